@@ -0,0 +1,350 @@
+#ifndef MATRIXDB_AGG_H
+#define MATRIXDB_AGG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "row.h"
+#include "arena.h"
+#include "sink.h"
+#include "sort.h"
+
+/*
+ * GROUP BY a with COUNT(b), SUM(b), MIN(b) and MAX(b).
+ *
+ * Unordered input goes through an open-addressing hash table of 32 byte
+ * groups, two per cache line, linear probing. Rows are processed in
+ * batches of AGG_BATCH: the slots of the whole batch are hashed first
+ * in a loop that vectorizes, the slots are prefetched, then the
+ * aggregates are updated. The table is sized before every batch so a
+ * batch never rehashes.
+ *
+ * Input sorted by a, the rows of a RangeSlice, needs no hashing at all:
+ * AggRun folds runs of equal a and emits a group when a changes, the
+ * groups come out in a order.
+ *
+ * Every group prints as "a,count,sum,min,max".
+ */
+#define AGG_BATCH 256
+#define AGG_MIN_BITS 10
+// Longest formatted group, "a,count,sum,min,max\n".
+#define AGG_MAX_LINE 80
+
+typedef struct AggGroup {
+    int64_t count; // 0 marks a free slot
+    int64_t sum;
+    int a;
+    int min;
+    int max;
+} AggGroup;
+
+typedef struct AggTable {
+    AggGroup *slots;
+    int bits;      // log2 of the number of slots
+    uint32_t mask;
+    uint32_t n;    // groups
+    Arena *arena;  // arena of the slots, NULL for malloc
+} AggTable;
+
+static inline uint32_t agg_slot_of(const AggTable *table, int a)
+{
+    // Fibonacci hashing, the top bits of the product
+    return (uint32_t)(((uint64_t)(uint32_t)a * 0x9E3779B97F4A7C15ull) >> (64 - table->bits));
+}
+
+static inline bool agg_init(AggTable *table, int bits, Arena *arena)
+{
+    memset(table, 0, sizeof(AggTable));
+    table->arena = arena;
+    table->bits = bits < AGG_MIN_BITS ? AGG_MIN_BITS : bits;
+    table->mask = (1u << table->bits) - 1;
+    table->slots = arena_alloc(arena, sizeof(AggGroup) << table->bits);
+    if (!table->slots)
+    {
+        return false;
+    }
+
+    memset(table->slots, 0, sizeof(AggGroup) << table->bits);
+    return true;
+}
+
+static inline void agg_free(AggTable *table)
+{
+    arena_free(table->arena, table->slots);
+    memset(table, 0, sizeof(AggTable));
+}
+
+/**
+ * @brief The slot of group a, claimed when a is new.
+ */
+static inline AggGroup* agg_find(AggTable *table, uint32_t slot, int a)
+{
+    AggGroup *group = &table->slots[slot];
+    while (group->count && group->a != a)
+    {
+        slot = (slot + 1) & table->mask;
+        group = &table->slots[slot];
+    }
+
+    if (!group->count)
+    {
+        group->a = a;
+        group->min = INT32_MAX;
+        group->max = INT32_MIN;
+        table->n++;
+    }
+    return group;
+}
+
+static inline void agg_fold(AggGroup *group, const AggGroup *other)
+{
+    group->count += other->count;
+    group->sum += other->sum;
+    group->min = other->min < group->min ? other->min : group->min;
+    group->max = other->max > group->max ? other->max : group->max;
+}
+
+/**
+ * @brief Keep the load at most 1/2 after n more groups.
+ */
+static inline bool agg_reserve(AggTable *table, uint32_t n)
+{
+    if ((uint64_t)(table->n + n)*2 <= (uint64_t)table->mask + 1)
+    {
+        return true;
+    }
+
+    int bits = table->bits;
+    while (((uint64_t)(table->n + n)*2) > (1ull << bits))
+    {
+        bits++;
+    }
+
+    AggTable grown;
+    if (bits > 31 || !agg_init(&grown, bits, table->arena))
+    {
+        return false;
+    }
+    for (uint32_t i = 0; i <= table->mask; i++)
+    {
+        const AggGroup *group = &table->slots[i];
+        if (group->count)
+        {
+            *agg_find(&grown, agg_slot_of(&grown, group->a), group->a) = *group;
+        }
+    }
+
+    agg_free(table);
+    *table = grown;
+    return true;
+}
+
+/**
+ * @brief Aggregate the rows (a[i], b[i]) for i in [0, n).
+ *
+ * @return false when out of memory.
+ */
+static inline bool agg_update(AggTable *table, const int *a, const int *b, int n)
+{
+    uint32_t slots[AGG_BATCH];
+
+    for (int base = 0; base < n; base += AGG_BATCH)
+    {
+        int m = n - base < AGG_BATCH ? n - base : AGG_BATCH;
+        if (!agg_reserve(table, (uint32_t)m))
+        {
+            return false;
+        }
+
+        const int *ka = a + base, *kb = b + base;
+        for (int i = 0; i < m; i++)
+        {
+            slots[i] = agg_slot_of(table, ka[i]);
+        }
+        for (int i = 0; i < m; i++)
+        {
+            __builtin_prefetch(&table->slots[slots[i]], 1);
+        }
+        for (int i = 0; i < m; i++)
+        {
+            AggGroup *group = agg_find(table, slots[i], ka[i]);
+            group->count++;
+            group->sum += kb[i];
+            group->min = kb[i] < group->min ? kb[i] : group->min;
+            group->max = kb[i] > group->max ? kb[i] : group->max;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Fold the groups of src into table, the merge of partial tables.
+ */
+static inline bool agg_merge(AggTable *table, const AggTable *src)
+{
+    if (!agg_reserve(table, src->n))
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i <= src->mask; i++)
+    {
+        const AggGroup *group = &src->slots[i];
+        if (group->count)
+        {
+            agg_fold(agg_find(table, agg_slot_of(table, group->a), group->a), group);
+        }
+    }
+    return true;
+}
+
+static inline int agg_compare(const void *x, const void *y)
+{
+    int a = ((const AggGroup *)x)->a, b = ((const AggGroup *)y)->a;
+    return (a > b) - (a < b);
+}
+
+/**
+ * @brief Move the groups of table to the front of its slots, sorted by
+ *        a. The table is unusable afterwards except for agg_free.
+ *
+ * @return The groups, table->n of them.
+ */
+static inline AggGroup* agg_sorted(AggTable *table)
+{
+    uint32_t n = 0;
+    for (uint32_t i = 0; i <= table->mask; i++)
+    {
+        if (table->slots[i].count)
+        {
+            table->slots[n++] = table->slots[i];
+        }
+    }
+
+    // the radix sort of sort.h orders (index, a) pairs by a, then the
+    // groups are permuted, qsort without the memory for it.
+    Row *keys = malloc(sizeof(Row)*(n ? n : 1));
+    Row *scratch = malloc(sizeof(Row)*(n ? n : 1));
+    AggGroup *sorted = malloc(sizeof(AggGroup)*(n ? n : 1));
+    if (keys && scratch && sorted)
+    {
+        for (uint32_t i = 0; i < n; i++)
+        {
+            keys[i].a = (int)i;
+            keys[i].b = table->slots[i].a;
+        }
+        sort_rows_by_b(keys, (int)n, scratch, NULL);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            sorted[i] = table->slots[keys[i].a];
+        }
+        memcpy(table->slots, sorted, sizeof(AggGroup)*n);
+    }
+    else
+    {
+        qsort(table->slots, n, sizeof(AggGroup), agg_compare);
+    }
+
+    free(keys);
+    free(scratch);
+    free(sorted);
+    return table->slots;
+}
+
+/**
+ * @brief Groups written to a sink, OFFSET n LIMIT k keeps the groups
+ *        [offset, end) in output order.
+ */
+typedef struct AggOutput {
+    ResultSink *sink;
+    int64_t offset;
+    int64_t end;
+    int64_t rank;  // groups emitted so far
+} AggOutput;
+
+static inline void agg_emit(AggOutput *out, const AggGroup *group)
+{
+    if (out->rank >= out->offset && out->rank < out->end)
+    {
+        char line[AGG_MAX_LINE];
+        int len = sink_itoa(group->a, line);
+        line[len++] = ',';
+        len += sink_ltoa(group->count, line + len);
+        line[len++] = ',';
+        len += sink_ltoa(group->sum, line + len);
+        line[len++] = ',';
+        len += sink_itoa(group->min, line + len);
+        line[len++] = ',';
+        len += sink_itoa(group->max, line + len);
+        line[len++] = '\n';
+        sink_text(out->sink, line, len);
+    }
+    out->rank++;
+}
+
+static inline bool agg_output_done(const AggOutput *out)
+{
+    return out->rank >= out->end;
+}
+
+/**
+ * @brief Streaming aggregation of rows sorted by a.
+ */
+typedef struct AggRun {
+    AggGroup group; // the group of the current a, open when count > 0
+    AggOutput *out;
+} AggRun;
+
+/**
+ * @brief Aggregate rows[0, n), sorted by a and following the rows given
+ *        before. Every run of equal a is folded in a tight loop, rows
+ *        past the limit of the output are skipped.
+ */
+static inline void agg_run_rows(AggRun *run, const Row *rows, int n)
+{
+    for (int i = 0; i < n && !agg_output_done(run->out); )
+    {
+        int a = rows[i].a;
+        AggGroup part = { 0, 0, a, INT32_MAX, INT32_MIN };
+        int j = i;
+        for (; j < n && rows[j].a == a; j++)
+        {
+            part.sum += rows[j].b;
+            part.min = rows[j].b < part.min ? rows[j].b : part.min;
+            part.max = rows[j].b > part.max ? rows[j].b : part.max;
+        }
+        part.count = j - i;
+        i = j;
+
+        if (run->group.count && run->group.a == a)
+        {
+            agg_fold(&run->group, &part);
+        }
+        else
+        {
+            if (run->group.count)
+            {
+                agg_emit(run->out, &run->group);
+            }
+            run->group = part;
+        }
+    }
+}
+
+/**
+ * @brief Emit the open group, the end of the input.
+ */
+static inline void agg_run_finish(AggRun *run)
+{
+    if (run->group.count)
+    {
+        agg_emit(run->out, &run->group);
+    }
+    run->group.count = 0;
+}
+
+#endif // MATRIXDB_AGG_H
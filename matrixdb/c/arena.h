@@ -0,0 +1,218 @@
+#ifndef MATRIXDB_ARENA_H
+#define MATRIXDB_ARENA_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+
+#include "stats.h"
+
+/*
+ * Query scoped bump allocator. Everything a query allocates (result
+ * buffers, sort scratch space, slice lists) comes from the chunks of its
+ * arena and is released at once by arena_reset, which is O(1) and keeps
+ * the chunks for the next query. Chunks are 2 MB aligned so the kernel
+ * can back them with transparent huge pages.
+ *
+ * The helpers arena_alloc/arena_realloc/arena_free accept a NULL arena
+ * and then fall back to malloc/realloc/free, so containers can take an
+ * optional arena.
+ */
+#define ARENA_CHUNK_SIZE (2u << 20)
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaChunk ArenaChunk;
+struct ArenaChunk {
+    ArenaChunk *next;
+    size_t size; // bytes of the chunk including this header
+    size_t used; // bytes handed out including this header
+};
+
+typedef struct Arena {
+    ArenaChunk *head; // first chunk, reset rewinds to it
+    ArenaChunk *cur;  // chunk allocations come from
+    void  *last;      // most recent allocation, can grow in place
+    size_t allocated; // bytes handed out since the last reset
+} Arena;
+
+#define ARENA_HEADER (((sizeof(ArenaChunk) + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT) * ARENA_ALIGNMENT)
+
+static inline void arena_init(Arena *arena)
+{
+    memset(arena, 0, sizeof(Arena));
+}
+
+static inline ArenaChunk* arena_new_chunk(size_t min_size)
+{
+    size_t size = ARENA_CHUNK_SIZE;
+    while (size < min_size + ARENA_HEADER)
+    {
+        size += ARENA_CHUNK_SIZE;
+    }
+
+    void *mem = NULL;
+    if (posix_memalign(&mem, ARENA_CHUNK_SIZE, size) != 0)
+    {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(mem, size, MADV_HUGEPAGE);
+#endif
+
+    STATS_COUNT(STATS_ALLOCS, 1);
+
+    ArenaChunk *chunk = (ArenaChunk *)mem;
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = ARENA_HEADER;
+    return chunk;
+}
+
+/**
+ * @brief Allocate size bytes aligned to align (a power of two) from
+ *        arena, malloc when arena is NULL.
+ *
+ * @return The memory, NULL when out of memory.
+ */
+static inline void* arena_alloc_aligned(Arena *arena, size_t size, size_t align)
+{
+    if (!arena)
+    {
+        void *mem = NULL;
+        return posix_memalign(&mem, align < sizeof(void *) ? sizeof(void *) : align, size ? size : 1) == 0 ? mem : NULL;
+    }
+
+    if (align < ARENA_ALIGNMENT)
+    {
+        align = ARENA_ALIGNMENT;
+    }
+
+    ArenaChunk *chunk = arena->cur;
+    while (chunk)
+    {
+        size_t offset = (chunk->used + align - 1) & ~(align - 1);
+        if (offset + size <= chunk->size)
+        {
+            chunk->used = offset + size;
+            arena->cur = chunk;
+            arena->last = (char *)chunk + offset;
+            arena->allocated += size;
+            return arena->last;
+        }
+
+        // chunks after cur are left over from before the last reset
+        chunk = chunk->next;
+        if (chunk)
+        {
+            chunk->used = ARENA_HEADER;
+        }
+    }
+
+    chunk = arena_new_chunk(size + align);
+    if (!chunk)
+    {
+        return NULL;
+    }
+
+    // append behind the current chunk, chunks skipped above stay in the
+    // list and are used again after the next reset
+    if (!arena->head)
+    {
+        arena->head = chunk;
+    }
+    else
+    {
+        ArenaChunk *tail = arena->cur;
+        while (tail->next)
+        {
+            tail = tail->next;
+        }
+        tail->next = chunk;
+    }
+    arena->cur = chunk;
+
+    return arena_alloc_aligned(arena, size, align);
+}
+
+static inline void* arena_alloc(Arena *arena, size_t size)
+{
+    return arena_alloc_aligned(arena, size, ARENA_ALIGNMENT);
+}
+
+/**
+ * @brief Grow ptr (old_size bytes) to new_size bytes. The most recent
+ *        allocation grows in place while its chunk has room, anything
+ *        else is copied. realloc when arena is NULL.
+ */
+static inline void* arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t new_size)
+{
+    if (!arena)
+    {
+        return realloc(ptr, new_size);
+    }
+
+    if (ptr && ptr == arena->last)
+    {
+        ArenaChunk *chunk = arena->cur;
+        size_t offset = (size_t)((char *)ptr - (char *)chunk);
+        if (offset + new_size <= chunk->size)
+        {
+            chunk->used = offset + new_size;
+            arena->allocated += new_size > old_size ? new_size - old_size : 0;
+            return ptr;
+        }
+    }
+
+    void *mem = arena_alloc(arena, new_size);
+    if (mem && ptr)
+    {
+        memcpy(mem, ptr, old_size < new_size ? old_size : new_size);
+    }
+    return mem;
+}
+
+/**
+ * @brief Memory of an arena is released by arena_reset, only a NULL
+ *        arena frees ptr.
+ */
+static inline void arena_free(Arena *arena, void *ptr)
+{
+    if (!arena)
+    {
+        free(ptr);
+    }
+}
+
+/**
+ * @brief Release everything allocated from arena in O(1), the chunks
+ *        are kept for reuse.
+ */
+static inline void arena_reset(Arena *arena)
+{
+    arena->cur = arena->head;
+    arena->last = NULL;
+    arena->allocated = 0;
+    if (arena->head)
+    {
+        arena->head->used = ARENA_HEADER;
+    }
+}
+
+/**
+ * @brief Return all chunks of arena to the system.
+ */
+static inline void arena_destroy(Arena *arena)
+{
+    ArenaChunk *chunk = arena->head;
+    while (chunk)
+    {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena_init(arena);
+}
+
+#endif // MATRIXDB_ARENA_H
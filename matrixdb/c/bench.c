@@ -0,0 +1,436 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "row.h"
+#include "table.h"
+#include "search.h"
+#include "parser.h"
+#include "arena.h"
+#include "filter.h"
+#include "zonemap.h"
+#include "sink.h"
+#include "sort.h"
+#include "agg.h"
+#include "join.h"
+#include "bench.h"
+
+/*
+ * Benchmark of the query engines over generated tables of every size and
+ * a range query of every selectivity, see bench.h for the statistics.
+ * The engines write their rows to a sink on /dev/null unless -o names a
+ * file, so formatting is measured and the terminal is not.
+ *
+ *    scan   columnar filter kernel over every row, task1
+ *    zone   the same scan skipping blocks by the zone map
+ *    slice  binary searched slices of the (a,b) sorted rows, task2
+ *    order  slices collected and radix sorted by b, task3 and task4
+ *    group  GROUP BY a over the selected rows by hash aggregation
+ *    join   sort-merge self join on a of the selected rows
+ *
+ * Usage: bench [-e engines] [-n sizes] [-s selectivities] [-r runs]
+ *              [-w warmup] [-f text|csv|json] [-o path]
+ *    engines        comma separated, default all of them
+ *    sizes          comma separated row counts, K/M suffixes allowed,
+ *                   default 1M,4M
+ *    selectivities  comma separated fractions, default 0.0001,0.01,0.1,1
+ *    runs, warmup   timed and untimed runs per case, default 20 and 3
+ *
+ * Threads follow MATRIXDB_THREADS, see parallel.h.
+ */
+#define N_BASE_B 10
+// Rows of every a, the join pairs each with the other rows of its a.
+#define ROWS_PER_A 4
+#define DEFAULT_SIZES "1M,4M"
+#define DEFAULT_SELECTIVITIES "0.0001,0.01,0.1,1"
+#define DEFAULT_RUNS 20
+#define DEFAULT_WARMUP 3
+
+// Query scoped allocations, released at once when the case is done.
+Arena query_arena;
+
+// Buffered writer of the result rows, see sink.h.
+ResultSink result_sink;
+
+/**
+ * @brief Inputs of one case, every engine reads what it needs.
+ */
+typedef struct BenchCase {
+    const Row *rows;      // sorted by (a,b)
+    const Table *table;   // the same rows as columns
+    const ZoneMap *map;   // zone map of table
+    int nrows;
+    const Query *query;
+    int *sel;             // room for nrows
+    Row *collect;         // room for nrows
+    Row *scratch;         // room for nrows
+    int nthreads;
+} BenchCase;
+
+typedef struct BenchEngine {
+    const char *name;
+    int64_t (*run)(const BenchCase *c);
+} BenchEngine;
+
+static uint64_t next_random(uint64_t *state)
+{
+    // splitmix64
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Rows sorted by (a,b), ROWS_PER_A rows for every a in
+ *        [0, nrows/ROWS_PER_A) with random b in N_BASE_B*[0, 100).
+ */
+static Row* generate_rows(int nrows)
+{
+    Row *rows = malloc(sizeof(Row)*(nrows > 0 ? nrows : 1));
+    if (!rows)
+    {
+        return NULL;
+    }
+
+    uint64_t state = 42;
+    for (int i = 0; i < nrows; i++)
+    {
+        Row row = { i / ROWS_PER_A, N_BASE_B*(int)(next_random(&state) % 100) };
+        // insertion into the rows of the same a keeps them sorted by b
+        int j = i;
+        for (; j > 0 && rows[j - 1].a == row.a && rows[j - 1].b > row.b; j--)
+        {
+            rows[j] = rows[j - 1];
+        }
+        rows[j] = row;
+    }
+
+    return rows;
+}
+
+/**
+ * @brief Selection of the query over the columns, filter kernel when the
+ *        query has a predicate shape, the generic evaluation otherwise.
+ */
+static int bench_select(const BenchCase *c, const ZoneMap *map)
+{
+    int a_in[FILTER_MAX_IN_LIST];
+    ScanPredicate pred;
+    QueryEnv query_env = { c->query, c->table->a, c->table->b };
+    FilterEnv filter_env = { &pred, c->table->a, c->table->b };
+    ZoneScan scan = { map, zone_test_query, c->query, query_env_select, &query_env };
+
+    if (filter_from_query(c->query, &pred, a_in, FILTER_MAX_IN_LIST))
+    {
+        // resolve the kernel before the threads race on it
+        filter_select(&pred, c->table->a, c->table->b, 0, 0, c->sel);
+        scan.may_match = zone_test_predicate;
+        scan.test_env = &pred;
+        scan.select = filter_env_select;
+        scan.env = &filter_env;
+    }
+
+    return zone_scan_parallel(&scan, c->nrows, c->nthreads, c->sel);
+}
+
+static int64_t run_scan(const BenchCase *c)
+{
+    int found = bench_select(c, NULL);
+    sink_select(&result_sink, c->table->a, c->table->b, c->sel, found, c->nthreads);
+    sink_flush(&result_sink);
+    return found;
+}
+
+static int64_t run_zone(const BenchCase *c)
+{
+    int found = bench_select(c, c->map);
+    sink_select(&result_sink, c->table->a, c->table->b, c->sel, found, c->nthreads);
+    sink_flush(&result_sink);
+    return found;
+}
+
+/**
+ * @brief Matching rows of the slices, to the sink or into out.
+ */
+static int bench_slices(const BenchCase *c, Row *out)
+{
+    int found = 0;
+    for (int i = 0; i < c->query->nslices; i++)
+    {
+        RangeSlice slice = c->query->slices[i];
+        int left_idx, right_idx;
+        rows_slice_range(c->rows, c->nrows, slice, &left_idx, &right_idx);
+
+        for (int j = left_idx; j < right_idx; j++)
+        {
+            if (slice.covered || query_match(c->query, c->rows[j]))
+            {
+                if (out)
+                {
+                    out[found] = c->rows[j];
+                }
+                else
+                {
+                    sink_row(&result_sink, c->rows[j].a, c->rows[j].b);
+                }
+                found++;
+            }
+        }
+    }
+    return found;
+}
+
+static int64_t run_slice(const BenchCase *c)
+{
+    int found = bench_slices(c, NULL);
+    sink_flush(&result_sink);
+    return found;
+}
+
+static int64_t run_order(const BenchCase *c)
+{
+    int found = bench_slices(c, c->collect);
+    sort_rows_by_b(c->collect, found, c->scratch, NULL);
+    sink_rows(&result_sink, c->collect, found, c->nthreads);
+    sink_flush(&result_sink);
+    return found;
+}
+
+static int64_t run_group(const BenchCase *c)
+{
+    int found = bench_select(c, c->map);
+
+    AggTable table;
+    if (!agg_init(&table, AGG_MIN_BITS, NULL))
+    {
+        return -1;
+    }
+
+    int a[AGG_BATCH], b[AGG_BATCH];
+    bool ok = true;
+    for (int base = 0; base < found && ok; base += AGG_BATCH)
+    {
+        int n = found - base < AGG_BATCH ? found - base : AGG_BATCH;
+        for (int i = 0; i < n; i++)
+        {
+            a[i] = c->table->a[c->sel[base + i]];
+            b[i] = c->table->b[c->sel[base + i]];
+        }
+        ok = agg_update(&table, a, b, n);
+    }
+
+    uint32_t ngroups = table.n;
+    AggGroup *groups = agg_sorted(&table);
+    AggOutput out = { &result_sink, 0, INT64_MAX, 0 };
+    for (uint32_t i = 0; i < ngroups && ok; i++)
+    {
+        agg_emit(&out, &groups[i]);
+    }
+    sink_flush(&result_sink);
+    agg_free(&table);
+
+    return ok ? (int64_t)ngroups : -1;
+}
+
+static int64_t run_join(const BenchCase *c)
+{
+    JoinOutput out = { &result_sink, 0, INT64_MAX, 0 };
+    bool ok = join_merge(c->rows, c->nrows, c->rows, c->nrows, c->query, &out);
+    sink_flush(&result_sink);
+    return ok ? join_output_found(&out) : -1;
+}
+
+static const BenchEngine engines[] = {
+    { "scan", run_scan },
+    { "zone", run_zone },
+    { "slice", run_slice },
+    { "order", run_order },
+    { "group", run_group },
+    { "join", run_join },
+};
+#define N_ENGINES ((int)(sizeof(engines)/sizeof(engines[0])))
+
+/**
+ * @brief Whether name is in the comma separated list, NULL lists all.
+ */
+static bool listed(const char *list, const char *name)
+{
+    if (!list)
+    {
+        return true;
+    }
+
+    size_t len = strlen(name);
+    for (const char *cur = list; *cur; )
+    {
+        const char *end = strchr(cur, ',');
+        size_t n = end ? (size_t)(end - cur) : strlen(cur);
+        if (n == len && strncmp(cur, name, len) == 0)
+        {
+            return true;
+        }
+        cur += n + (end != NULL);
+    }
+    return false;
+}
+
+/**
+ * @brief Run every listed engine on nrows rows with the query of every
+ *        selectivity.
+ *
+ * @return false when out of memory.
+ */
+static bool bench_size(int nrows, const char *selectivities, const char *engine_list,
+                        int runs, int warmup, BenchFormat format)
+{
+    Row *rows = generate_rows(nrows);
+    Table *table = rows ? table_from_rows(rows, nrows) : NULL;
+    ZoneMap *map = table ? zonemap_build(table) : NULL;
+    int *sel = malloc(sizeof(int)*(nrows > 0 ? nrows : 1));
+    Row *collect = malloc(sizeof(Row)*(nrows > 0 ? nrows : 1));
+    Row *scratch = malloc(sizeof(Row)*(nrows > 0 ? nrows : 1));
+    double *samples = malloc(sizeof(double)*(runs > 0 ? runs : 1));
+    bool ok = rows && table && map && sel && collect && scratch && samples;
+
+    for (const char *cur = selectivities; ok && *cur; )
+    {
+        char *end;
+        double selectivity = strtod(cur, &end);
+        if (end == cur)
+        {
+            fprintf(stderr, "invalid selectivity list: %s\n", selectivities);
+            break;
+        }
+        cur = *end == ',' ? end + 1 : end;
+
+        // the a of the generated rows are dense, a prefix of them selects
+        // the fraction of the rows
+        char text[128];
+        long na = (long)(selectivity*nrows/ROWS_PER_A + 0.5);
+        snprintf(text, sizeof(text), "a >= 0 AND a < %ld", na);
+        char err[256];
+        Query *query = query_parse(text, &query_arena, err, sizeof(err));
+        if (!query)
+        {
+            fprintf(stderr, "invalid query: %s\n", err);
+            continue;
+        }
+
+        BenchCase c = { rows, table, map, nrows, query, sel, collect, scratch, parallel_threads() };
+        for (int e = 0; e < N_ENGINES; e++)
+        {
+            if (!listed(engine_list, engines[e].name))
+            {
+                continue;
+            }
+
+            BenchResult result = { engines[e].name, nrows, selectivity, 0, 0, 0, 0, 0, 0, 0 };
+            for (int r = 0; r < warmup; r++)
+            {
+                engines[e].run(&c);
+            }
+            for (int r = 0; r < runs; r++)
+            {
+                double before = bench_now_ns();
+                result.found = engines[e].run(&c);
+                samples[r] = bench_now_ns() - before;
+            }
+            bench_summarize(&result, samples, runs, (double)nrows*sizeof(Row));
+            bench_report(stdout, format, &result);
+        }
+
+        arena_reset(&query_arena);
+    }
+
+    if (!ok)
+    {
+        fprintf(stderr, "WARN: %d rows skipped, out of memory\n", nrows);
+    }
+
+    free(samples);
+    free(scratch);
+    free(collect);
+    free(sel);
+    zonemap_free(map);
+    table_free(table);
+    free(rows);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    const char *engine_list = NULL;
+    const char *sizes = DEFAULT_SIZES;
+    const char *selectivities = DEFAULT_SELECTIVITIES;
+    const char *output = "/dev/null";
+    int runs = DEFAULT_RUNS, warmup = DEFAULT_WARMUP;
+    BenchFormat format = BENCH_TEXT;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "e:n:s:r:w:f:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'e': engine_list = optarg; break;
+        case 'n': sizes = optarg; break;
+        case 's': selectivities = optarg; break;
+        case 'r': runs = atoi(optarg); break;
+        case 'w': warmup = atoi(optarg); break;
+        case 'o': output = optarg; break;
+        case 'f':
+            if (!bench_parse_format(optarg, &format))
+            {
+                fprintf(stderr, "invalid format: %s, text, csv or json expected\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-e engines] [-n sizes] [-s selectivities] [-r runs] "
+                    "[-w warmup] [-f text|csv|json] [-o path]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (runs < 1 || runs > BENCH_MAX_RUNS || warmup < 0)
+    {
+        fprintf(stderr, "invalid runs: %d runs and %d warmup runs\n", runs, warmup);
+        return 1;
+    }
+
+    int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || !sink_init(&result_sink, fd))
+    {
+        fprintf(stderr, "cannot open %s\n", output);
+        return 1;
+    }
+    arena_init(&query_arena);
+
+    bench_report_header(stdout, format);
+    const char *cur = sizes;
+    while (*cur)
+    {
+        char *end;
+        long nrows = bench_parse_count(cur, &end);
+        if (end == cur)
+        {
+            fprintf(stderr, "invalid size list: %s\n", sizes);
+            return 1;
+        }
+        if (nrows > 0 && nrows <= INT32_MAX)
+        {
+            bench_size((int)nrows, selectivities, engine_list, runs, warmup, format);
+        }
+
+        cur = *end == ',' ? end + 1 : end;
+    }
+
+    arena_destroy(&query_arena);
+    sink_close(&result_sink);
+    close(fd);
+    return 0;
+}
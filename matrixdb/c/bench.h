@@ -0,0 +1,164 @@
+#ifndef MATRIXDB_BENCH_H
+#define MATRIXDB_BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+/*
+ * Benchmark harness. A case runs warmup times untimed, then runs times
+ * timed, every run is one wall clock sample from CLOCK_MONOTONIC. The
+ * report holds the p50, p99 and max of the samples, and rows/s and
+ * bytes/s of the input at the median, as an aligned table, CSV or JSON
+ * lines.
+ */
+#define BENCH_MAX_RUNS 100000
+
+typedef enum BenchFormat {
+    BENCH_TEXT,
+    BENCH_CSV,
+    BENCH_JSON,
+} BenchFormat;
+
+typedef struct BenchResult {
+    const char *engine;
+    long nrows;          // input rows
+    double selectivity;  // fraction of the rows the query selects
+    int64_t found;       // rows the engine produced, of the last run
+    int runs;
+    double p50_ns;
+    double p99_ns;
+    double max_ns;
+    double rows_per_s;   // input rows over the median
+    double bytes_per_s;  // input bytes over the median
+} BenchResult;
+
+static inline double bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+static inline int bench_compare(const void *x, const void *y)
+{
+    double a = *(const double *)x, b = *(const double *)y;
+    return (a > b) - (a < b);
+}
+
+/**
+ * @brief Nearest rank percentile p in [0, 100] of n sorted samples.
+ */
+static inline double bench_percentile(const double *sorted, int n, double p)
+{
+    if (n <= 0)
+    {
+        return 0;
+    }
+
+    int rank = (int)(p/100.0*n + 0.999999);
+    rank = rank < 1 ? 1 : rank > n ? n : rank;
+    return sorted[rank - 1];
+}
+
+/**
+ * @brief Summarize the samples of a case, samples are sorted in place.
+ */
+static inline void bench_summarize(BenchResult *result, double *samples, int n, double bytes)
+{
+    qsort(samples, n, sizeof(double), bench_compare);
+    result->runs = n;
+    result->p50_ns = bench_percentile(samples, n, 50);
+    result->p99_ns = bench_percentile(samples, n, 99);
+    result->max_ns = n > 0 ? samples[n - 1] : 0;
+
+    double seconds = result->p50_ns / 1e9;
+    result->rows_per_s = seconds > 0 ? result->nrows / seconds : 0;
+    result->bytes_per_s = seconds > 0 ? bytes / seconds : 0;
+}
+
+/**
+ * @brief Parse a count with an optional K or M suffix, such as 4M.
+ */
+static inline long bench_parse_count(const char *s, char **end)
+{
+    long n = strtol(s, end, 10);
+    if (**end == 'K' || **end == 'k')
+    {
+        n *= 1000;
+        (*end)++;
+    }
+    else if (**end == 'M' || **end == 'm')
+    {
+        n *= 1000000;
+        (*end)++;
+    }
+    return n;
+}
+
+static inline bool bench_parse_format(const char *name, BenchFormat *format)
+{
+    if (strcmp(name, "text") == 0)
+    {
+        *format = BENCH_TEXT;
+    }
+    else if (strcmp(name, "csv") == 0)
+    {
+        *format = BENCH_CSV;
+    }
+    else if (strcmp(name, "json") == 0)
+    {
+        *format = BENCH_JSON;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+static inline void bench_report_header(FILE *out, BenchFormat format)
+{
+    if (format == BENCH_TEXT)
+    {
+        fprintf(out, "%-8s %12s %8s %12s %6s %10s %10s %10s %12s %10s\n", "engine", "rows",
+                "select", "found", "runs", "p50(ms)", "p99(ms)", "max(ms)", "Mrows/s", "MB/s");
+    }
+    else if (format == BENCH_CSV)
+    {
+        fprintf(out, "engine,rows,selectivity,found,runs,p50_ns,p99_ns,max_ns,rows_per_s,bytes_per_s\n");
+    }
+}
+
+/**
+ * @brief One line per result, JSON comes as one object per line.
+ */
+static inline void bench_report(FILE *out, BenchFormat format, const BenchResult *r)
+{
+    if (format == BENCH_TEXT)
+    {
+        fprintf(out, "%-8s %12ld %8.4f %12lld %6d %10.3f %10.3f %10.3f %12.1f %10.1f\n",
+                r->engine, r->nrows, r->selectivity, (long long)r->found, r->runs,
+                r->p50_ns/1e6, r->p99_ns/1e6, r->max_ns/1e6, r->rows_per_s/1e6, r->bytes_per_s/1e6);
+    }
+    else if (format == BENCH_CSV)
+    {
+        fprintf(out, "%s,%ld,%g,%lld,%d,%.0f,%.0f,%.0f,%.0f,%.0f\n",
+                r->engine, r->nrows, r->selectivity, (long long)r->found, r->runs,
+                r->p50_ns, r->p99_ns, r->max_ns, r->rows_per_s, r->bytes_per_s);
+    }
+    else
+    {
+        fprintf(out, "{\"engine\":\"%s\",\"rows\":%ld,\"selectivity\":%g,\"found\":%lld,"
+                "\"runs\":%d,\"p50_ns\":%.0f,\"p99_ns\":%.0f,\"max_ns\":%.0f,"
+                "\"rows_per_s\":%.0f,\"bytes_per_s\":%.0f}\n",
+                r->engine, r->nrows, r->selectivity, (long long)r->found, r->runs,
+                r->p50_ns, r->p99_ns, r->max_ns, r->rows_per_s, r->bytes_per_s);
+    }
+    fflush(out);
+}
+
+#endif // MATRIXDB_BENCH_H
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "row.h"
+#include "search.h"
+#include "eytzinger.h"
+#include "lookup.h"
+
+/*
+ * Compare plain branchless binary search (rows_lower_bound) with the
+ * Eytzinger layout (eytzinger_lower_bound) on sorted tables, one exact
+ * lookup at a time and batched with interleaved searches (lookup_batch
+ * on one thread, over the rows and over the layout).
+ *
+ * Usage: bench_search [sizes] [queries]
+ *    sizes   comma separated row counts, K/M suffixes allowed,
+ *            default 1M,4M,64M,256M
+ *    queries number of random lookups per size, default 1M
+ */
+#define DEFAULT_SIZES "1M,4M,64M,256M"
+#define DEFAULT_QUERIES 1000000
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+    // splitmix64
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static long parse_count(const char *s, char **end)
+{
+    long n = strtol(s, end, 10);
+    if (**end == 'K' || **end == 'k')
+    {
+        n *= 1000;
+        (*end)++;
+    }
+    else if (**end == 'M' || **end == 'm')
+    {
+        n *= 1000000;
+        (*end)++;
+    }
+    return n;
+}
+
+static void bench_size(long nrows, int nqueries)
+{
+    Row *rows = malloc(sizeof(Row)*nrows);
+    uint64_t *queries = malloc(sizeof(uint64_t)*nqueries);
+    if (!rows || !queries)
+    {
+        printf("%12ld  skipped, out of memory\n", nrows);
+        free(rows);
+        free(queries);
+        return;
+    }
+
+    // sorted rows with a few b per a, queries hit and miss about equally
+    for (long i = 0; i < nrows; i++)
+    {
+        rows[i].a = (int)(i / 4) * 2;
+        rows[i].b = (int)(i % 4) * 10;
+    }
+    uint64_t state = 42;
+    for (int q = 0; q < nqueries; q++)
+    {
+        uint64_t r = next_random(&state);
+        Row probe = { (int)(r % (uint64_t)(nrows/2 + 1)), (int)((r >> 40) % 40) };
+        queries[q] = row_key(probe);
+    }
+
+    double before = now_ns();
+    Eytzinger *tree = eytzinger_build(rows, (int)nrows);
+    double build_ns = now_ns() - before;
+    if (!tree)
+    {
+        printf("%12ld  skipped, out of memory\n", nrows);
+        free(rows);
+        free(queries);
+        return;
+    }
+
+    int *idx = malloc(sizeof(int)*(nqueries > 0 ? nqueries : 1));
+    if (!idx)
+    {
+        printf("%12ld  skipped, out of memory\n", nrows);
+        eytzinger_free(tree);
+        free(rows);
+        free(queries);
+        return;
+    }
+
+    // the checksums keep the searches alive and verify they all agree,
+    // a key adds the index of its row or -1 when it is missing.
+    long sum_binary = 0, sum_eytz = 0, sum_batch = 0, sum_ebatch = 0;
+
+    before = now_ns();
+    for (int q = 0; q < nqueries; q++)
+    {
+        int pos = rows_lower_bound(rows, (int)nrows, queries[q]);
+        sum_binary += pos < nrows && row_key(rows[pos]) == queries[q] ? pos : -1;
+    }
+    double binary_ns = (now_ns() - before) / nqueries;
+
+    before = now_ns();
+    for (int q = 0; q < nqueries; q++)
+    {
+        int pos = eytzinger_lower_bound(tree, queries[q]);
+        sum_eytz += pos < nrows && row_key(rows[pos]) == queries[q] ? pos : -1;
+    }
+    double eytz_ns = (now_ns() - before) / nqueries;
+
+    before = now_ns();
+    lookup_batch(NULL, rows, (int)nrows, queries, nqueries, idx, NULL, 1);
+    double batch_ns = (now_ns() - before) / nqueries;
+    for (int q = 0; q < nqueries; q++)
+    {
+        sum_batch += idx[q];
+    }
+
+    before = now_ns();
+    lookup_batch(tree, rows, (int)nrows, queries, nqueries, idx, NULL, 1);
+    double ebatch_ns = (now_ns() - before) / nqueries;
+    for (int q = 0; q < nqueries; q++)
+    {
+        sum_ebatch += idx[q];
+    }
+
+    bool agree = sum_binary == sum_eytz && sum_binary == sum_batch && sum_binary == sum_ebatch;
+    printf("%12ld  %10.1f  %10.1f  %10.1f  %10.1f  %8.2fx  %10.1f%s\n", nrows, binary_ns,
+            eytz_ns, batch_ns, ebatch_ns, binary_ns / ebatch_ns, build_ns / 1e6,
+            agree ? "" : "  MISMATCH");
+
+    eytzinger_free(tree);
+    free(idx);
+    free(rows);
+    free(queries);
+}
+
+int main(int argc, char **argv)
+{
+    const char *sizes = argc > 1 ? argv[1] : DEFAULT_SIZES;
+    int nqueries = argc > 2 ? atoi(argv[2]) : DEFAULT_QUERIES;
+
+    printf("%12s  %10s  %10s  %10s  %10s  %9s  %10s\n", "rows", "binary(ns)", "eytz(ns)",
+            "batch(ns)", "ebatch(ns)", "speedup", "build(ms)");
+
+    const char *cur = sizes;
+    while (*cur)
+    {
+        char *end;
+        long nrows = parse_count(cur, &end);
+        if (end == cur)
+        {
+            fprintf(stderr, "invalid size list: %s\n", sizes);
+            return 1;
+        }
+        if (nrows > 0 && nrows <= INT32_MAX)
+        {
+            bench_size(nrows, nqueries);
+        }
+
+        cur = *end == ',' ? end + 1 : end;
+    }
+
+    return 0;
+}
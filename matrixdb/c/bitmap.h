@@ -0,0 +1,451 @@
+#ifndef MATRIXDB_BITMAP_H
+#define MATRIXDB_BITMAP_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "filter.h"
+#include "zonemap.h"
+
+/*
+ * Bitmap index on column a, one compressed bitmap of row ids per
+ * distinct value of a. The bitmaps are Roaring style: row ids are split
+ * into the high 16 bits, the key of a container, and the low 16 bits
+ * kept in the container, a sorted array of at most BITMAP_ARRAY_MAX
+ * values or a bitset of 65536 bits beyond that.
+ *
+ * An IN-list is resolved by OR-ing the bitmaps of its values container
+ * by container, AND-ed with the blocks whose zone admits the b range,
+ * and b is then only read for the rows left. The work depends on the
+ * number of matching rows, not on the size of the table.
+ */
+#define BITMAP_ARRAY_MAX 4096
+#define BITMAP_WORDS 1024
+// Columns with more distinct values are not indexed.
+#define BITMAP_MAX_VALUES (1 << 16)
+
+typedef struct BitmapContainer {
+    uint16_t key;    // high 16 bits of the row ids
+    int card;        // number of row ids
+    int cap;         // capacity of array
+    uint16_t *array; // sorted low 16 bits, card <= BITMAP_ARRAY_MAX
+    uint64_t *bits;  // BITMAP_WORDS words once card exceeds it
+} BitmapContainer;
+
+typedef struct Bitmap {
+    BitmapContainer *containers; // sorted by key
+    int n;
+    int cap;
+} Bitmap;
+
+typedef struct BitmapIndex {
+    int nvalues;
+    int *values;     // distinct values of a, ascending
+    Bitmap *bitmaps; // bitmaps[i] holds the rows with a == values[i]
+    size_t bytes;    // memory of the containers
+} BitmapIndex;
+
+static inline void bitmap_free(Bitmap *bm)
+{
+    for (int i = 0; i < bm->n; i++)
+    {
+        free(bm->containers[i].array);
+        free(bm->containers[i].bits);
+    }
+    free(bm->containers);
+    memset(bm, 0, sizeof(Bitmap));
+}
+
+/**
+ * @brief Add row, larger than every row added before.
+ *
+ * @return false when out of memory.
+ */
+static inline bool bitmap_append(Bitmap *bm, int row, size_t *bytes)
+{
+    uint16_t key = (uint16_t)((uint32_t)row >> 16), low = (uint16_t)row;
+
+    if (bm->n == 0 || bm->containers[bm->n - 1].key != key)
+    {
+        if (bm->n == bm->cap)
+        {
+            int cap = bm->cap ? bm->cap*2 : 4;
+            BitmapContainer *containers = realloc(bm->containers, sizeof(BitmapContainer)*cap);
+            if (!containers)
+            {
+                return false;
+            }
+            bm->containers = containers;
+            *bytes += sizeof(BitmapContainer)*(cap - bm->cap);
+            bm->cap = cap;
+        }
+        memset(&bm->containers[bm->n], 0, sizeof(BitmapContainer));
+        bm->containers[bm->n++].key = key;
+    }
+
+    BitmapContainer *c = &bm->containers[bm->n - 1];
+    if (c->bits)
+    {
+        c->bits[low >> 6] |= 1ull << (low & 63);
+        c->card++;
+        return true;
+    }
+
+    if (c->card == BITMAP_ARRAY_MAX)
+    {
+        // the array would outgrow the bitset, convert
+        c->bits = calloc(BITMAP_WORDS, sizeof(uint64_t));
+        if (!c->bits)
+        {
+            return false;
+        }
+        for (int i = 0; i < c->card; i++)
+        {
+            c->bits[c->array[i] >> 6] |= 1ull << (c->array[i] & 63);
+        }
+        c->bits[low >> 6] |= 1ull << (low & 63);
+        c->card++;
+        *bytes += BITMAP_WORDS*sizeof(uint64_t) - c->cap*sizeof(uint16_t);
+        free(c->array);
+        c->array = NULL;
+        c->cap = 0;
+        return true;
+    }
+
+    if (c->card == c->cap)
+    {
+        int cap = c->cap ? c->cap*2 : 4;
+        uint16_t *array = realloc(c->array, sizeof(uint16_t)*cap);
+        if (!array)
+        {
+            return false;
+        }
+        c->array = array;
+        *bytes += sizeof(uint16_t)*(cap - c->cap);
+        c->cap = cap;
+    }
+    c->array[c->card++] = low;
+    return true;
+}
+
+/**
+ * @brief Index of the first container of bm with a key >= key.
+ */
+static inline int bitmap_seek(const Bitmap *bm, uint32_t key)
+{
+    int lo = 0, hi = bm->n;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (bm->containers[mid].key < key)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static inline void bitmap_index_free(BitmapIndex *index)
+{
+    if (!index)
+    {
+        return;
+    }
+
+    for (int i = 0; i < index->nvalues; i++)
+    {
+        bitmap_free(&index->bitmaps[i]);
+    }
+    free(index->values);
+    free(index->bitmaps);
+    free(index);
+}
+
+static inline uint32_t bitmap_hash(int value)
+{
+    return (uint32_t)value * 0x9e3779b1u;
+}
+
+static inline int bitmap_order_compare(const void *x, const void *y)
+{
+    int64_t l = *(const int64_t *)x, r = *(const int64_t *)y;
+    return l < r ? -1 : l > r;
+}
+
+/**
+ * @brief Build the bitmap index of column a, one pass in row order so
+ *        every bitmap is appended in ascending order.
+ *
+ * @return BitmapIndex* the index, NULL when out of memory or when a has
+ *         more than BITMAP_MAX_VALUES distinct values.
+ */
+static inline BitmapIndex* bitmap_index_build(const int *a, int nrows)
+{
+    BitmapIndex *index = calloc(1, sizeof(BitmapIndex));
+    // open addressing from a value to its slot in values/bitmaps
+    int slots = 2*BITMAP_MAX_VALUES;
+    int *table = malloc(sizeof(int)*slots);
+    if (index)
+    {
+        index->values = malloc(sizeof(int)*BITMAP_MAX_VALUES);
+        index->bitmaps = calloc(BITMAP_MAX_VALUES, sizeof(Bitmap));
+    }
+    bool ok = index && table && index->values && index->bitmaps;
+    if (table)
+    {
+        memset(table, 0xff, sizeof(int)*slots);
+    }
+
+    for (int row = 0; ok && row < nrows; row++)
+    {
+        uint32_t h = bitmap_hash(a[row]) & (slots - 1);
+        while (table[h] >= 0 && index->values[table[h]] != a[row])
+        {
+            h = (h + 1) & (slots - 1);
+        }
+        if (table[h] < 0)
+        {
+            if (index->nvalues == BITMAP_MAX_VALUES)
+            {
+                ok = false;
+                break;
+            }
+            table[h] = index->nvalues;
+            index->values[index->nvalues++] = a[row];
+        }
+        ok = bitmap_append(&index->bitmaps[table[h]], row, &index->bytes);
+    }
+    free(table);
+
+    if (!ok)
+    {
+        bitmap_index_free(index);
+        return NULL;
+    }
+
+    // sort values with their bitmaps, lookups binary search the values
+    int n = index->nvalues;
+    int64_t *order = malloc(sizeof(int64_t)*(n > 0 ? n : 1));
+    int *values = malloc(sizeof(int)*(n > 0 ? n : 1));
+    Bitmap *bitmaps = malloc(sizeof(Bitmap)*(n > 0 ? n : 1));
+    if (!order || !values || !bitmaps)
+    {
+        free(order);
+        free(values);
+        free(bitmaps);
+        bitmap_index_free(index);
+        return NULL;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        // value in the high half, slot in the low half
+        order[i] = (int64_t)index->values[i] * (1ll << 32) + i;
+    }
+    qsort(order, n, sizeof(int64_t), bitmap_order_compare);
+    for (int i = 0; i < n; i++)
+    {
+        int slot = (int)(order[i] & 0xffffffff);
+        values[i] = index->values[slot];
+        bitmaps[i] = index->bitmaps[slot];
+    }
+
+    free(order);
+    free(index->values);
+    free(index->bitmaps);
+    index->values = values;
+    index->bitmaps = bitmaps;
+    return index;
+}
+
+/**
+ * @brief Bitmap of the rows with a == value, NULL when there is none.
+ */
+static inline const Bitmap* bitmap_index_lookup(const BitmapIndex *index, int value)
+{
+    int lo = 0, hi = index->nvalues;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (index->values[mid] < value)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo < index->nvalues && index->values[lo] == value ? &index->bitmaps[lo] : NULL;
+}
+
+typedef struct BitmapEnv {
+    const BitmapIndex *index;
+    const ScanPredicate *pred; // a_in must not be NULL
+    const int *b;
+    const ZoneMap *map;        // drops blocks the b range rules out, can be NULL
+} BitmapEnv;
+
+/**
+ * @brief Bit i set when block i of container key may hold a b in the
+ *        range of pred, one zone per 4096 rows.
+ */
+static inline uint16_t bitmap_zone_mask(const BitmapEnv *env, uint32_t key)
+{
+    if (!env->map || env->map->block_rows != 4096)
+    {
+        return 0xffff;
+    }
+
+    uint16_t mask = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int64_t blk = (int64_t)key*16 + i;
+        if (blk < env->map->nblocks && env->map->zones[blk].max_b >= env->pred->b_low &&
+                env->map->zones[blk].min_b <= env->pred->b_high)
+        {
+            mask |= (uint16_t)(1u << i);
+        }
+    }
+    return mask;
+}
+
+static inline int bitmap_emit(const BitmapEnv *env, int row, int begin, int end, int *sel, int nsel)
+{
+    const ScanPredicate *pred = env->pred;
+    // b - low <= high - low as unsigned, one compare for the closed range,
+    // rows of a container outside [begin, end) belong to another partition
+    if (row >= begin && row < end &&
+            (uint32_t)env->b[row] - (uint32_t)pred->b_low <= (uint32_t)pred->b_high - (uint32_t)pred->b_low)
+    {
+        sel[nsel++] = row;
+    }
+    return nsel;
+}
+
+/**
+ * @brief RangeSelect of a ScanPredicate with an IN-list through the
+ *        bitmap index, see filter.h.
+ */
+static inline int bitmap_env_select(const void *arg, int begin, int end, int *sel)
+{
+    const BitmapEnv *env = (const BitmapEnv *)arg;
+    const ScanPredicate *pred = env->pred;
+    if (begin >= end || pred->b_low > pred->b_high)
+    {
+        return 0;
+    }
+
+    const Bitmap *bitmaps[FILTER_MAX_IN_LIST];
+    int cursor[FILTER_MAX_IN_LIST];
+    int k = 0;
+    uint32_t first_key = (uint32_t)begin >> 16, last_key = (uint32_t)(end - 1) >> 16;
+    for (int i = 0; i < pred->n_a_in && i < FILTER_MAX_IN_LIST; i++)
+    {
+        const Bitmap *bm = bitmap_index_lookup(env->index, pred->a_in[i]);
+        if (bm)
+        {
+            bitmaps[k] = bm;
+            cursor[k++] = bitmap_seek(bm, first_key);
+        }
+    }
+
+    uint64_t words[BITMAP_WORDS];
+    memset(words, 0, sizeof(words));
+    int nsel = 0;
+
+    for (;;)
+    {
+        // next key of any of the bitmaps
+        uint32_t key = UINT32_MAX;
+        for (int j = 0; j < k; j++)
+        {
+            if (cursor[j] < bitmaps[j]->n && bitmaps[j]->containers[cursor[j]].key < key)
+            {
+                key = bitmaps[j]->containers[cursor[j]].key;
+            }
+        }
+        if (key > last_key)
+        {
+            break;
+        }
+
+        const BitmapContainer *parts[FILTER_MAX_IN_LIST];
+        int nparts = 0;
+        for (int j = 0; j < k; j++)
+        {
+            if (cursor[j] < bitmaps[j]->n && bitmaps[j]->containers[cursor[j]].key == key)
+            {
+                parts[nparts++] = &bitmaps[j]->containers[cursor[j]++];
+            }
+        }
+
+        uint16_t mask = bitmap_zone_mask(env, key);
+        if (!mask)
+        {
+            continue;
+        }
+        int base = (int)(key << 16);
+
+        if (nparts == 1 && parts[0]->array)
+        {
+            // a single array needs no OR
+            for (int i = 0; i < parts[0]->card; i++)
+            {
+                uint16_t low = parts[0]->array[i];
+                if (mask >> (low >> 12) & 1)
+                {
+                    nsel = bitmap_emit(env, base + low, begin, end, sel, nsel);
+                }
+            }
+            continue;
+        }
+
+        // OR the containers into the bitset, AND it with the zone mask
+        for (int p = 0; p < nparts; p++)
+        {
+            if (parts[p]->bits)
+            {
+                for (int w = 0; w < BITMAP_WORDS; w++)
+                {
+                    words[w] |= parts[p]->bits[w];
+                }
+            }
+            else
+            {
+                for (int i = 0; i < parts[p]->card; i++)
+                {
+                    words[parts[p]->array[i] >> 6] |= 1ull << (parts[p]->array[i] & 63);
+                }
+            }
+        }
+        for (int blk = 0; blk < 16; blk++)
+        {
+            if (!(mask >> blk & 1))
+            {
+                memset(words + blk*64, 0, 64*sizeof(uint64_t));
+            }
+        }
+
+        for (int w = 0; w < BITMAP_WORDS; w++)
+        {
+            uint64_t word = words[w];
+            while (word)
+            {
+                nsel = bitmap_emit(env, base + w*64 + __builtin_ctzll(word), begin, end, sel, nsel);
+                word &= word - 1;
+            }
+            words[w] = 0;
+        }
+    }
+
+    return nsel;
+}
+
+#endif // MATRIXDB_BITMAP_H
@@ -0,0 +1,665 @@
+#ifndef MATRIXDB_COMPRESS_H
+#define MATRIXDB_COMPRESS_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include "table.h"
+#include "filter.h"
+#include "parser.h"
+#include "zonemap.h"
+
+/*
+ * Lightweight column compression. Every block of a column picks the
+ * smallest of three encodings:
+ *
+ *   PACKED_FOR    frame of reference, value - min bit-packed at the
+ *                 width of max - min
+ *   PACKED_DELTA  blocks sorted ascending, the steps between neighbours
+ *                 minus the smallest step bit-packed, an arithmetic
+ *                 sequence such as a sorted key column packs to 0 bits
+ *   PACKED_RLE    (value, end) of every run of equal values
+ *
+ * Predicates are evaluated on the codes, value ranges are translated to
+ * code ranges once per block, and a range covering the whole block (or
+ * none of it) settles the block without touching its data. Only rows
+ * that match are decoded to values.
+ */
+#define PACKED_BLOCK_ROWS ZONEMAP_BLOCK_ROWS
+// Candidates below 1/PACKED_SPARSE of a block are probed one by one.
+#define PACKED_SPARSE 8
+
+typedef enum PackedEncoding {
+    PACKED_FOR = 0,
+    PACKED_DELTA = 1,
+    PACKED_RLE = 2,
+} PackedEncoding;
+
+typedef struct PackedBlock {
+    uint64_t offset;   // payload in the data of the column
+    int      min;
+    int      max;
+    uint32_t step;     // PACKED_DELTA, smallest step
+    int      nruns;    // PACKED_RLE
+    uint8_t  encoding; // PackedEncoding
+    uint8_t  width;    // bits per code of PACKED_FOR/PACKED_DELTA
+} PackedBlock;
+
+typedef struct PackedColumn {
+    int nrows;
+    int nblocks;
+    PackedBlock *blocks;
+    uint8_t *data;
+    size_t size;       // bytes of data
+} PackedColumn;
+
+typedef struct PackedTable {
+    int nrows;
+    PackedColumn a;
+    PackedColumn b;
+} PackedTable;
+
+static inline int packed_width(uint32_t range)
+{
+    return range ? 32 - __builtin_clz(range) : 0;
+}
+
+static inline uint32_t packed_mask(int width)
+{
+    return width >= 32 ? UINT32_MAX : (1u << width) - 1;
+}
+
+/**
+ * @brief Code i of a bit-packed payload, data is padded so the 64 bit
+ *        load never leaves the buffer.
+ */
+static inline uint32_t packed_extract(const uint8_t *data, int width, int i)
+{
+    uint64_t bit = (uint64_t)i*width;
+    uint64_t word;
+    memcpy(&word, data + (bit >> 3), sizeof(word));
+    return (uint32_t)(word >> (bit & 7)) & packed_mask(width);
+}
+
+/**
+ * @brief Append the payload of one block to the data of col.
+ *
+ * @return false when out of memory.
+ */
+static inline bool packed_encode_block(PackedColumn *col, size_t *cap, PackedBlock *block,
+                        const int *values, int n)
+{
+    int min = INT_MAX, max = INT_MIN, nruns = 1;
+    uint32_t min_step = UINT32_MAX, max_step = 0;
+    bool sorted = true;
+    for (int i = 0; i < n; i++)
+    {
+        min = values[i] < min ? values[i] : min;
+        max = values[i] > max ? values[i] : max;
+        if (i > 0)
+        {
+            uint32_t step = (uint32_t)values[i] - (uint32_t)values[i - 1];
+            sorted = sorted && values[i] >= values[i - 1];
+            min_step = step < min_step ? step : min_step;
+            max_step = step > max_step ? step : max_step;
+            nruns += values[i] != values[i - 1];
+        }
+    }
+    if (n < 2)
+    {
+        min_step = max_step = 0;
+    }
+
+    int for_width = packed_width((uint32_t)max - (uint32_t)min);
+    int delta_width = packed_width(max_step - min_step);
+    size_t for_size = ((size_t)n*for_width + 7) / 8;
+    size_t delta_size = sorted ? ((size_t)n*delta_width + 7) / 8 : SIZE_MAX;
+    size_t rle_size = (size_t)nruns*2*sizeof(int);
+
+    memset(block, 0, sizeof(PackedBlock));
+    block->offset = col->size;
+    block->min = min;
+    block->max = max;
+    block->encoding = PACKED_FOR;
+    block->width = (uint8_t)for_width;
+    size_t size = for_size;
+    if (delta_size < size)
+    {
+        block->encoding = PACKED_DELTA;
+        block->width = (uint8_t)delta_width;
+        block->step = min_step;
+        size = delta_size;
+    }
+    if (rle_size < size)
+    {
+        block->encoding = PACKED_RLE;
+        block->width = 0;
+        block->nruns = nruns;
+        size = rle_size;
+    }
+
+    // 8 bytes of slack for the last 64 bit load of packed_extract
+    if (col->size + size + 8 > *cap)
+    {
+        size_t new_cap = *cap ? *cap*2 : 64*1024;
+        while (new_cap < col->size + size + 8)
+        {
+            new_cap *= 2;
+        }
+        uint8_t *data = realloc(col->data, new_cap);
+        if (!data)
+        {
+            return false;
+        }
+        col->data = data;
+        *cap = new_cap;
+    }
+
+    uint8_t *out = col->data + col->size;
+    memset(out, 0, size + 8);
+    if (block->encoding == PACKED_RLE)
+    {
+        int run = 0;
+        for (int i = 1; i <= n; i++)
+        {
+            if (i == n || values[i] != values[i - 1])
+            {
+                int pair[2] = { values[i - 1], i };
+                memcpy(out + (size_t)run*sizeof(pair), pair, sizeof(pair));
+                run++;
+            }
+        }
+    }
+    else
+    {
+        uint64_t acc = 0;
+        int bits = 0;
+        size_t pos = 0;
+        for (int i = 0; i < n; i++)
+        {
+            uint32_t code = block->encoding == PACKED_FOR ? (uint32_t)values[i] - (uint32_t)min :
+                    i > 0 ? (uint32_t)values[i] - (uint32_t)values[i - 1] - min_step : 0;
+            acc |= (uint64_t)code << bits;
+            bits += block->width;
+            while (bits >= 8)
+            {
+                out[pos++] = (uint8_t)acc;
+                acc >>= 8;
+                bits -= 8;
+            }
+        }
+        if (bits > 0)
+        {
+            out[pos] = (uint8_t)acc;
+        }
+    }
+
+    col->size += size;
+    return true;
+}
+
+static inline void packed_column_free(PackedColumn *col)
+{
+    free(col->blocks);
+    free(col->data);
+    memset(col, 0, sizeof(PackedColumn));
+}
+
+/**
+ * @brief Pack nrows values into col.
+ *
+ * @return false when out of memory.
+ */
+static inline bool packed_column_build(PackedColumn *col, const int *values, int nrows)
+{
+    memset(col, 0, sizeof(PackedColumn));
+    col->nrows = nrows;
+    col->nblocks = (nrows + PACKED_BLOCK_ROWS - 1) / PACKED_BLOCK_ROWS;
+    col->blocks = malloc(sizeof(PackedBlock)*(col->nblocks > 0 ? col->nblocks : 1));
+    if (!col->blocks)
+    {
+        return false;
+    }
+
+    size_t cap = 0;
+    for (int blk = 0; blk < col->nblocks; blk++)
+    {
+        int begin = blk*PACKED_BLOCK_ROWS;
+        int n = nrows - begin < PACKED_BLOCK_ROWS ? nrows - begin : PACKED_BLOCK_ROWS;
+        if (!packed_encode_block(col, &cap, &col->blocks[blk], values + begin, n))
+        {
+            packed_column_free(col);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Packed copy of table.
+ *
+ * @return PackedTable* the packed table, NULL when out of memory.
+ */
+static inline PackedTable* packed_table_build(const Table *table)
+{
+    PackedTable *packed = calloc(1, sizeof(PackedTable));
+    if (!packed)
+    {
+        return NULL;
+    }
+
+    packed->nrows = table->nrows;
+    if (!packed_column_build(&packed->a, table->a, table->nrows) ||
+            !packed_column_build(&packed->b, table->b, table->nrows))
+    {
+        packed_column_free(&packed->a);
+        free(packed);
+        return NULL;
+    }
+
+    return packed;
+}
+
+static inline void packed_table_free(PackedTable *packed)
+{
+    if (!packed)
+    {
+        return;
+    }
+
+    packed_column_free(&packed->a);
+    packed_column_free(&packed->b);
+    free(packed);
+}
+
+/**
+ * @brief Bytes of the packed table, blocks included.
+ */
+static inline size_t packed_table_size(const PackedTable *packed)
+{
+    return packed->a.size + packed->b.size +
+            sizeof(PackedBlock)*((size_t)packed->a.nblocks + packed->b.nblocks);
+}
+
+static inline int packed_block_rows(const PackedColumn *col, int blk)
+{
+    int begin = blk*PACKED_BLOCK_ROWS;
+    return col->nrows - begin < PACKED_BLOCK_ROWS ? col->nrows - begin : PACKED_BLOCK_ROWS;
+}
+
+/**
+ * @brief Decode block blk of col into out.
+ */
+static inline void packed_decode_block(const PackedColumn *col, int blk, int *out)
+{
+    const PackedBlock *block = &col->blocks[blk];
+    const uint8_t *data = col->data + block->offset;
+    int n = packed_block_rows(col, blk);
+
+    if (block->encoding == PACKED_RLE)
+    {
+        int start = 0;
+        for (int r = 0; r < block->nruns; r++)
+        {
+            int pair[2];
+            memcpy(pair, data + (size_t)r*sizeof(pair), sizeof(pair));
+            for (int i = start; i < pair[1]; i++)
+            {
+                out[i] = pair[0];
+            }
+            start = pair[1];
+        }
+    }
+    else if (block->encoding == PACKED_DELTA)
+    {
+        uint32_t v = (uint32_t)block->min;
+        for (int i = 0; i < n; i++)
+        {
+            v += i > 0 ? block->step + packed_extract(data, block->width, i) : 0;
+            out[i] = (int)v;
+        }
+    }
+    else
+    {
+        for (int i = 0; i < n; i++)
+        {
+            out[i] = (int)((uint32_t)block->min + packed_extract(data, block->width, i));
+        }
+    }
+}
+
+/**
+ * @brief Value of row i of block blk, O(1) for PACKED_FOR, a binary
+ *        search over the runs for PACKED_RLE, O(i) for PACKED_DELTA.
+ */
+static inline int packed_get(const PackedColumn *col, int blk, int i)
+{
+    const PackedBlock *block = &col->blocks[blk];
+    const uint8_t *data = col->data + block->offset;
+
+    if (block->encoding == PACKED_FOR)
+    {
+        return (int)((uint32_t)block->min + packed_extract(data, block->width, i));
+    }
+
+    if (block->encoding == PACKED_RLE)
+    {
+        int lo = 0, hi = block->nruns - 1;
+        while (lo < hi)
+        {
+            int mid = (lo + hi) / 2;
+            int end;
+            memcpy(&end, data + (size_t)mid*2*sizeof(int) + sizeof(int), sizeof(int));
+            if (end <= i)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        int value;
+        memcpy(&value, data + (size_t)lo*2*sizeof(int), sizeof(int));
+        return value;
+    }
+
+    uint32_t v = (uint32_t)block->min;
+    for (int j = 1; j <= i; j++)
+    {
+        v += block->step + packed_extract(data, block->width, j);
+    }
+    return (int)v;
+}
+
+/**
+ * @brief Inclusive value ranges of one column, an IN-list is a range
+ *        per value.
+ */
+typedef struct PackedRanges {
+    int64_t lo[FILTER_MAX_IN_LIST];
+    int64_t hi[FILTER_MAX_IN_LIST];
+    int n;
+    bool all; // the column is unrestricted
+} PackedRanges;
+
+static inline void packed_ranges_of(const ScanPredicate *pred, PackedRanges *a, PackedRanges *b)
+{
+    a->all = !pred->a_in;
+    a->n = a->all ? 0 : pred->n_a_in;
+    for (int k = 0; k < a->n; k++)
+    {
+        a->lo[k] = a->hi[k] = pred->a_in[k];
+    }
+
+    b->all = false;
+    b->n = 1;
+    b->lo[0] = pred->b_low;
+    b->hi[0] = pred->b_high;
+}
+
+/**
+ * @brief Code ranges of ranges inside block, relative to block->min.
+ *
+ * @return The number of code ranges, -1 when a range covers the block.
+ */
+static inline int packed_code_ranges(const PackedBlock *block, const PackedRanges *ranges,
+                        uint32_t *lo, uint32_t *width)
+{
+    int m = 0;
+    for (int r = 0; r < ranges->n; r++)
+    {
+        if (ranges->hi[r] < block->min || ranges->lo[r] > block->max || ranges->lo[r] > ranges->hi[r])
+        {
+            continue;
+        }
+        if (ranges->lo[r] <= block->min && ranges->hi[r] >= block->max)
+        {
+            return -1;
+        }
+        int64_t clo = ranges->lo[r] > block->min ? ranges->lo[r] : block->min;
+        int64_t chi = ranges->hi[r] < block->max ? ranges->hi[r] : block->max;
+        lo[m] = (uint32_t)(clo - block->min);
+        width[m] = (uint32_t)(chi - clo);
+        m++;
+    }
+    return m;
+}
+
+static inline bool packed_code_in(uint32_t code, const uint32_t *lo, const uint32_t *width, int m)
+{
+    bool in = false;
+    for (int r = 0; r < m; r++)
+    {
+        in |= code - lo[r] <= width[r];
+    }
+    return in;
+}
+
+/**
+ * @brief keep[i] &= row i of block blk lies in ranges, evaluated on
+ *        the codes of the block.
+ */
+static inline void packed_filter_block(const PackedColumn *col, int blk,
+                        const PackedRanges *ranges, uint8_t *keep)
+{
+    if (ranges->all)
+    {
+        return;
+    }
+
+    const PackedBlock *block = &col->blocks[blk];
+    const uint8_t *data = col->data + block->offset;
+    int n = packed_block_rows(col, blk);
+
+    uint32_t lo[FILTER_MAX_IN_LIST], width[FILTER_MAX_IN_LIST];
+    int m = packed_code_ranges(block, ranges, lo, width);
+    if (m < 0)
+    {
+        return;
+    }
+    if (m == 0)
+    {
+        memset(keep, 0, n);
+        return;
+    }
+
+    if (block->encoding == PACKED_RLE)
+    {
+        int start = 0;
+        for (int r = 0; r < block->nruns; r++)
+        {
+            int pair[2];
+            memcpy(pair, data + (size_t)r*sizeof(pair), sizeof(pair));
+            if (!packed_code_in((uint32_t)pair[0] - (uint32_t)block->min, lo, width, m))
+            {
+                memset(keep + start, 0, pair[1] - start);
+            }
+            start = pair[1];
+        }
+    }
+    else if (block->encoding == PACKED_DELTA)
+    {
+        // a sorted block starts at its min, the codes are the offsets
+        uint32_t code = 0;
+        for (int i = 0; i < n; i++)
+        {
+            code += i > 0 ? block->step + packed_extract(data, block->width, i) : 0;
+            keep[i] &= packed_code_in(code, lo, width, m);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < n; i++)
+        {
+            keep[i] &= packed_code_in(packed_extract(data, block->width, i), lo, width, m);
+        }
+    }
+}
+
+/**
+ * @brief Whether row i of block blk lies in ranges.
+ */
+static inline bool packed_accept(const PackedColumn *col, int blk, int i, const PackedRanges *ranges)
+{
+    if (ranges->all)
+    {
+        return true;
+    }
+
+    int v = packed_get(col, blk, i);
+    for (int r = 0; r < ranges->n; r++)
+    {
+        if (v >= ranges->lo[r] && v <= ranges->hi[r])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+typedef struct PackedEnv {
+    const PackedTable *table;
+    PackedRanges a;
+    PackedRanges b;
+    const Query *query; // evaluated on decoded blocks when there are no ranges
+} PackedEnv;
+
+/**
+ * @brief RangeSelect of a ScanPredicate over a packed table. Column a
+ *        is evaluated first, column b only when candidates are left, and
+ *        a few candidates are probed one by one instead of a full pass.
+ */
+static inline int packed_env_select(const void *arg, int begin, int end, int *sel)
+{
+    const PackedEnv *env = (const PackedEnv *)arg;
+    const PackedTable *table = env->table;
+    uint8_t keep[PACKED_BLOCK_ROWS];
+    int nsel = 0;
+
+    for (int blk = begin / PACKED_BLOCK_ROWS; blk*PACKED_BLOCK_ROWS < end; blk++)
+    {
+        int base = blk*PACKED_BLOCK_ROWS;
+        int n = packed_block_rows(&table->a, blk);
+        int lo = begin > base ? begin - base : 0;
+        int hi = end - base < n ? end - base : n;
+
+        memset(keep, 1, n);
+        packed_filter_block(&table->a, blk, &env->a, keep);
+
+        int candidates = 0;
+        for (int i = lo; i < hi; i++)
+        {
+            candidates += keep[i];
+        }
+        if (candidates == 0)
+        {
+            continue;
+        }
+
+        if (candidates < n / PACKED_SPARSE && table->b.blocks[blk].encoding != PACKED_DELTA)
+        {
+            for (int i = lo; i < hi; i++)
+            {
+                if (keep[i] && packed_accept(&table->b, blk, i, &env->b))
+                {
+                    sel[nsel++] = base + i;
+                }
+            }
+            continue;
+        }
+
+        packed_filter_block(&table->b, blk, &env->b, keep);
+        for (int i = lo; i < hi; i++)
+        {
+            // branch free append, the index is overwritten when rejected
+            sel[nsel] = base + i;
+            nsel += keep[i];
+        }
+    }
+
+    return nsel;
+}
+
+/**
+ * @brief RangeSelect of any query over a packed table, blocks are
+ *        decoded and evaluated row at a time.
+ */
+static inline int packed_query_select(const void *arg, int begin, int end, int *sel)
+{
+    const PackedEnv *env = (const PackedEnv *)arg;
+    const PackedTable *table = env->table;
+    int a[PACKED_BLOCK_ROWS], b[PACKED_BLOCK_ROWS];
+    int nsel = 0;
+
+    for (int blk = begin / PACKED_BLOCK_ROWS; blk*PACKED_BLOCK_ROWS < end; blk++)
+    {
+        int base = blk*PACKED_BLOCK_ROWS;
+        int n = packed_block_rows(&table->a, blk);
+        int lo = begin > base ? begin - base : 0;
+        int hi = end - base < n ? end - base : n;
+
+        packed_decode_block(&table->a, blk, a);
+        packed_decode_block(&table->b, blk, b);
+        for (int i = lo; i < hi; i++)
+        {
+            Row row = { a[i], b[i] };
+            sel[nsel] = base + i;
+            nsel += query_match(env->query, row);
+        }
+    }
+
+    return nsel;
+}
+
+/**
+ * @brief Decode the rows sel[0, n) of col into out, sel ascending. Each
+ *        block is decoded at most once.
+ */
+static inline void packed_gather(const PackedColumn *col, const int *sel, int n, int *out)
+{
+    int cache[PACKED_BLOCK_ROWS];
+    int cached = -1;
+
+    for (int k = 0; k < n; k++)
+    {
+        int blk = sel[k] / PACKED_BLOCK_ROWS, i = sel[k] % PACKED_BLOCK_ROWS;
+        if (col->blocks[blk].encoding != PACKED_DELTA)
+        {
+            out[k] = packed_get(col, blk, i);
+            continue;
+        }
+        if (blk != cached)
+        {
+            packed_decode_block(col, blk, cache);
+            cached = blk;
+        }
+        out[k] = cache[i];
+    }
+}
+
+/**
+ * @brief Decode the rows sel[0, n) of table into rows.
+ */
+static inline void packed_gather_rows(const PackedTable *table, const int *sel, int n, Row *rows)
+{
+    int a[PACKED_BLOCK_ROWS], b[PACKED_BLOCK_ROWS];
+
+    for (int k = 0; k < n; k += PACKED_BLOCK_ROWS)
+    {
+        int m = n - k < PACKED_BLOCK_ROWS ? n - k : PACKED_BLOCK_ROWS;
+        packed_gather(&table->a, sel + k, m, a);
+        packed_gather(&table->b, sel + k, m, b);
+        for (int i = 0; i < m; i++)
+        {
+            rows[k + i].a = a[i];
+            rows[k + i].b = b[i];
+        }
+    }
+}
+
+#endif // MATRIXDB_COMPRESS_H
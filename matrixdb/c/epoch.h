@@ -0,0 +1,208 @@
+#ifndef MATRIXDB_EPOCH_H
+#define MATRIXDB_EPOCH_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+/*
+ * Epoch-based reclamation. Readers pin the global epoch for the length
+ * of a read section and never block, writers retire memory they
+ * unpublished together with the epoch of the retirement. Retired memory
+ * is released once every pinned epoch is newer, then no reader can
+ * still hold a pointer to it.
+ *
+ *   reader: epoch_enter, load the published pointer, read, epoch_exit
+ *   writer: publish the new pointer, epoch_retire the old, epoch_reclaim
+ *
+ * Readers take a slot once with epoch_register, slots sit on their own
+ * cache lines so pinning stays local to the reader's core. The writer
+ * side (retire, reclaim) is single threaded, callers serialize it.
+ */
+#define EPOCH_MAX_READERS 256
+#define EPOCH_CACHE_LINE 64
+
+typedef struct EpochSlot {
+    _Alignas(EPOCH_CACHE_LINE) _Atomic uint64_t epoch; // pinned epoch, 0 outside a read section
+    atomic_bool used;
+} EpochSlot;
+
+typedef struct EpochRetired EpochRetired;
+struct EpochRetired {
+    EpochRetired *next;
+    void *ptr;
+    void (*release)(void *ptr);
+    uint64_t epoch;
+};
+
+typedef struct EpochDomain {
+    _Atomic uint64_t global;        // current epoch, starts at 1
+    atomic_int nslots;              // slots ever registered, bound of the scans
+    EpochSlot slots[EPOCH_MAX_READERS];
+    EpochRetired *retired;          // writer side, newest first
+    int64_t pending;                // retired and not released yet
+} EpochDomain;
+
+static inline void epoch_init(EpochDomain *domain)
+{
+    memset(domain, 0, sizeof(EpochDomain));
+    atomic_init(&domain->global, 1);
+    atomic_init(&domain->nslots, 0);
+    for (int i = 0; i < EPOCH_MAX_READERS; i++)
+    {
+        atomic_init(&domain->slots[i].epoch, 0);
+        atomic_init(&domain->slots[i].used, false);
+    }
+}
+
+/**
+ * @brief Claim a reader slot.
+ *
+ * @return The slot, -1 when all EPOCH_MAX_READERS are taken.
+ */
+static inline int epoch_register(EpochDomain *domain)
+{
+    for (int i = 0; i < EPOCH_MAX_READERS; i++)
+    {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&domain->slots[i].used, &expected, true))
+        {
+            int n = atomic_load(&domain->nslots);
+            while (n < i + 1 && !atomic_compare_exchange_weak(&domain->nslots, &n, i + 1))
+            {
+            }
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static inline void epoch_unregister(EpochDomain *domain, int slot)
+{
+    atomic_store(&domain->slots[slot].epoch, 0);
+    atomic_store(&domain->slots[slot].used, false);
+}
+
+/**
+ * @brief Begin a read section, pointers loaded afterwards stay valid
+ *        until epoch_exit.
+ */
+static inline void epoch_enter(EpochDomain *domain, int slot)
+{
+    // sequentially consistent, the pin is visible before the loads of
+    // the read section.
+    atomic_store(&domain->slots[slot].epoch, atomic_load(&domain->global));
+}
+
+static inline void epoch_exit(EpochDomain *domain, int slot)
+{
+    atomic_store_explicit(&domain->slots[slot].epoch, 0, memory_order_release);
+}
+
+/**
+ * @brief Oldest epoch pinned by a reader, UINT64_MAX when none is.
+ */
+static inline uint64_t epoch_min_pinned(EpochDomain *domain)
+{
+    uint64_t min = UINT64_MAX;
+    int n = atomic_load(&domain->nslots);
+    for (int i = 0; i < n; i++)
+    {
+        uint64_t e = atomic_load(&domain->slots[i].epoch);
+        min = e && e < min ? e : min;
+    }
+    return min;
+}
+
+/**
+ * @brief Wait until no reader can hold a pointer unpublished before the
+ *        call, the fallback when a retirement cannot be recorded.
+ */
+static inline void epoch_synchronize(EpochDomain *domain)
+{
+    uint64_t e = atomic_fetch_add(&domain->global, 1);
+    while (epoch_min_pinned(domain) <= e)
+    {
+        sched_yield();
+    }
+}
+
+/**
+ * @brief Release ptr with release once no reader can hold it, ptr must
+ *        be unpublished already.
+ */
+static inline void epoch_retire(EpochDomain *domain, void *ptr, void (*release)(void *ptr))
+{
+    EpochRetired *node = malloc(sizeof(EpochRetired));
+    if (!node)
+    {
+        epoch_synchronize(domain);
+        release(ptr);
+        return;
+    }
+
+    node->ptr = ptr;
+    node->release = release;
+    node->epoch = atomic_load(&domain->global);
+    node->next = domain->retired;
+    domain->retired = node;
+    domain->pending++;
+}
+
+/**
+ * @brief Advance the epoch and release what no reader can hold anymore.
+ *
+ * @return Number of released pointers.
+ */
+static inline int epoch_reclaim(EpochDomain *domain)
+{
+    if (!domain->retired)
+    {
+        return 0;
+    }
+
+    atomic_fetch_add(&domain->global, 1);
+    uint64_t min = epoch_min_pinned(domain);
+
+    int released = 0;
+    EpochRetired **link = &domain->retired;
+    while (*link)
+    {
+        EpochRetired *node = *link;
+        if (node->epoch < min)
+        {
+            *link = node->next;
+            node->release(node->ptr);
+            free(node);
+            released++;
+        }
+        else
+        {
+            link = &node->next;
+        }
+    }
+    domain->pending -= released;
+
+    return released;
+}
+
+/**
+ * @brief Release everything retired, no reader may be in a read section.
+ */
+static inline void epoch_destroy(EpochDomain *domain)
+{
+    while (domain->retired)
+    {
+        EpochRetired *node = domain->retired;
+        domain->retired = node->next;
+        node->release(node->ptr);
+        free(node);
+    }
+    domain->pending = 0;
+}
+
+#endif // MATRIXDB_EPOCH_H
@@ -0,0 +1,133 @@
+#ifndef MATRIXDB_EYTZINGER_H
+#define MATRIXDB_EYTZINGER_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "row.h"
+#include "search.h"
+
+/**
+ * @brief Eytzinger (breadth first, BFS order) layout of the packed keys
+ *        of a sorted row array. The children of node k are 2k and 2k+1,
+ *        so the top levels share a few hot cache lines and the lines of
+ *        the next levels can be prefetched before they are needed.
+ */
+typedef struct Eytzinger {
+    int       n;
+    uint64_t *keys; // keys[1..n] in BFS order, keys[0] is unused
+    int      *rank; // rank[k] is the index in the sorted rows of keys[k]
+} Eytzinger;
+
+static inline int eytzinger_fill(Eytzinger *tree, const Row *rows, int i, int k)
+{
+    // in order walk of the implicit tree hands out the sorted rows
+    while (k <= tree->n)
+    {
+        i = eytzinger_fill(tree, rows, i, 2*k);
+        tree->keys[k] = row_key(rows[i]);
+        tree->rank[k] = i++;
+        k = 2*k + 1;
+    }
+
+    return i;
+}
+
+/**
+ * @brief Build the layout once after the rows are loaded.
+ * 
+ * @param rows Rows sorted by (a,b).
+ * @param nrows Number of rows.
+ * @return Eytzinger* the layout, NULL when out of memory.
+ */
+static inline Eytzinger* eytzinger_build(const Row *rows, int nrows)
+{
+    Eytzinger *tree = calloc(1, sizeof(Eytzinger));
+    if (!tree)
+    {
+        return NULL;
+    }
+
+    void *keys = NULL;
+    tree->n = nrows;
+    // keys[16k] starts a cache line so the prefetch of 4 levels ahead
+    // covers the 16 descendants with two lines.
+    if (posix_memalign(&keys, 64, sizeof(uint64_t)*((size_t)nrows + 1)) != 0)
+    {
+        free(tree);
+        return NULL;
+    }
+    tree->keys = (uint64_t *)keys;
+    tree->rank = malloc(sizeof(int)*((size_t)nrows + 1));
+    if (!tree->rank)
+    {
+        free(tree->keys);
+        free(tree);
+        return NULL;
+    }
+
+    eytzinger_fill(tree, rows, 0, 1);
+
+    return tree;
+}
+
+static inline void eytzinger_free(Eytzinger *tree)
+{
+    if (!tree)
+    {
+        return;
+    }
+
+    free(tree->keys);
+    free(tree->rank);
+    free(tree);
+}
+
+/**
+ * @brief Same result as rows_lower_bound over the rows the layout was
+ *        built from: the index of the first row >= key, n when none.
+ */
+static inline int eytzinger_lower_bound(const Eytzinger *tree, uint64_t key)
+{
+    const uint64_t *keys = tree->keys;
+    unsigned k = 1;
+    STATS_COUNT(STATS_SEARCHES, 1);
+    STATS_COUNT(STATS_SEARCH_STEPS, stats_search_depth((int64_t)tree->n + 1));
+
+    while (k <= (unsigned)tree->n)
+    {
+        __builtin_prefetch(keys + 16*k);
+        __builtin_prefetch(keys + 16*k + 8);
+        k = 2*k + (keys[k] < key);
+    }
+
+    // strip the trailing right turns (1 bits) and the last left turn,
+    // what remains is the last node where the search went left.
+    k >>= __builtin_ffs(~k);
+
+    return k ? tree->rank[k] : tree->n;
+}
+
+/**
+ * @brief rows_slice_range through the Eytzinger layout when tree is not
+ *        NULL, plain binary search over rows otherwise.
+ */
+static inline void eytzinger_slice_range(const Eytzinger *tree, const Row *rows, int nrows,
+                        RangeSlice slice, int *begin, int *end)
+{
+    if (!tree)
+    {
+        rows_slice_range(rows, nrows, slice, begin, end);
+        return;
+    }
+
+    *begin = eytzinger_lower_bound(tree, row_key(slice.left));
+    uint64_t last = slice_last_key(slice);
+    *end = last == UINT64_MAX ? tree->n : eytzinger_lower_bound(tree, last + 1);
+    if (*end < *begin)
+    {
+        *end = *begin;
+    }
+}
+
+#endif // MATRIXDB_EYTZINGER_H
@@ -0,0 +1,437 @@
+#ifndef MATRIXDB_FILTER_H
+#define MATRIXDB_FILTER_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "parallel.h"
+#include "parser.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FILTER_HAVE_X86 1
+#endif
+
+// Longest IN-list filter_from_query turns into a ScanPredicate.
+#define FILTER_MAX_IN_LIST 16
+
+/**
+ * @brief Predicate of the shape `a IN (...) AND b_low <= b <= b_high`,
+ *        the shape of task1_handle.
+ */
+typedef struct ScanPredicate {
+    const int *a_in;  // values of the IN-list, NULL when `a` is unrestricted
+    int n_a_in;       // number of values in a_in
+    int b_low;        // inclusive lower bound of b
+    int b_high;       // inclusive upper bound of b
+} ScanPredicate;
+
+/**
+ * @brief Filter kernel, evaluate pred on rows [begin, end) and append
+ *        the indices of accepted rows to sel in ascending order.
+ * 
+ * @return Number of indices written to sel.
+ */
+typedef int (*FilterKernel)(const ScanPredicate *pred, const int *a, const int *b,
+                        int begin, int end, int *sel);
+
+static inline bool filter_accept(const ScanPredicate *pred, int a, int b)
+{
+    bool in = !pred->a_in;
+    for (int k = 0; k < pred->n_a_in && !in; k++)
+    {
+        in = pred->a_in[k] == a;
+    }
+
+    // b - low <= high - low as unsigned, one compare for the closed range
+    return in && (uint32_t)b - (uint32_t)pred->b_low <= (uint32_t)pred->b_high - (uint32_t)pred->b_low;
+}
+
+/**
+ * @brief Reference row at a time kernel, also used for the tails of
+ *        the SIMD kernels.
+ */
+static inline int filter_select_scalar(const ScanPredicate *pred, const int *a, const int *b,
+                        int begin, int end, int *sel)
+{
+    int nsel = 0;
+
+    if (pred->b_high < pred->b_low)
+    {
+        return 0;
+    }
+
+    for (int i = begin; i < end; i++)
+    {
+        sel[nsel] = i;
+        nsel += filter_accept(pred, a[i], b[i]);
+    }
+
+    return nsel;
+}
+
+#ifdef FILTER_HAVE_X86
+
+static inline int filter_emit_mask(unsigned mask, int base, int *sel)
+{
+    int nsel = 0;
+    while (mask)
+    {
+        sel[nsel++] = base + __builtin_ctz(mask);
+        mask &= mask - 1;
+    }
+    return nsel;
+}
+
+/**
+ * @brief SSE2 kernel, 4 rows per instruction.
+ */
+static inline int filter_select_sse2(const ScanPredicate *pred, const int *a, const int *b,
+                        int begin, int end, int *sel)
+{
+    if (pred->b_high < pred->b_low)
+    {
+        return 0;
+    }
+
+    int nsel = 0;
+    int i = begin;
+
+    // signed compare of (b - low) ^ sign against (high - low) ^ sign
+    // is the unsigned compare SSE2 lacks.
+    const __m128i sign  = _mm_set1_epi32(INT32_MIN);
+    const __m128i low   = _mm_set1_epi32(pred->b_low);
+    const __m128i width = _mm_set1_epi32((int32_t)(((uint32_t)pred->b_high - (uint32_t)pred->b_low) ^ 0x80000000u));
+
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128i in;
+        if (pred->a_in)
+        {
+            __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+            in = _mm_setzero_si128();
+            for (int k = 0; k < pred->n_a_in; k++)
+            {
+                in = _mm_or_si128(in, _mm_cmpeq_epi32(va, _mm_set1_epi32(pred->a_in[k])));
+            }
+
+            // most blocks are rejected on `a`, b is never loaded for them.
+            if (!_mm_movemask_ps(_mm_castsi128_ps(in)))
+            {
+                continue;
+            }
+        }
+        else
+        {
+            in = _mm_set1_epi32(-1);
+        }
+
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i off = _mm_xor_si128(_mm_sub_epi32(vb, low), sign);
+        __m128i ok  = _mm_andnot_si128(_mm_cmpgt_epi32(off, width), in);
+
+        nsel += filter_emit_mask(_mm_movemask_ps(_mm_castsi128_ps(ok)), i, sel + nsel);
+    }
+
+    return nsel + filter_select_scalar(pred, a, b, i, end, sel + nsel);
+}
+
+/**
+ * @brief AVX2 kernel, 8 rows per instruction.
+ */
+__attribute__((target("avx2")))
+static inline int filter_select_avx2(const ScanPredicate *pred, const int *a, const int *b,
+                        int begin, int end, int *sel)
+{
+    if (pred->b_high < pred->b_low)
+    {
+        return 0;
+    }
+
+    int nsel = 0;
+    int i = begin;
+
+    const __m256i sign  = _mm256_set1_epi32(INT32_MIN);
+    const __m256i low   = _mm256_set1_epi32(pred->b_low);
+    const __m256i width = _mm256_set1_epi32((int32_t)(((uint32_t)pred->b_high - (uint32_t)pred->b_low) ^ 0x80000000u));
+
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256i in;
+        if (pred->a_in)
+        {
+            __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+            in = _mm256_setzero_si256();
+            for (int k = 0; k < pred->n_a_in; k++)
+            {
+                in = _mm256_or_si256(in, _mm256_cmpeq_epi32(va, _mm256_set1_epi32(pred->a_in[k])));
+            }
+
+            if (_mm256_testz_si256(in, in))
+            {
+                continue;
+            }
+        }
+        else
+        {
+            in = _mm256_set1_epi32(-1);
+        }
+
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i off = _mm256_xor_si256(_mm256_sub_epi32(vb, low), sign);
+        __m256i ok  = _mm256_andnot_si256(_mm256_cmpgt_epi32(off, width), in);
+
+        nsel += filter_emit_mask(_mm256_movemask_ps(_mm256_castsi256_ps(ok)), i, sel + nsel);
+    }
+
+    return nsel + filter_select_scalar(pred, a, b, i, end, sel + nsel);
+}
+
+#endif // FILTER_HAVE_X86
+
+/**
+ * @brief Pick the widest kernel the running CPU supports, the choice
+ *        can be forced with MATRIXDB_SIMD=avx2|sse2|scalar.
+ * 
+ * @param name Receives the name of the chosen kernel, can be NULL.
+ * @return FilterKernel the kernel.
+ */
+static inline FilterKernel filter_resolve(const char **name)
+{
+    const char *force = getenv("MATRIXDB_SIMD");
+    FilterKernel kernel = filter_select_scalar;
+    const char *chosen = "scalar";
+
+#ifdef FILTER_HAVE_X86
+    __builtin_cpu_init();
+    if (!force || strcmp(force, "scalar") != 0)
+    {
+        kernel = filter_select_sse2;
+        chosen = "sse2";
+    }
+    if ((!force || strcmp(force, "avx2") == 0) && __builtin_cpu_supports("avx2"))
+    {
+        kernel = filter_select_avx2;
+        chosen = "avx2";
+    }
+#endif
+
+    if (name)
+    {
+        *name = chosen;
+    }
+
+    return kernel;
+}
+
+/**
+ * @brief Evaluate pred over rows [begin, end) of the columns a and b
+ *        with the kernel resolved on first use.
+ * 
+ * @param sel Output selection vector with room for end-begin indices.
+ * @return Number of accepted rows.
+ */
+static inline int filter_select(const ScanPredicate *pred, const int *a, const int *b,
+                        int begin, int end, int *sel)
+{
+    static FilterKernel kernel = NULL;
+    if (!kernel)
+    {
+        kernel = filter_resolve(NULL);
+    }
+
+    return kernel(pred, a, b, begin, end, sel);
+}
+
+// Partitions smaller than this are not worth a thread.
+#define FILTER_MIN_PARTITION (64*1024)
+
+/**
+ * @brief Selection over rows [begin, end), appends accepted row indices
+ *        to sel in ascending order and returns how many were appended.
+ */
+typedef int (*RangeSelect)(const void *env, int begin, int end, int *sel);
+
+typedef struct SelectPartitionCtx {
+    RangeSelect select;
+    const void *env;
+    int  nrows;
+    int  align;
+    int *sel;
+    int *counts; // number of accepted rows per partition
+} SelectPartitionCtx;
+
+static inline void select_partition_work(int tid, int nthreads, void *arg)
+{
+    SelectPartitionCtx *ctx = (SelectPartitionCtx *)arg;
+    int begin = parallel_partition(ctx->nrows, nthreads, tid, ctx->align);
+    int end = parallel_partition(ctx->nrows, nthreads, tid + 1, ctx->align);
+
+    // a partition never accepts more rows than it has, so sel[begin, end)
+    // is the thread local result buffer of this partition.
+    ctx->counts[tid] = ctx->select(ctx->env, begin, end, ctx->sel + begin);
+}
+
+/**
+ * @brief Run select over [0, nrows) split into one partition per thread,
+ *        the output is identical to select(env, 0, nrows, sel).
+ * 
+ * @param nthreads Number of threads, see parallel_threads().
+ * @param align Partition boundaries are multiples of align rows.
+ * @param sel Output selection vector with room for nrows indices.
+ * @return Number of accepted rows.
+ */
+static inline int select_parallel(RangeSelect select, const void *env, int nrows,
+                        int nthreads, int align, int *sel)
+{
+    int max_threads = nrows / FILTER_MIN_PARTITION;
+    if (nthreads > max_threads)
+    {
+        nthreads = max_threads;
+    }
+    if (nthreads <= 1)
+    {
+        return select(env, 0, nrows, sel);
+    }
+
+    int counts[PARALLEL_MAX_THREADS];
+    SelectPartitionCtx ctx = { select, env, nrows, align, sel, counts };
+    parallel_run(nthreads, select_partition_work, &ctx);
+
+    // concatenate the partitions in row order
+    int nsel = counts[0];
+    for (int t = 1; t < nthreads; t++)
+    {
+        int begin = parallel_partition(nrows, nthreads, t, align);
+        memmove(sel + nsel, sel + begin, sizeof(int)*counts[t]);
+        nsel += counts[t];
+    }
+
+    return nsel;
+}
+
+typedef struct FilterEnv {
+    const ScanPredicate *pred;
+    const int *a;
+    const int *b;
+} FilterEnv;
+
+static inline int filter_env_select(const void *arg, int begin, int end, int *sel)
+{
+    const FilterEnv *env = (const FilterEnv *)arg;
+    return filter_select(env->pred, env->a, env->b, begin, end, sel);
+}
+
+/**
+ * @brief Express query as a ScanPredicate, possible when every box has
+ *        the same b range and a is unrestricted or limited to at most
+ *        cap distinct values.
+ * 
+ * @param a_in Receives the IN-list of pred, room for cap values.
+ * @return true when pred is equivalent to query.
+ */
+static inline bool filter_from_query(const Query *query, ScanPredicate *pred, int *a_in, int cap)
+{
+    const BoxSet *where = &query->where;
+    ScanPredicate empty = { a_in, 0, 0, -1 };
+    *pred = empty;
+    if (where->nboxes == 0)
+    {
+        return true;
+    }
+
+    pred->b_low = (int)where->boxes[0].b_lo;
+    pred->b_high = (int)where->boxes[0].b_hi;
+    if (where->nboxes == 1 && where->boxes[0].a_lo == INT_MIN && where->boxes[0].a_hi == INT_MAX)
+    {
+        pred->a_in = NULL;
+        return true;
+    }
+
+    for (int i = 0; i < where->nboxes; i++)
+    {
+        const Box *box = &where->boxes[i];
+        if (box->b_lo != pred->b_low || box->b_hi != pred->b_high || 
+                box->a_hi - box->a_lo >= cap - pred->n_a_in)
+        {
+            return false;
+        }
+        for (int64_t a = box->a_lo; a <= box->a_hi; a++)
+        {
+            a_in[pred->n_a_in++] = (int)a;
+        }
+    }
+
+    return true;
+}
+
+typedef struct QueryEnv {
+    const Query *query;
+    const int *a;
+    const int *b;
+} QueryEnv;
+
+/**
+ * @brief Generic RangeSelect of any parsed query, row at a time.
+ */
+static inline int query_env_select(const void *arg, int begin, int end, int *sel)
+{
+    const QueryEnv *env = (const QueryEnv *)arg;
+    int nsel = 0;
+
+    for (int i = begin; i < end; i++)
+    {
+        Row row = { env->a[i], env->b[i] };
+        sel[nsel] = i;
+        nsel += query_match(env->query, row);
+    }
+
+    return nsel;
+}
+
+typedef struct InListEnv {
+    const QueryGroup *group; // the only b range of the query
+    const int *a;
+    const int *b;
+} InListEnv;
+
+/**
+ * @brief RangeSelect of queries whose boxes share one b range, such as
+ *        IN-lists too long for a ScanPredicate. The b range and the
+ *        bounds of the list are tested branch-free first, only the rows
+ *        within both probe the list.
+ */
+static inline int inlist_env_select(const void *arg, int begin, int end, int *sel)
+{
+    const InListEnv *env = (const InListEnv *)arg;
+    const InList *list = &env->group->a;
+    if (list->n == 0 || env->group->b_lo > env->group->b_hi)
+    {
+        return 0;
+    }
+
+    uint32_t b_low = (uint32_t)(int)env->group->b_lo;
+    uint32_t b_span = (uint32_t)(env->group->b_hi - env->group->b_lo);
+    uint32_t a_low = (uint32_t)list->min;
+    uint32_t a_span = (uint32_t)list->max - (uint32_t)list->min;
+
+    int nsel = 0;
+    for (int i = begin; i < end; i++)
+    {
+        sel[nsel] = i;
+        nsel += ((uint32_t)env->b[i] - b_low <= b_span) & ((uint32_t)env->a[i] - a_low <= a_span);
+    }
+
+    int m = 0;
+    for (int k = 0; k < nsel; k++)
+    {
+        sel[m] = sel[k];
+        m += inlist_contains(list, env->a[sel[k]]);
+    }
+
+    return m;
+}
+
+#endif // MATRIXDB_FILTER_H
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "row.h"
+#include "table.h"
+#include "tablefile.h"
+#include "parallel.h"
+#include "seed.h"
+
+/*
+ * Generate a table as seed.h describes and write it as a table file, the
+ * tasks map it with MATRIXDB_TABLE. The same options and seed give the
+ * same file for every number of threads.
+ *
+ * Usage: gen [options] path
+ *    -n rows         row count, K/M suffixes allowed, default 4M
+ *    -d dist         uniform, zipf or dup, distribution of a, default uniform
+ *    -a domain       distinct keys of uniform and zipf, default 1000000
+ *    -z exponent     skew of zipf, default 1.0
+ *    -k rows         rows per a of dup, default 100
+ *    -A base         a = base*key, default 1000
+ *    -b domain       distinct b, default 100
+ *    -B base         b = base*[0, domain), default 10
+ *    -o order        sorted, unsorted or nearly, default sorted
+ *    -x fraction     rows moved by nearly, default 0.01
+ *    -s seed         default 42
+ *    -l layout       rows (task2-4) or columns (task1), default rows
+ *
+ * Threads follow MATRIXDB_THREADS, see parallel.h.
+ */
+#define DEFAULT_ROWS 4000000
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e3 + ts.tv_nsec/1e6;
+}
+
+static long parse_count(const char *s)
+{
+    char *end;
+    long n = strtol(s, &end, 10);
+    if (*end == 'K' || *end == 'k')
+    {
+        n *= 1000;
+        end++;
+    }
+    else if (*end == 'M' || *end == 'm')
+    {
+        n *= 1000000;
+        end++;
+    }
+    return *end || end == s ? -1 : n;
+}
+
+/**
+ * @brief Print the number of distinct a and the rows of the largest a,
+ *        the skew the engines see.
+ */
+static void print_stats(const Row *rows, int nrows, int nthreads)
+{
+    Row *sorted = malloc(sizeof(Row)*(nrows > 0 ? nrows : 1));
+    if (!sorted)
+    {
+        return;
+    }
+    memcpy(sorted, rows, sizeof(Row)*nrows);
+    if (!seed_sort(sorted, nrows, nthreads))
+    {
+        free(sorted);
+        return;
+    }
+
+    int keys = 0, most = 0, run = 0, most_a = 0;
+    for (int i = 0; i < nrows; i++)
+    {
+        run = i > 0 && sorted[i].a == sorted[i - 1].a ? run + 1 : 1;
+        keys += run == 1;
+        if (run > most)
+        {
+            most = run;
+            most_a = sorted[i].a;
+        }
+    }
+
+    printf("---- Rows(%d) Keys(%d) MaxRows(%d) of a=%d ----\n", nrows, keys, most, most_a);
+    free(sorted);
+}
+
+int main(int argc, char **argv)
+{
+    SeedConfig config;
+    seed_config_default(&config);
+    long nrows = DEFAULT_ROWS;
+    TableLayout layout = TABLE_LAYOUT_ROWS;
+
+    int opt;
+    bool bad = false;
+    while ((opt = getopt(argc, argv, "n:d:a:z:k:A:b:B:o:x:s:l:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': nrows = parse_count(optarg); bad = bad || nrows < 0 || nrows > INT32_MAX; break;
+        case 'a': config.a_domain = atoi(optarg); break;
+        case 'z': config.zipf_s = atof(optarg); break;
+        case 'k': config.dup = atoi(optarg); break;
+        case 'A': config.a_base = atoi(optarg); break;
+        case 'b': config.b_domain = atoi(optarg); break;
+        case 'B': config.b_base = atoi(optarg); break;
+        case 'x': config.disorder = atof(optarg); break;
+        case 's': config.seed = strtoull(optarg, NULL, 10); break;
+        case 'd':
+            config.dist = strcmp(optarg, "zipf") == 0 ? SEED_ZIPF :
+                    strcmp(optarg, "dup") == 0 ? SEED_DUPLICATES : SEED_UNIFORM;
+            bad = bad || (config.dist == SEED_UNIFORM && strcmp(optarg, "uniform") != 0);
+            break;
+        case 'o':
+            config.order = strcmp(optarg, "unsorted") == 0 ? SEED_UNSORTED :
+                    strcmp(optarg, "nearly") == 0 ? SEED_NEARLY_SORTED : SEED_SORTED;
+            bad = bad || (config.order == SEED_SORTED && strcmp(optarg, "sorted") != 0);
+            break;
+        case 'l':
+            layout = strcmp(optarg, "columns") == 0 ? TABLE_LAYOUT_COLUMNS : TABLE_LAYOUT_ROWS;
+            bad = bad || (layout == TABLE_LAYOUT_ROWS && strcmp(optarg, "rows") != 0);
+            break;
+        default:
+            bad = true;
+            break;
+        }
+    }
+    if (bad || optind != argc - 1)
+    {
+        fprintf(stderr, "usage: %s [-n rows] [-d uniform|zipf|dup] [-a domain] [-z exponent] "
+                "[-k rows] [-A base] [-b domain] [-B base] [-o sorted|unsorted|nearly] "
+                "[-x fraction] [-s seed] [-l rows|columns] path\n", argv[0]);
+        return 1;
+    }
+    const char *path = argv[optind];
+
+    char err[PATH_MAX + 64];
+    if (!seed_config_check(&config, (int)nrows, err, sizeof(err)))
+    {
+        fprintf(stderr, "invalid options: %s\n", err);
+        return 1;
+    }
+
+    int nthreads = parallel_threads();
+    Row *rows = malloc(sizeof(Row)*(nrows > 0 ? nrows : 1));
+    double before = now_ms();
+    if (!rows || !seed_generate(&config, rows, (int)nrows, nthreads))
+    {
+        fprintf(stderr, "out of memory\n");
+        free(rows);
+        return 1;
+    }
+    double after = now_ms();
+
+    printf("---- Cost %.0fus(%.2fms) to generate %ld rows. ----\n",
+            (after-before)*1000, after-before, nrows);
+    print_stats(rows, (int)nrows, nthreads);
+
+    before = now_ms();
+    bool ok;
+    if (layout == TABLE_LAYOUT_COLUMNS)
+    {
+        Table *table = table_from_rows(rows, (int)nrows);
+        ok = table && tablefile_write_table(path, table, err, sizeof(err));
+        if (!table)
+        {
+            snprintf(err, sizeof(err), "out of memory");
+        }
+        table_free(table);
+    }
+    else
+    {
+        ok = tablefile_write_rows(path, rows, (uint64_t)nrows, err, sizeof(err));
+    }
+    after = now_ms();
+    free(rows);
+
+    if (!ok)
+    {
+        fprintf(stderr, "%s\n", err);
+        return 1;
+    }
+
+    printf("---- Cost %.0fus(%.2fms) to write %s. ----\n", (after-before)*1000, after-before, path);
+    return 0;
+}
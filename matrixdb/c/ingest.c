@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "row.h"
+#include "search.h"
+#include "parser.h"
+#include "arena.h"
+#include "sink.h"
+#include "merge.h"
+#include "lsm.h"
+
+/*
+ * Continuous ingest into an LsmTable. A writer thread appends rows in
+ * random order in batches while reader threads and the main thread run
+ * the query against lock-free snapshots of the table, every result is
+ * in (a,b) order without ever re-sorting the whole table. The last
+ * round prints the rows.
+ *
+ * Usage: ingest [query]
+ *    MATRIXDB_INGEST_ROWS    rows appended, default N_ROWS
+ *    MATRIXDB_INGEST_ROUNDS  queries the main thread runs while ingesting, default 8
+ *    MATRIXDB_INGEST_READERS reader threads querying meanwhile, default 4
+ */
+#define N_BASE_A 1000
+#define N_BASE_B 10
+// Number of rows that generated for testing.
+#define N_ROWS 4000000
+// Rows per append of the writer.
+#define INGEST_BATCH 1024
+#define DEFAULT_ROUNDS 8
+#define DEFAULT_READERS 4
+
+
+// WHERE expression used when none is given on the command line.
+#define DEFAULT_QUERY "a IN (1000, 2000, 3000) AND b >= 10 AND b < 50"
+
+// Query scoped allocations, released at once when the query is done.
+Arena query_arena;
+
+// Buffered writer of the result rows, see sink.h.
+ResultSink result_sink;
+
+typedef struct Ingest {
+    LsmTable *table;
+    int64_t nrows;
+    atomic_bool done;
+} Ingest;
+
+typedef struct IngestReader {
+    Ingest *ingest;
+    const Query *query;
+    int64_t queries; // queries run
+    int64_t found;   // rows found by all of them
+} IngestReader;
+
+static uint64_t next_random(uint64_t *state)
+{
+    // splitmix64
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Writer thread, appends rows with a in N_BASE_A*[1, 4096] and
+ *        b in N_BASE_B*[0, 100) in random order.
+ */
+static void* ingest_writer(void *arg)
+{
+    Ingest *ingest = (Ingest *)arg;
+    uint64_t state = 42;
+    Row batch[INGEST_BATCH];
+
+    for (int64_t done = 0; done < ingest->nrows; )
+    {
+        int n = ingest->nrows - done < INGEST_BATCH ? (int)(ingest->nrows - done) : INGEST_BATCH;
+        for (int i = 0; i < n; i++)
+        {
+            uint64_t r = next_random(&state);
+            batch[i].a = N_BASE_A*(int)(1 + (r & 4095));
+            batch[i].b = N_BASE_B*(int)((r >> 12) % 100);
+        }
+        if (!lsm_append_rows(ingest->table, batch, n))
+        {
+            fprintf(stderr, "WARN: out of memory after %lld rows\n", (long long)done);
+            break;
+        }
+        done += n;
+    }
+
+    atomic_store(&ingest->done, true);
+    return NULL;
+}
+
+/**
+ * @brief Scan the slices of query over the runs of a snapshot, the runs
+ *        are merged per slice so the rows come out in (a,b) order.
+ *
+ * @param runs Room for snap->nruns merge runs.
+ * @param tree Room for 2*snap->nruns ints.
+ * @param handle A callback receives every accepted row in (a,b) order.
+ *               You can pass a NULL handle to only count the rows.
+ * @return How many rows that accepted by the processor
+ */
+int lsm_scan(const LsmSnapshot *snap, const Query *query, MergeRun *runs, int *tree, void(*handle)(Row))
+{
+    int accepted_cnt = 0;
+    QueryLimit limit = { query, 0, 0 };
+
+    for (int i = 0; i < query->nslices && !query_limit_done(&limit); i++)
+    {
+        RangeSlice slice = query->slices[i];
+        int k = lsm_slice_runs(snap, slice, runs);
+        if (k == 0)
+        {
+            continue;
+        }
+
+        LoserTree lt;
+        merge_init(&lt, runs, k, tree, MERGE_BY_KEY);
+        Row row;
+        while (!query_limit_done(&limit) && merge_next(&lt, &row) >= 0)
+        {
+            if ((slice.covered || query_match(query, row)) && query_limit_keep(&limit, row))
+            {
+                if (handle)
+                {
+                    handle(row);
+                }
+                accepted_cnt++;
+            }
+        }
+    }
+
+    return accepted_cnt;
+}
+
+/**
+ * @brief scan_process of task2 over a snapshot, see lsm_scan.
+ */
+int lsm_scan_process(const LsmSnapshot *snap, const Query *query, void(*handle)(Row))
+{
+    clock_t before = clock();
+
+    MergeRun *runs = arena_alloc(&query_arena, sizeof(MergeRun)*(snap->nruns + 1));
+    int *tree = arena_alloc(&query_arena, sizeof(int)*2*(snap->nruns + 1));
+    if (!runs || !tree)
+    {
+        return 0;
+    }
+    int accepted_cnt = lsm_scan(snap, query, runs, tree, handle);
+
+    // rows go out before the cost line
+    sink_flush(&result_sink);
+
+    clock_t after = clock();
+
+    printf("---- Cost: %ldus(%.2fms) Total(%lld) Runs(%d) Found(%d) ----\n",
+            after-before, ((float)after-(float)before)/1000.0F, (long long)snap->nrows,
+            snap->nruns, accepted_cnt);
+
+    return accepted_cnt;
+}
+
+/**
+ * @brief Reader thread, counts the rows of the query until the writer
+ *        is done.
+ */
+static void* ingest_reader(void *arg)
+{
+    IngestReader *reader = (IngestReader *)arg;
+    LsmTable *table = reader->ingest->table;
+    int slot = lsm_reader_register(table);
+    if (slot < 0)
+    {
+        return NULL;
+    }
+
+    MergeRun *runs = NULL;
+    int *tree = NULL;
+    int cap = 0;
+    while (!atomic_load(&reader->ingest->done))
+    {
+        LsmSnapshot snap;
+        lsm_snapshot_acquire(table, slot, &snap);
+        if (snap.nruns > cap)
+        {
+            free(runs);
+            free(tree);
+            cap = snap.nruns*2;
+            runs = malloc(sizeof(MergeRun)*cap);
+            tree = malloc(sizeof(int)*2*cap);
+        }
+        if (runs && tree)
+        {
+            reader->found += lsm_scan(&snap, reader->query, runs, tree, NULL);
+            reader->queries++;
+        }
+        lsm_snapshot_release(table, &snap);
+
+        if (!runs || !tree)
+        {
+            break;
+        }
+    }
+
+    free(runs);
+    free(tree);
+    lsm_reader_unregister(table, slot);
+    return NULL;
+}
+
+void ingest_handle(Row row)
+{
+    sink_row(&result_sink, row.a, row.b);
+}
+
+static long env_long(const char *name, long fallback)
+{
+    const char *env = getenv(name);
+    long n = env ? strtol(env, NULL, 10) : fallback;
+    return n > 0 ? n : fallback;
+}
+
+int main(int argc, char **argv)
+{
+    if (!sink_init(&result_sink, STDOUT_FILENO))
+    {
+        return 1;
+    }
+
+    arena_init(&query_arena);
+
+    // The WHERE expression comes from the command line, @path reads it
+    // from a file, see parser.h.
+    char err[256];
+    Query *query = query_parse_arg(argc > 1 ? argv[1] : DEFAULT_QUERY, &query_arena, err, sizeof(err));
+    if (!query)
+    {
+        fprintf(stderr, "invalid query: %s\n", err);
+        return 1;
+    }
+    if (query->group_by_a)
+    {
+        // snapshots are scanned row by row
+        fprintf(stderr, "invalid query: GROUP BY a is not supported while ingesting\n");
+        return 1;
+    }
+
+    LsmTable table;
+    if (!lsm_init(&table))
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    if (!lsm_start(&table))
+    {
+        fprintf(stderr, "WARN: cannot start the compactor, runs are not merged\n");
+    }
+
+    Ingest ingest = { &table, env_long("MATRIXDB_INGEST_ROWS", N_ROWS), false };
+    long rounds = env_long("MATRIXDB_INGEST_ROUNDS", DEFAULT_ROUNDS);
+    int nreaders = (int)env_long("MATRIXDB_INGEST_READERS", DEFAULT_READERS);
+    nreaders = nreaders < EPOCH_MAX_READERS - 1 ? nreaders : EPOCH_MAX_READERS - 1;
+    int slot = lsm_reader_register(&table);
+
+    IngestReader *readers = calloc(nreaders, sizeof(IngestReader));
+    pthread_t *reader_threads = calloc(nreaders, sizeof(pthread_t));
+    int started = 0;
+    pthread_t writer;
+    if (pthread_create(&writer, NULL, ingest_writer, &ingest) != 0)
+    {
+        ingest_writer(&ingest);
+    }
+    else
+    {
+        for (; readers && reader_threads && started < nreaders; started++)
+        {
+            IngestReader reader = { &ingest, query, 0, 0 };
+            readers[started] = reader;
+            if (pthread_create(&reader_threads[started], NULL, ingest_reader, &readers[started]) != 0)
+            {
+                break;
+            }
+        }
+
+        // query while the writer appends
+        for (long r = 0; r < rounds && !atomic_load(&ingest.done); r++)
+        {
+            struct timespec pause = { 0, 20*1000*1000 };
+            nanosleep(&pause, NULL);
+
+            LsmSnapshot snap;
+            lsm_snapshot_acquire(&table, slot, &snap);
+            lsm_scan_process(&snap, query, NULL);
+            lsm_snapshot_release(&table, &snap);
+        }
+        pthread_join(writer, NULL);
+    }
+
+    int64_t queries = 0;
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(reader_threads[i], NULL);
+        queries += readers[i].queries;
+    }
+
+    // the final round prints its rows
+    LsmSnapshot snap;
+    lsm_snapshot_acquire(&table, slot, &snap);
+    lsm_scan_process(&snap, query, ingest_handle);
+    lsm_snapshot_release(&table, &snap);
+    lsm_reader_unregister(&table, slot);
+
+    lsm_stop(&table);
+    printf("---- Compactions(%lld) Readers(%d) Queries(%lld) ----\n",
+            (long long)table.compactions, started, (long long)queries);
+
+    free(readers);
+    free(reader_threads);
+    lsm_free(&table);
+    arena_destroy(&query_arena);
+    sink_close(&result_sink);
+}
@@ -0,0 +1,333 @@
+#ifndef MATRIXDB_INLIST_H
+#define MATRIXDB_INLIST_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "arena.h"
+
+/*
+ * Membership test of a value in a set of sorted, disjoint intervals, the
+ * a ranges of the boxes that share one b range. The probe is picked by
+ * the shape of the set:
+ *
+ *   linear  up to INLIST_LINEAR_MAX intervals, every interval is tested
+ *           with bitwise operators, no branches, the loop vectorizes
+ *   sorted  branch-free binary search over the interval starts
+ *   hash    a perfect hash of the values when every interval is a
+ *           single value and there are at least INLIST_HASH_MIN of them
+ *
+ * The perfect hash is hash-and-displace: a value hashes to a bucket of
+ * about INLIST_BUCKET_KEYS values, the displacement of the bucket moves
+ * all of them to free slots of a table with 1.25 slots per value. A
+ * probe is one hash, two loads and a compare, about 6 bytes per value,
+ * independent of the size of the list.
+ */
+#define INLIST_LINEAR_MAX 16
+#define INLIST_HASH_MIN 64
+#define INLIST_BUCKET_KEYS 4
+// slots per value of the perfect hash, 1.25 is a load of 0.8
+#define INLIST_LOAD_NUM 5
+#define INLIST_LOAD_DEN 4
+// displacements tried per bucket and seeds tried per build
+#define INLIST_MAX_DISP 65536
+#define INLIST_MAX_SEEDS 16
+
+typedef enum InListProbe {
+    INLIST_LINEAR,
+    INLIST_SORTED,
+    INLIST_HASH,
+} InListProbe;
+
+typedef struct InList {
+    InListProbe probe;
+    int n;             // number of intervals
+    int min;           // lo[0], the smallest value
+    int max;           // hi[n-1], the largest value
+    int *lo;           // sorted interval starts, inclusive
+    int *hi;           // interval ends, inclusive
+    uint64_t seed;     // INLIST_HASH: seed of the value hash
+    uint32_t nbuckets;
+    uint32_t nslots;
+    uint32_t *disp;    // displacement of every bucket, xored into the slot hash
+    int *slots;        // value of every slot, free slots repeat lo[0]
+} InList;
+
+static inline uint64_t inlist_hash(int v, uint64_t seed)
+{
+    // splitmix64 finalizer
+    uint64_t h = ((uint64_t)(uint32_t)v ^ seed) * 0x9E3779B97F4A7C15ull;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+    return h ^ (h >> 31);
+}
+
+/**
+ * @brief Map a uniform 32 bit x to [0, n) without a division.
+ */
+static inline uint32_t inlist_reduce(uint32_t x, uint32_t n)
+{
+    return (uint32_t)(((uint64_t)x * n) >> 32);
+}
+
+static inline uint32_t inlist_bucket(const InList *list, uint64_t h)
+{
+    return inlist_reduce((uint32_t)(h >> 32), list->nbuckets);
+}
+
+static inline uint32_t inlist_slot(const InList *list, uint64_t h, uint32_t disp)
+{
+    return inlist_reduce((uint32_t)h ^ disp, list->nslots);
+}
+
+static inline uint32_t inlist_disp(uint32_t d)
+{
+    return d ? (uint32_t)inlist_hash((int)d, 0x5851F42D4C957F2Dull) : 0;
+}
+
+/**
+ * @brief Try to place every value with one seed.
+ *
+ * @param order Scratch of n ints, values grouped by bucket.
+ * @param start Scratch of nbuckets + 1 ints, bucket offsets into order.
+ * @param by_size Scratch of nbuckets ints, buckets largest first.
+ * @param taken Scratch of nslots bytes.
+ * @return true when every bucket found a displacement.
+ */
+static inline bool inlist_place(InList *list, int *order, int *start, int *by_size, unsigned char *taken)
+{
+    int n = list->n;
+    int nbuckets = (int)list->nbuckets;
+
+    // counting sort of the values by bucket
+    memset(start, 0, sizeof(int)*(nbuckets + 1));
+    for (int i = 0; i < n; i++)
+    {
+        start[inlist_bucket(list, inlist_hash(list->lo[i], list->seed)) + 1]++;
+    }
+    int max_size = 0;
+    for (int k = 0; k < nbuckets; k++)
+    {
+        max_size = start[k + 1] > max_size ? start[k + 1] : max_size;
+        start[k + 1] += start[k];
+    }
+    int *fill = by_size; // borrowed as the fill cursors first
+    memcpy(fill, start, sizeof(int)*nbuckets);
+    for (int i = 0; i < n; i++)
+    {
+        order[fill[inlist_bucket(list, inlist_hash(list->lo[i], list->seed))]++] = list->lo[i];
+    }
+
+    // buckets largest first, the crowded ones get the free table
+    int m = 0;
+    for (int size = max_size; size > 0; size--)
+    {
+        for (int k = 0; k < nbuckets; k++)
+        {
+            if (start[k + 1] - start[k] == size)
+            {
+                by_size[m++] = k;
+            }
+        }
+    }
+
+    memset(taken, 0, list->nslots);
+    uint32_t pos[64];
+    for (int i = 0; i < m; i++)
+    {
+        int k = by_size[i];
+        int size = start[k + 1] - start[k];
+        if (size > (int)(sizeof(pos)/sizeof(pos[0])))
+        {
+            return false;
+        }
+
+        uint32_t d = 0;
+        for (; d < INLIST_MAX_DISP; d++)
+        {
+            uint32_t disp = inlist_disp(d);
+            bool ok = true;
+            for (int j = 0; j < size && ok; j++)
+            {
+                pos[j] = inlist_slot(list, inlist_hash(order[start[k] + j], list->seed), disp);
+                ok = !taken[pos[j]];
+                for (int l = 0; l < j && ok; l++)
+                {
+                    ok = pos[l] != pos[j];
+                }
+            }
+            if (ok)
+            {
+                list->disp[k] = disp;
+                for (int j = 0; j < size; j++)
+                {
+                    taken[pos[j]] = 1;
+                    list->slots[pos[j]] = order[start[k] + j];
+                }
+                break;
+            }
+        }
+        if (d == INLIST_MAX_DISP)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Build the perfect hash of the single value intervals of list.
+ *
+ * @return false when out of memory or no seed worked.
+ */
+static inline bool inlist_build_hash(InList *list, Arena *arena)
+{
+    int n = list->n;
+    list->nbuckets = (uint32_t)((n + INLIST_BUCKET_KEYS - 1) / INLIST_BUCKET_KEYS);
+    list->nslots = (uint32_t)((int64_t)n*INLIST_LOAD_NUM/INLIST_LOAD_DEN + 1);
+    list->disp = arena_alloc(arena, sizeof(uint32_t)*list->nbuckets);
+    list->slots = arena_alloc(arena, sizeof(int)*list->nslots);
+
+    int *order = malloc(sizeof(int)*n);
+    int *start = malloc(sizeof(int)*(list->nbuckets + 1));
+    int *by_size = malloc(sizeof(int)*list->nbuckets);
+    unsigned char *taken = malloc(list->nslots);
+
+    bool ok = false;
+    if (list->disp && list->slots && order && start && by_size && taken)
+    {
+        for (int s = 0; s < INLIST_MAX_SEEDS && !ok; s++)
+        {
+            list->seed = inlist_hash(s, 0x2545F4914F6CDD1Dull);
+            ok = inlist_place(list, order, start, by_size, taken);
+        }
+    }
+
+    if (ok)
+    {
+        // a free slot holding a member never matches a non-member
+        for (uint32_t i = 0; i < list->nslots; i++)
+        {
+            list->slots[i] = taken[i] ? list->slots[i] : list->lo[0];
+        }
+    }
+    else
+    {
+        arena_free(arena, list->disp);
+        arena_free(arena, list->slots);
+        list->disp = NULL;
+        list->slots = NULL;
+    }
+
+    free(order);
+    free(start);
+    free(by_size);
+    free(taken);
+    return ok;
+}
+
+/**
+ * @brief Initialize list over n sorted, disjoint intervals and pick its
+ *        probe. lo and hi are taken over, they must come from arena.
+ */
+static inline void inlist_init(InList *list, int *lo, int *hi, int n, Arena *arena)
+{
+    memset(list, 0, sizeof(InList));
+    list->lo = lo;
+    list->hi = hi;
+    list->n = n;
+    list->min = n > 0 ? lo[0] : 0;
+    list->max = n > 0 ? hi[n - 1] : -1;
+    list->probe = n <= INLIST_LINEAR_MAX ? INLIST_LINEAR : INLIST_SORTED;
+
+    bool points = n >= INLIST_HASH_MIN;
+    for (int i = 0; i < n && points; i++)
+    {
+        points = lo[i] == hi[i];
+    }
+    if (points)
+    {
+        // without memory or a usable seed the sorted probe still works
+        list->probe = inlist_build_hash(list, arena) ? INLIST_HASH : INLIST_SORTED;
+    }
+}
+
+static inline void inlist_free(InList *list, Arena *arena)
+{
+    arena_free(arena, list->lo);
+    arena_free(arena, list->hi);
+    arena_free(arena, list->disp);
+    arena_free(arena, list->slots);
+    memset(list, 0, sizeof(InList));
+}
+
+/**
+ * @brief Index of the last interval starting at or before v, 0 when v
+ *        is before every interval. Branch-free, the loop count only
+ *        depends on n.
+ */
+static inline int inlist_floor(const InList *list, int v)
+{
+    const int *lo = list->lo;
+    int base = 0;
+    for (int n = list->n; n > 1; )
+    {
+        int half = n / 2;
+        base = lo[base + half] <= v ? base + half : base;
+        n -= half;
+    }
+    return base;
+}
+
+static inline bool inlist_contains(const InList *list, int v)
+{
+    switch (list->probe)
+    {
+    case INLIST_LINEAR:
+    {
+        bool in = false;
+        for (int k = 0; k < list->n; k++)
+        {
+            in |= (v >= list->lo[k]) & (v <= list->hi[k]);
+        }
+        return in;
+    }
+    case INLIST_SORTED:
+    {
+        int k = inlist_floor(list, v);
+        return list->n > 0 && (v >= list->lo[k]) & (v <= list->hi[k]);
+    }
+    case INLIST_HASH:
+    {
+        uint64_t h = inlist_hash(v, list->seed);
+        return list->slots[inlist_slot(list, h, list->disp[inlist_bucket(list, h)])] == v;
+    }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Whether some value of list lies in [lo, hi], the zone map test.
+ */
+static inline bool inlist_intersects(const InList *list, int64_t lo, int64_t hi)
+{
+    if (list->n == 0 || lo > list->max || hi < list->min)
+    {
+        return false;
+    }
+
+    // the interval starting at or before lo may reach into [lo, hi],
+    // otherwise the next one must start in it.
+    int k = lo < list->min ? 0 : inlist_floor(list, (int)lo);
+    if (list->hi[k] >= lo && list->lo[k] <= hi)
+    {
+        return true;
+    }
+    return k + 1 < list->n && list->lo[k + 1] <= hi;
+}
+
+#endif // MATRIXDB_INLIST_H
@@ -0,0 +1,452 @@
+#ifndef MATRIXDB_JIT_H
+#define MATRIXDB_JIT_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "parser.h"
+
+/*
+ * Query compilation: the WHERE expression of a query is emitted as a
+ * specialized C scan loop, compiled by the system compiler into a shared
+ * object and loaded with dlopen. Objects are cached on disk by the hash
+ * of their source, the compiler and the cpu, so a repeated query only
+ * pays for the dlopen.
+ *
+ *   MATRIXDB_JIT_DIR  cache directory, default $XDG_CACHE_HOME/matrixdb-jit
+ *                     or /tmp/matrixdb-jit-<euid>
+ *   MATRIXDB_JIT_CC   compiler, default gcc
+ *
+ * Whatever sits in the cache is loaded into the process, so the cache
+ * must be a directory of this user that nobody else can write to, and
+ * the objects in it files of this user. Otherwise the query falls back
+ * to the interpreted scan.
+ */
+#define JIT_DEFAULT_DIR "/tmp/matrixdb-jit"
+#define JIT_DEFAULT_CC "gcc"
+#define JIT_SYMBOL "matrixdb_scan"
+// Most boxes compiled, longer expressions compile slower than they scan.
+#define JIT_MAX_BOXES 256
+// Bump when the generated code changes shape, it is part of the hash.
+#define JIT_ABI_VERSION 2
+
+/**
+ * @brief Signature of the generated scan, appends the indices of rows in
+ *        [begin, end) that satisfy the compiled predicate to sel.
+ */
+typedef int (*JitScan)(const int *a, const int *b, int begin, int end, int *sel);
+
+typedef struct JitKernel {
+    void    *handle;  // dlopen handle
+    JitScan  scan;
+    uint64_t hash;    // hash of the generated source
+    bool     cached;  // loaded from the cache without compiling
+} JitKernel;
+
+typedef struct JitSource {
+    char  *text;
+    size_t len;
+    size_t cap;
+    bool   failed;
+} JitSource;
+
+static inline void jit_emit(JitSource *src, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static inline void jit_emit(JitSource *src, const char *fmt, ...)
+{
+    va_list args;
+    while (!src->failed)
+    {
+        va_start(args, fmt);
+        int n = vsnprintf(src->text + src->len, src->cap - src->len, fmt, args);
+        va_end(args);
+        if (n < 0)
+        {
+            src->failed = true;
+            return;
+        }
+        if ((size_t)n < src->cap - src->len)
+        {
+            src->len += n;
+            return;
+        }
+
+        size_t cap = src->cap ? src->cap*2 : 4096;
+        while (cap - src->len <= (size_t)n)
+        {
+            cap *= 2;
+        }
+        char *text = realloc(src->text, cap);
+        if (!text)
+        {
+            src->failed = true;
+            return;
+        }
+        src->text = text;
+        src->cap = cap;
+    }
+}
+
+/**
+ * @brief Emit the test of lo <= v <= hi, one unsigned compare for a range,
+ *        nothing when the range is the whole int domain.
+ */
+static inline void jit_emit_range(JitSource *src, const char *v, int64_t lo, int64_t hi)
+{
+    if (lo == hi)
+    {
+        // an unsigned literal, INT_MIN as a long literal never equals v
+        jit_emit(src, "(%s == %uu)", v, (unsigned)(int)lo);
+    }
+    else
+    {
+        jit_emit(src, "((unsigned)%s - %uu <= %uu)", v, (unsigned)(int)lo, (unsigned)(hi - lo));
+    }
+}
+
+/**
+ * @brief Generate the scan loop of query. The predicate is evaluated with
+ *        bitwise operators only, so the first loop of each block
+ *        vectorizes, the second one only visits words with matches.
+ */
+static inline void jit_generate(JitSource *src, const Query *query)
+{
+    const BoxSet *where = &query->where;
+
+    jit_emit(src, "/* generated by matrixdb jit, abi %d */\n", JIT_ABI_VERSION);
+    jit_emit(src, "#include <stdint.h>\n#include <string.h>\n\n");
+    jit_emit(src, "#define BLOCK 1024\n\n");
+    jit_emit(src, "int " JIT_SYMBOL "(const int *restrict a, const int *restrict b, "
+            "int begin, int end, int *restrict sel)\n{\n");
+    jit_emit(src, "    int nsel = 0;\n");
+    jit_emit(src, "    unsigned char keep[BLOCK];\n\n");
+    jit_emit(src, "    (void)a; (void)b;\n");
+    jit_emit(src, "    for (int base = begin; base < end; base += BLOCK)\n    {\n");
+    jit_emit(src, "        int n = end - base < BLOCK ? end - base : BLOCK;\n");
+    jit_emit(src, "        if (n < BLOCK)\n        {\n            memset(keep, 0, sizeof(keep));\n        }\n");
+    jit_emit(src, "        for (int i = 0; i < n; i++)\n        {\n");
+    jit_emit(src, "            unsigned va = (unsigned)a[base + i], vb = (unsigned)b[base + i];\n");
+    jit_emit(src, "            (void)va; (void)vb;\n");
+    jit_emit(src, "            keep[i] = 0");
+
+    // boxes are normalized sorted by their b range, boxes sharing a b
+    // range become one b test and an OR of their a tests.
+    for (int i = 0; i < where->nboxes; )
+    {
+        const Box *first = &where->boxes[i];
+        bool full_b = first->b_lo == INT_MIN && first->b_hi == INT_MAX;
+
+        jit_emit(src, "\n                | (");
+        if (!full_b)
+        {
+            jit_emit_range(src, "vb", first->b_lo, first->b_hi);
+            jit_emit(src, " & (");
+        }
+
+        int j = i;
+        for (; j < where->nboxes && where->boxes[j].b_lo == first->b_lo &&
+                where->boxes[j].b_hi == first->b_hi; j++)
+        {
+            const Box *box = &where->boxes[j];
+            if (j > i)
+            {
+                jit_emit(src, " | ");
+            }
+            if (box->a_lo == INT_MIN && box->a_hi == INT_MAX)
+            {
+                jit_emit(src, "1");
+            }
+            else
+            {
+                jit_emit_range(src, "va", box->a_lo, box->a_hi);
+            }
+        }
+
+        jit_emit(src, full_b ? ")" : "))");
+        i = j;
+    }
+
+    jit_emit(src, ";\n        }\n");
+    jit_emit(src, "        for (int i = 0; i < n; i += 8)\n        {\n");
+    jit_emit(src, "            uint64_t word;\n");
+    jit_emit(src, "            memcpy(&word, keep + i, sizeof(word));\n");
+    jit_emit(src, "            while (word)\n            {\n");
+    jit_emit(src, "                sel[nsel++] = base + i + __builtin_ctzll(word) / 8;\n");
+    jit_emit(src, "                word &= word - 1;\n");
+    jit_emit(src, "            }\n        }\n    }\n\n");
+    jit_emit(src, "    return nsel;\n}\n");
+}
+
+static inline uint64_t jit_hash(const char *text, size_t len)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ (unsigned char)text[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/**
+ * @brief Hash of the instruction set extensions of this cpu, the flags
+ *        line of /proc/cpuinfo. Objects are built with -march=native and
+ *        the cache may be shared with other hosts, an object built for
+ *        another cpu could use instructions this one lacks. 0 when the
+ *        flags are unknown, the objects are then built for the baseline.
+ */
+static inline uint64_t jit_cpu_hash(void)
+{
+    static uint64_t cpu_hash;
+    static bool cpu_hash_known;
+    if (cpu_hash_known)
+    {
+        return cpu_hash;
+    }
+
+    FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+    if (cpuinfo)
+    {
+        char line[8192];
+        while (fgets(line, sizeof(line), cpuinfo))
+        {
+            // flags on x86, Features on arm
+            if (strncmp(line, "flags", 5) == 0 || strncmp(line, "Features", 8) == 0)
+            {
+                cpu_hash = jit_hash(line, strlen(line));
+                break;
+            }
+        }
+        fclose(cpuinfo);
+    }
+
+    cpu_hash_known = true;
+    return cpu_hash;
+}
+
+/**
+ * @brief Compile src into so with cc, returns true on success. native
+ *        builds for this cpu, see jit_cpu_hash.
+ */
+static inline bool jit_run_compiler(const char *cc, const char *src, const char *so, bool native)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        const char *argv[] = { cc, "-O3", "-shared", "-fPIC", "-w", "-o", so, src,
+                "-march=native", NULL };
+        // without native the list ends before -march
+        argv[8] = native ? argv[8] : NULL;
+        execvp(cc, (char *const *)argv);
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            return false;
+        }
+    }
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+ * @brief The cache directory, see MATRIXDB_JIT_DIR.
+ */
+static inline void jit_cache_dir(char *dir, size_t len)
+{
+    const char *env = getenv("MATRIXDB_JIT_DIR");
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    if (env && *env)
+    {
+        snprintf(dir, len, "%s", env);
+    }
+    else if (xdg && *xdg == '/')
+    {
+        snprintf(dir, len, "%s/matrixdb-jit", xdg);
+    }
+    else
+    {
+        snprintf(dir, len, "%s-%u", JIT_DEFAULT_DIR, (unsigned)geteuid());
+    }
+}
+
+/**
+ * @brief Create dir when it does not exist, and check that it is a real
+ *        directory of this user nobody else can write to.
+ */
+static inline bool jit_check_dir(const char *dir, char *err, size_t errlen)
+{
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST)
+    {
+        snprintf(err, err ? errlen : 0, "cannot create %s: %s", dir, strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != geteuid() ||
+            (st.st_mode & 077) != 0)
+    {
+        snprintf(err, err ? errlen : 0, "%s is not a private directory of this user", dir);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Whether path is a regular file of this user, not a symlink.
+ */
+static inline bool jit_owned_file(const char *path)
+{
+    struct stat st;
+    return lstat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_uid == geteuid() &&
+            (st.st_mode & 022) == 0;
+}
+
+/**
+ * @brief Compile query into a scan kernel, or load it from the cache.
+ *
+ * @param kernel Receives the kernel.
+ * @param err Receives a message on failure, can be NULL.
+ * @param errlen Size of err.
+ * @return true when kernel is ready, release it with jit_unload.
+ */
+static inline bool jit_compile(const Query *query, JitKernel *kernel, char *err, size_t errlen)
+{
+    char dir[PATH_MAX];
+    const char *cc = getenv("MATRIXDB_JIT_CC");
+    jit_cache_dir(dir, sizeof(dir));
+    cc = cc && *cc ? cc : JIT_DEFAULT_CC;
+
+    memset(kernel, 0, sizeof(JitKernel));
+    if (query->where.nboxes > JIT_MAX_BOXES)
+    {
+        snprintf(err, err ? errlen : 0, "query has %d boxes, the jit takes %d", query->where.nboxes, JIT_MAX_BOXES);
+        return false;
+    }
+
+    JitSource src = { 0 };
+    jit_generate(&src, query);
+    if (src.failed)
+    {
+        free(src.text);
+        snprintf(err, err ? errlen : 0, "out of memory");
+        return false;
+    }
+
+    // the compiler and the cpu take part in the hash, another cc or another
+    // cpu builds another object
+    uint64_t cpu = jit_cpu_hash();
+    kernel->hash = jit_hash(src.text, src.len) ^ jit_hash(cc, strlen(cc)) ^ cpu;
+
+    if (!jit_check_dir(dir, err, errlen))
+    {
+        free(src.text);
+        return false;
+    }
+
+    char so[PATH_MAX + 32], tmp_so[PATH_MAX + 32], tmp_c[PATH_MAX + 32];
+    snprintf(so, sizeof(so), "%s/%016llx.so", dir, (unsigned long long)kernel->hash);
+    snprintf(tmp_so, sizeof(tmp_so), "%s/%016llx.XXXXXX.so", dir, (unsigned long long)kernel->hash);
+    snprintf(tmp_c, sizeof(tmp_c), "%s/%016llx.XXXXXX.c", dir, (unsigned long long)kernel->hash);
+
+    struct stat st;
+    kernel->cached = lstat(so, &st) == 0;
+    if (kernel->cached && !jit_owned_file(so))
+    {
+        free(src.text);
+        snprintf(err, err ? errlen : 0, "%s is not a file of this user", so);
+        return false;
+    }
+    if (!kernel->cached)
+    {
+        // the temporary files are created here, never opened through a
+        // name someone else could have placed first.
+        int fd_c = mkstemps(tmp_c, 2);
+        int fd_so = fd_c >= 0 ? mkstemps(tmp_so, 3) : -1;
+        bool ok = fd_so >= 0 && write(fd_c, src.text, src.len) == (ssize_t)src.len;
+        ok = fd_c >= 0 && close(fd_c) == 0 && ok;
+        ok = fd_so >= 0 && close(fd_so) == 0 && ok;
+        // compile aside and rename, concurrent processes never load a
+        // half written object.
+        ok = ok && jit_run_compiler(cc, tmp_c, tmp_so, cpu != 0) && rename(tmp_so, so) == 0;
+        if (fd_c >= 0)
+        {
+            unlink(tmp_c);
+        }
+        if (!ok)
+        {
+            if (fd_so >= 0)
+            {
+                unlink(tmp_so);
+            }
+            free(src.text);
+            snprintf(err, err ? errlen : 0, "failed to compile %s with %s", so, cc);
+            return false;
+        }
+    }
+    free(src.text);
+
+    kernel->handle = dlopen(so, RTLD_NOW | RTLD_LOCAL);
+    if (!kernel->handle)
+    {
+        snprintf(err, err ? errlen : 0, "dlopen: %s", dlerror());
+        return false;
+    }
+
+    kernel->scan = (JitScan)dlsym(kernel->handle, JIT_SYMBOL);
+    if (!kernel->scan)
+    {
+        snprintf(err, err ? errlen : 0, "dlsym: %s", dlerror());
+        dlclose(kernel->handle);
+        kernel->handle = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static inline void jit_unload(JitKernel *kernel)
+{
+    if (kernel->handle)
+    {
+        dlclose(kernel->handle);
+    }
+    memset(kernel, 0, sizeof(JitKernel));
+}
+
+typedef struct JitEnv {
+    JitScan scan;
+    const int *a;
+    const int *b;
+} JitEnv;
+
+/**
+ * @brief RangeSelect of a compiled kernel, see filter.h.
+ */
+static inline int jit_env_select(const void *arg, int begin, int end, int *sel)
+{
+    const JitEnv *env = (const JitEnv *)arg;
+    return env->scan(env->a, env->b, begin, end, sel);
+}
+
+#endif // MATRIXDB_JIT_H
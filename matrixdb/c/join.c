@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <string.h>
+
+#include "row.h"
+#include "parser.h"
+#include "arena.h"
+#include "sink.h"
+#include "tablefile.h"
+#include "join.h"
+
+/*
+ * Join of two tables on a, such as today's and yesterday's snapshot,
+ * both filtered by the query. Every pair prints as "a,left_b,right_b".
+ *
+ * Usage: join [query]
+ *    MATRIXDB_JOIN_LEFT   table file of the left side, see tablefile.h
+ *    MATRIXDB_JOIN_RIGHT  table file of the right side
+ *    MATRIXDB_JOIN        merge or hash, default merge when both sides
+ *                         are rows sorted by (a,b), hash otherwise
+ *
+ * A missing table file is written from the generated rows of its side.
+ */
+#define N_BASE_A 1000
+#define N_BASE_B 10
+// Number of rows that generated for testing, per side.
+#define N_ROWS 4000000
+
+
+// WHERE expression used when none is given on the command line.
+#define DEFAULT_QUERY "a >= 1000 AND a <= 10000"
+
+// Query scoped allocations, released at once when the query is done.
+Arena query_arena;
+
+// Buffered writer of the result rows, see sink.h.
+ResultSink result_sink;
+
+/**
+ * @brief One side of the join, mapped from a table file or generated.
+ */
+typedef struct JoinSide {
+    const char *name;
+    TableFile *file;
+    Table *table;     // over the mapped columns of a column layout
+    Row *seed;
+    const Row *rows;  // row layout
+    int nrows;
+    bool sorted;      // rows sorted by (a,b)
+} JoinSide;
+
+/**
+ * @brief Rows of one side sorted by (a,b). The left side has two rows
+ *        for every a in N_BASE_A*[1, nrows/2], the right side four rows
+ *        for every odd multiple of N_BASE_A, half of the left a match.
+ */
+Row* generate_seed(int nrows, bool left)
+{
+    clock_t before = clock();
+
+    Row* rows = calloc(nrows, sizeof(Row));
+    if (!rows)
+    {
+        return NULL;
+    }
+
+    for (int i = 0; i < nrows; i++)
+    {
+        rows[i].a = left ? N_BASE_A*(1 + i/2) : N_BASE_A*(1 + 2*(i/4));
+        rows[i].b = left ? N_BASE_B*(i%2) : N_BASE_B*(i%4);
+    }
+
+    clock_t after = clock();
+
+    printf("---- Cost %ldus(%.2fms) to generate the %s seed. ----\n",
+            after-before, ((float)after-(float)before)/1000.0F, left ? "left" : "right");
+
+    return rows;
+}
+
+/**
+ * @brief Map the table file of side from path, or generate its rows and
+ *        write them to path when the file does not exist yet.
+ *
+ * @return false when the side cannot be used.
+ */
+bool open_side(JoinSide *side, const char *path, bool left)
+{
+    if (path && access(path, F_OK) == 0)
+    {
+        clock_t before = clock();
+
+        char err[PATH_MAX + 64];
+        side->file = tablefile_open(path, err, sizeof(err));
+        if (!side->file)
+        {
+            fprintf(stderr, "%s\n", err);
+            return false;
+        }
+
+        const TableFileHeader *header = side->file->header;
+        side->nrows = (int)header->nrows;
+        side->rows = side->file->rows;
+        side->sorted = side->rows && header->sort_order == TABLE_SORT_AB;
+        side->table = side->rows ? NULL : tablefile_table(side->file);
+        if (!side->rows && !side->table)
+        {
+            fprintf(stderr, "out of memory\n");
+            return false;
+        }
+
+        clock_t after = clock();
+
+        printf("---- Cost %ldus(%.2fms) to open the %s table file. ----\n",
+                after-before, ((float)after-(float)before)/1000.0F, side->name);
+        return true;
+    }
+
+    side->seed = generate_seed(N_ROWS, left);
+    if (!side->seed)
+    {
+        fprintf(stderr, "out of memory\n");
+        return false;
+    }
+    side->rows = side->seed;
+    side->nrows = N_ROWS;
+    side->sorted = true;
+
+    char werr[PATH_MAX + 64];
+    if (path && !tablefile_write_rows(path, side->seed, N_ROWS, werr, sizeof(werr)))
+    {
+        fprintf(stderr, "WARN: %s\n", werr);
+    }
+    return true;
+}
+
+void close_side(JoinSide *side)
+{
+    table_free(side->table);
+    tablefile_close(side->file);
+    free(side->seed);
+}
+
+static JoinInput side_input(const JoinSide *side)
+{
+    return side->rows ? join_input_rows(side->rows, side->nrows) : join_input_table(side->table);
+}
+
+/**
+ * @brief Join left and right on a, the pairs go to the result sink.
+ *
+ * @return Number of pairs written.
+ */
+int64_t join_process(const JoinSide *left, const JoinSide *right, const Query *query, bool merge)
+{
+    clock_t before = clock();
+
+    JoinOutput out = { &result_sink, query->offset, query_limit_end(query), 0 };
+    bool ok;
+    if (merge)
+    {
+        ok = join_merge(left->rows, left->nrows, right->rows, right->nrows, query, &out);
+    }
+    else
+    {
+        JoinInput lin = side_input(left), rin = side_input(right);
+        ok = join_hash(&lin, &rin, query, &out);
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "WARN: out of memory, the join is incomplete\n");
+    }
+
+    // rows go out before the cost line
+    sink_flush(&result_sink);
+
+    clock_t after = clock();
+
+    int64_t found = join_output_found(&out);
+    printf("---- Cost: %ldus(%.2fms) Left(%d) Right(%d) Found(%lld) ----\n",
+            after-before, ((float)after-(float)before)/1000.0F, left->nrows, right->nrows,
+            (long long)found);
+
+    return found;
+}
+
+int main(int argc, char **argv)
+{
+    if (!sink_init(&result_sink, STDOUT_FILENO))
+    {
+        return 1;
+    }
+
+    arena_init(&query_arena);
+
+    // The WHERE expression comes from the command line, @path reads it
+    // from a file, see parser.h.
+    char err[256];
+    Query *query = query_parse_arg(argc > 1 ? argv[1] : DEFAULT_QUERY, &query_arena, err, sizeof(err));
+    if (!query)
+    {
+        fprintf(stderr, "invalid query: %s\n", err);
+        return 1;
+    }
+    if (query->group_by_a || query->limit_by_a)
+    {
+        // one line per pair, the pairs of an a are not grouped
+        fprintf(stderr, "invalid query: GROUP BY a and LIMIT ... BY a do not apply to a join\n");
+        return 1;
+    }
+
+    JoinSide left = { "left", NULL, NULL, NULL, NULL, 0, false };
+    JoinSide right = { "right", NULL, NULL, NULL, NULL, 0, false };
+    if (!open_side(&left, getenv("MATRIXDB_JOIN_LEFT"), true) ||
+            !open_side(&right, getenv("MATRIXDB_JOIN_RIGHT"), false))
+    {
+        close_side(&left);
+        close_side(&right);
+        return 1;
+    }
+
+    const char *mode = getenv("MATRIXDB_JOIN");
+    bool merge = left.sorted && right.sorted && !(mode && strcmp(mode, "hash") == 0);
+    if (mode && strcmp(mode, "merge") == 0 && !merge)
+    {
+        fprintf(stderr, "WARN: the merge join needs rows sorted by (a,b), joining by hash\n");
+    }
+
+    join_process(&left, &right, query, merge);
+
+    arena_destroy(&query_arena);
+    sink_close(&result_sink);
+    close_side(&left);
+    close_side(&right);
+}
@@ -0,0 +1,620 @@
+#ifndef MATRIXDB_JOIN_H
+#define MATRIXDB_JOIN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include "row.h"
+#include "table.h"
+#include "search.h"
+#include "parser.h"
+#include "sink.h"
+#include "sort.h"
+#include "parallel.h"
+
+/*
+ * Equi-join of two tables on a, both sides filtered by the same query.
+ * Every pair of a left row and a right row with equal a prints as
+ * "a,left_b,right_b".
+ *
+ * join_merge streams two row tables sorted by (a,b), as task2-4 scan
+ * them. Each side is a cursor over the slices of the query that gallops
+ * to the a of the other side, the right rows of one a are buffered and
+ * paired with every left row of that a. The output is in
+ * (a, left_b, right_b) order and a LIMIT ends the join early.
+ *
+ * join_hash takes unsorted input such as the columns of task1. Both
+ * sides are filtered and radix partitioned by the top bits of a hash of
+ * a into partitions of about JOIN_PARTITION_ROWS build rows, so the
+ * chained hash table of a partition stays in cache while it is probed.
+ * The smaller side builds. Partitions are joined in parallel, a wave of
+ * them at a time, every thread formats its partitions into its own
+ * chunk and the chunks are written in partition order, the output does
+ * not depend on the number of threads.
+ */
+// Build rows per partition the partition bits aim for.
+#define JOIN_PARTITION_ROWS 4096
+// Fan-out of the single partitioning pass, past it the TLB thrashes.
+#define JOIN_MAX_PARTITION_BITS 12
+// Partitions per thread joined before the chunks are written.
+#define JOIN_WAVE_PARTITIONS 16
+// Smaller inputs are joined by the calling thread.
+#define JOIN_MIN_PARALLEL (64*1024)
+// Longest formatted pair, "a,left_b,right_b\n".
+#define JOIN_MAX_ROW 36
+
+/**
+ * @brief Pairs written to a sink, OFFSET n LIMIT k keeps the pairs
+ *        [offset, end) in output order.
+ */
+typedef struct JoinOutput {
+    ResultSink *sink;
+    int64_t offset;
+    int64_t end;
+    int64_t rank;  // pairs produced so far
+} JoinOutput;
+
+static inline int join_format_row(int a, int lb, int rb, char *out)
+{
+    int n = sink_itoa(a, out);
+    out[n++] = ',';
+    n += sink_itoa(lb, out + n);
+    out[n++] = ',';
+    n += sink_itoa(rb, out + n);
+    out[n++] = '\n';
+    return n;
+}
+
+static inline bool join_output_done(const JoinOutput *out)
+{
+    return out->rank >= out->end;
+}
+
+static inline void join_output_row(JoinOutput *out, int a, int lb, int rb)
+{
+    if (out->rank >= out->offset && out->rank < out->end)
+    {
+        char line[JOIN_MAX_ROW];
+        sink_text(out->sink, line, join_format_row(a, lb, rb, line));
+    }
+    out->rank++;
+}
+
+/**
+ * @brief Pairs written to the sink, the Found of a join.
+ */
+static inline int64_t join_output_found(const JoinOutput *out)
+{
+    int64_t end = out->rank < out->end ? out->rank : out->end;
+    return end > out->offset ? end - out->offset : 0;
+}
+
+/**
+ * @brief Rows of a sorted table that match a query, in (a,b) order.
+ */
+typedef struct JoinCursor {
+    const Row *rows;
+    int nrows;
+    const Query *query;
+    int slice; // current slice of query
+    int pos;   // current row, valid after a successful join_cursor_seek
+    int end;   // end of the rows of the current slice
+} JoinCursor;
+
+static inline void join_cursor_init(JoinCursor *cur, const Row *rows, int nrows, const Query *query)
+{
+    JoinCursor init = { rows, nrows, query, -1, 0, 0 };
+    *cur = init;
+}
+
+/**
+ * @brief Index of the first row of rows[pos, end) with row_key >= key.
+ *        Steps of 1, 2, 4, ... bracket it before the binary search, so
+ *        a short skip costs O(log distance) instead of O(log n).
+ */
+static inline int join_gallop(const Row *rows, int pos, int end, uint64_t key)
+{
+    if (pos >= end || row_key(rows[pos]) >= key)
+    {
+        return pos;
+    }
+
+    int lo = pos, step = 1;
+    while (lo + step < end && row_key(rows[lo + step]) < key)
+    {
+        lo += step;
+        step *= 2;
+    }
+    int hi = lo + step < end ? lo + step : end;
+
+    // rows[lo] < key <= rows[hi], the answer is in (lo, hi]
+    return lo + 1 + rows_lower_bound(rows + lo + 1, hi - lo - 1, key);
+}
+
+/**
+ * @brief Move cur to its next matching row with a >= a.
+ *
+ * @return false when there is none.
+ */
+static inline bool join_cursor_seek(JoinCursor *cur, int a)
+{
+    Row from = { a, INT_MIN };
+    uint64_t key = row_key(from);
+    const Query *query = cur->query;
+
+    for (;;)
+    {
+        if (cur->pos >= cur->end)
+        {
+            if (++cur->slice >= query->nslices)
+            {
+                return false;
+            }
+
+            RangeSlice slice = query->slices[cur->slice];
+            uint64_t last = slice_last_key(slice);
+            if (last < key)
+            {
+                // the whole slice lies before a
+                cur->end = cur->pos;
+                continue;
+            }
+            cur->pos = join_gallop(cur->rows, cur->pos, cur->nrows, row_key(slice.left));
+            cur->end = last == UINT64_MAX ? cur->nrows :
+                    join_gallop(cur->rows, cur->pos, cur->nrows, last + 1);
+            continue;
+        }
+
+        Row row = cur->rows[cur->pos];
+        if (row_key(row) < key)
+        {
+            cur->pos = join_gallop(cur->rows, cur->pos, cur->end, key);
+        }
+        else if (query->slices[cur->slice].covered || query_match(query, row))
+        {
+            return true;
+        }
+        else
+        {
+            cur->pos++;
+        }
+    }
+}
+
+/**
+ * @brief Sort-merge join of two row tables sorted by (a,b).
+ *
+ * @return false when out of memory, the output stops early.
+ */
+static inline bool join_merge(const Row *left, int nleft, const Row *right, int nright,
+                        const Query *query, JoinOutput *out)
+{
+    JoinCursor l, r;
+    join_cursor_init(&l, left, nleft, query);
+    join_cursor_init(&r, right, nright, query);
+
+    // the right rows of the current a
+    RowVec run = { NULL, 0, 0, NULL };
+    bool ok = true;
+
+    bool okl = join_cursor_seek(&l, INT_MIN);
+    bool okr = join_cursor_seek(&r, INT_MIN);
+    while (okl && okr && ok && !join_output_done(out))
+    {
+        int a = left[l.pos].a, ra = right[r.pos].a;
+        if (a < ra)
+        {
+            okl = join_cursor_seek(&l, ra);
+            continue;
+        }
+        if (ra < a)
+        {
+            okr = join_cursor_seek(&r, a);
+            continue;
+        }
+
+        run.n = 0;
+        for (; okr && right[r.pos].a == a && ok; r.pos++, okr = join_cursor_seek(&r, a))
+        {
+            ok = rowvec_push(&run, right[r.pos]);
+        }
+        for (; okl && left[l.pos].a == a && ok && !join_output_done(out); l.pos++, okl = join_cursor_seek(&l, a))
+        {
+            int lb = left[l.pos].b;
+            for (int j = 0; j < run.n; j++)
+            {
+                join_output_row(out, a, lb, run.rows[j].b);
+            }
+        }
+    }
+
+    rowvec_free(&run);
+    return ok;
+}
+
+/**
+ * @brief One side of a hash join, value i of column a is a[i*stride],
+ *        of column b b[i*stride]. A Row array has stride 2, a Table 1.
+ */
+typedef struct JoinInput {
+    const int *a;
+    const int *b;
+    size_t stride;
+    int n;
+} JoinInput;
+
+static inline JoinInput join_input_rows(const Row *rows, int nrows)
+{
+    JoinInput input = { &rows->a, &rows->b, sizeof(Row)/sizeof(int), nrows };
+    return input;
+}
+
+static inline JoinInput join_input_table(const Table *table)
+{
+    JoinInput input = { table->a, table->b, 1, table->nrows };
+    return input;
+}
+
+/**
+ * @brief Rows of one side grouped by partition, the rows of partition p
+ *        are rows[start[p], start[p + 1]).
+ */
+typedef struct JoinPartitions {
+    Row *rows;
+    int *start;
+    int n;
+} JoinPartitions;
+
+static inline uint64_t join_key_hash(int a)
+{
+    return (uint64_t)(uint32_t)a * 0x9E3779B97F4A7C15ull;
+}
+
+static inline uint32_t join_partition_of(int a, int bits)
+{
+    // the top bits, bits == 0 puts everything in partition 0
+    return bits ? (uint32_t)(join_key_hash(a) >> (64 - bits)) : 0;
+}
+
+typedef struct JoinPartitionCtx {
+    const JoinInput *input;
+    const Query *query;
+    int bits;
+    int *hist;       // hist[tid << bits | p], counts, then scatter positions
+    Row *rows;
+} JoinPartitionCtx;
+
+static inline void join_count_work(int tid, int nthreads, void *arg)
+{
+    JoinPartitionCtx *ctx = (JoinPartitionCtx *)arg;
+    const JoinInput *in = ctx->input;
+    int begin = parallel_partition(in->n, nthreads, tid, 1);
+    int end = parallel_partition(in->n, nthreads, tid + 1, 1);
+    int *hist = ctx->hist + ((size_t)tid << ctx->bits);
+
+    for (int i = begin; i < end; i++)
+    {
+        Row row = { in->a[i*in->stride], in->b[i*in->stride] };
+        hist[join_partition_of(row.a, ctx->bits)] += query_match(ctx->query, row);
+    }
+}
+
+static inline void join_scatter_work(int tid, int nthreads, void *arg)
+{
+    JoinPartitionCtx *ctx = (JoinPartitionCtx *)arg;
+    const JoinInput *in = ctx->input;
+    int begin = parallel_partition(in->n, nthreads, tid, 1);
+    int end = parallel_partition(in->n, nthreads, tid + 1, 1);
+    int *pos = ctx->hist + ((size_t)tid << ctx->bits);
+
+    for (int i = begin; i < end; i++)
+    {
+        Row row = { in->a[i*in->stride], in->b[i*in->stride] };
+        if (query_match(ctx->query, row))
+        {
+            ctx->rows[pos[join_partition_of(row.a, ctx->bits)]++] = row;
+        }
+    }
+}
+
+/**
+ * @brief Filter input by query and partition the matching rows into
+ *        1 << bits partitions. A count pass and a scatter pass, every
+ *        thread scatters to its own positions so the partitions keep
+ *        the input order.
+ *
+ * @return false when out of memory.
+ */
+static inline bool join_partition(const JoinInput *input, const Query *query, int bits,
+                        int nthreads, JoinPartitions *parts)
+{
+    int nparts = 1 << bits;
+    memset(parts, 0, sizeof(JoinPartitions));
+    int *hist = calloc((size_t)nthreads << bits, sizeof(int));
+    parts->start = malloc(sizeof(int)*(nparts + 1));
+    if (!hist || !parts->start)
+    {
+        free(hist);
+        free(parts->start);
+        parts->start = NULL;
+        return false;
+    }
+
+    JoinPartitionCtx ctx = { input, query, bits, hist, NULL };
+    parallel_run(nthreads, join_count_work, &ctx);
+
+    // scatter positions, partition major then thread
+    int total = 0;
+    for (int p = 0; p < nparts; p++)
+    {
+        parts->start[p] = total;
+        for (int t = 0; t < nthreads; t++)
+        {
+            int count = hist[((size_t)t << bits) | p];
+            hist[((size_t)t << bits) | p] = total;
+            total += count;
+        }
+    }
+    parts->start[nparts] = total;
+    parts->n = total;
+
+    ctx.rows = parts->rows = malloc(sizeof(Row)*(total ? total : 1));
+    if (!parts->rows)
+    {
+        free(hist);
+        free(parts->start);
+        parts->start = NULL;
+        return false;
+    }
+    parallel_run(nthreads, join_scatter_work, &ctx);
+
+    free(hist);
+    return true;
+}
+
+static inline void join_partitions_free(JoinPartitions *parts)
+{
+    free(parts->rows);
+    free(parts->start);
+    memset(parts, 0, sizeof(JoinPartitions));
+}
+
+/**
+ * @brief Formatted output of one thread, written after its wave.
+ */
+typedef struct JoinChunk {
+    char  *buf;
+    size_t len;
+    size_t cap;
+    bool   failed; // out of memory, later pairs are dropped
+} JoinChunk;
+
+static inline void join_chunk_row(JoinChunk *chunk, int a, int lb, int rb)
+{
+    if (chunk->cap - chunk->len < JOIN_MAX_ROW)
+    {
+        size_t cap = chunk->cap ? chunk->cap*2 : SINK_BUFFER_SIZE;
+        char *buf = chunk->failed ? NULL : realloc(chunk->buf, cap);
+        if (!buf)
+        {
+            chunk->failed = true;
+            return;
+        }
+        chunk->buf = buf;
+        chunk->cap = cap;
+    }
+
+    chunk->len += join_format_row(a, lb, rb, chunk->buf + chunk->len);
+}
+
+/**
+ * @brief Where the pairs of a probe go, out keeps the LIMIT of a serial
+ *        join, a chunk collects the pairs of a parallel one.
+ */
+typedef struct JoinEmit {
+    JoinOutput *out;
+    JoinChunk *chunk;
+    int64_t pairs;
+    bool failed;       // out of memory for the hash table
+} JoinEmit;
+
+/**
+ * @brief Hash join of the build and probe rows of one partition.
+ *
+ * @param heads Room for the buckets, the next power of two >= nbuild.
+ * @param next Room for nbuild ints.
+ * @param build_left The build rows come from the left side.
+ */
+static inline void join_probe(const Row *build, int nbuild, const Row *probe, int nprobe,
+                        bool build_left, int *heads, int *next, JoinEmit *emit)
+{
+    if (nbuild == 0 || nprobe == 0)
+    {
+        return;
+    }
+
+    uint32_t mask = 1;
+    while (mask < (uint32_t)nbuild)
+    {
+        mask <<= 1;
+    }
+    mask--;
+
+    memset(heads, -1, sizeof(int)*(mask + 1));
+    // inserted back to front, the chains list the build rows in order
+    for (int i = nbuild - 1; i >= 0; i--)
+    {
+        uint32_t h = (uint32_t)(join_key_hash(build[i].a) >> 16) & mask;
+        next[i] = heads[h];
+        heads[h] = i;
+    }
+
+    for (int i = 0; i < nprobe; i++)
+    {
+        if (emit->out && join_output_done(emit->out))
+        {
+            return;
+        }
+
+        Row row = probe[i];
+        uint32_t h = (uint32_t)(join_key_hash(row.a) >> 16) & mask;
+        for (int j = heads[h]; j >= 0; j = next[j])
+        {
+            if (build[j].a != row.a)
+            {
+                continue;
+            }
+
+            int lb = build_left ? build[j].b : row.b;
+            int rb = build_left ? row.b : build[j].b;
+            if (emit->out)
+            {
+                join_output_row(emit->out, row.a, lb, rb);
+            }
+            else
+            {
+                join_chunk_row(emit->chunk, row.a, lb, rb);
+            }
+            emit->pairs++;
+        }
+    }
+}
+
+typedef struct JoinProbeCtx {
+    const JoinPartitions *build;
+    const JoinPartitions *probe;
+    bool build_left;
+    int first;         // partitions [first, last) of the wave
+    int last;
+    JoinEmit *emits;   // one per thread
+} JoinProbeCtx;
+
+static inline void join_probe_work(int tid, int nthreads, void *arg)
+{
+    JoinProbeCtx *ctx = (JoinProbeCtx *)arg;
+    int begin = ctx->first + parallel_partition(ctx->last - ctx->first, nthreads, tid, 1);
+    int end = ctx->first + parallel_partition(ctx->last - ctx->first, nthreads, tid + 1, 1);
+    const int *bstart = ctx->build->start, *pstart = ctx->probe->start;
+
+    int most = 0;
+    for (int p = begin; p < end; p++)
+    {
+        int nbuild = bstart[p + 1] - bstart[p];
+        most = nbuild > most ? nbuild : most;
+    }
+    int *heads = malloc(sizeof(int)*2*(most ? most : 1));
+    int *next = malloc(sizeof(int)*(most ? most : 1));
+    if (!heads || !next)
+    {
+        free(heads);
+        free(next);
+        ctx->emits[tid].failed = true;
+        return;
+    }
+
+    for (int p = begin; p < end; p++)
+    {
+        join_probe(ctx->build->rows + bstart[p], bstart[p + 1] - bstart[p],
+                ctx->probe->rows + pstart[p], pstart[p + 1] - pstart[p],
+                ctx->build_left, heads, next, &ctx->emits[tid]);
+    }
+
+    free(heads);
+    free(next);
+}
+
+/**
+ * @brief Radix partitioned hash join of two unsorted inputs, pairs come
+ *        out grouped by partition. A query with a LIMIT is joined by
+ *        one thread so the limit can end it early.
+ *
+ * @return false when out of memory, the output may be incomplete.
+ */
+static inline bool join_hash(const JoinInput *left, const JoinInput *right,
+                        const Query *query, JoinOutput *out)
+{
+    int smaller = left->n < right->n ? left->n : right->n;
+    int bits = 0;
+    while ((smaller >> bits) > JOIN_PARTITION_ROWS && bits < JOIN_MAX_PARTITION_BITS)
+    {
+        bits++;
+    }
+    int nparts = 1 << bits;
+
+    int nthreads = parallel_threads();
+    if ((int64_t)left->n + right->n < JOIN_MIN_PARALLEL)
+    {
+        nthreads = 1;
+    }
+
+    JoinPartitions lparts, rparts;
+    if (!join_partition(left, query, bits, nthreads, &lparts))
+    {
+        return false;
+    }
+    if (!join_partition(right, query, bits, nthreads, &rparts))
+    {
+        join_partitions_free(&lparts);
+        return false;
+    }
+
+    bool build_left = lparts.n <= rparts.n;
+    JoinProbeCtx ctx = { build_left ? &lparts : &rparts, build_left ? &rparts : &lparts,
+            build_left, 0, nparts, NULL };
+
+    JoinEmit emits[PARALLEL_MAX_THREADS];
+    JoinChunk chunks[PARALLEL_MAX_THREADS];
+    memset(emits, 0, sizeof(emits));
+    memset(chunks, 0, sizeof(chunks));
+    ctx.emits = emits;
+
+    bool failed = false;
+    if (nthreads == 1 || query->limit >= 0)
+    {
+        emits[0].out = out;
+        join_probe_work(0, 1, &ctx);
+        failed = emits[0].failed;
+    }
+    else
+    {
+        for (int t = 0; t < nthreads; t++)
+        {
+            emits[t].chunk = &chunks[t];
+        }
+
+        int wave = nthreads*JOIN_WAVE_PARTITIONS;
+        for (int first = 0; first < nparts && !failed; first += wave)
+        {
+            ctx.first = first;
+            ctx.last = first + wave < nparts ? first + wave : nparts;
+            parallel_run(nthreads, join_probe_work, &ctx);
+
+            for (int t = 0; t < nthreads; t++)
+            {
+                // every thread has its own flags, they are combined here
+                failed = failed || emits[t].failed || chunks[t].failed;
+                if (chunks[t].len)
+                {
+                    sink_text(out->sink, chunks[t].buf, chunks[t].len);
+                }
+                chunks[t].len = 0;
+            }
+        }
+
+        for (int t = 0; t < nthreads; t++)
+        {
+            out->rank += emits[t].pairs;
+            free(chunks[t].buf);
+        }
+    }
+
+    join_partitions_free(&lparts);
+    join_partitions_free(&rparts);
+    return !failed;
+}
+
+#endif // MATRIXDB_JOIN_H
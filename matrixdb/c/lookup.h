@@ -0,0 +1,218 @@
+#ifndef MATRIXDB_LOOKUP_H
+#define MATRIXDB_LOOKUP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "row.h"
+#include "search.h"
+#include "eytzinger.h"
+#include "parallel.h"
+#include "stats.h"
+
+/*
+ * Batched exact (a,b) lookups. One search at a time waits for a cache
+ * miss at nearly every step, each step depends on the previous one.
+ * Here LOOKUP_GROUP searches advance together one step at a time: every
+ * search prefetches the row of its next step, and by the time the group
+ * comes back to it the line has arrived, so the misses of the group
+ * overlap instead of queueing.
+ *
+ * Searches over the same rows take the same number of steps, so the
+ * group needs no per search bookkeeping besides its base pointer.
+ */
+// Searches in flight, about the misses a core keeps outstanding.
+#define LOOKUP_GROUP 16
+// Keys below which a batch is resolved on the calling thread.
+#define LOOKUP_MIN_PARALLEL (1 << 16)
+
+/**
+ * @brief rows_lower_bound of n <= LOOKUP_GROUP keys at once, pos[j] is
+ *        the index of the first row >= keys[j].
+ */
+static inline void lookup_group_rows(const Row *rows, int nrows, const uint64_t *keys, int n,
+                        int *pos)
+{
+    if (nrows <= 0)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            pos[j] = 0;
+        }
+        return;
+    }
+    STATS_COUNT(STATS_SEARCHES, n);
+    STATS_COUNT(STATS_SEARCH_STEPS, n*stats_search_depth(nrows));
+
+    const Row *base[LOOKUP_GROUP];
+    for (int j = 0; j < n; j++)
+    {
+        base[j] = rows;
+    }
+
+    int len = nrows;
+    while (len > 1)
+    {
+        int half = len / 2;
+        // the next step reads base[next], fetch it while the others search
+        int next = (len - half) / 2;
+        for (int j = 0; j < n; j++)
+        {
+            base[j] = row_key(base[j][half]) < keys[j] ? base[j] + half : base[j];
+            __builtin_prefetch(base[j] + next);
+        }
+        len -= half;
+    }
+
+    for (int j = 0; j < n; j++)
+    {
+        pos[j] = (int)(base[j] - rows) + (row_key(*base[j]) < keys[j]);
+    }
+}
+
+/**
+ * @brief eytzinger_lower_bound of n <= LOOKUP_GROUP keys at once, see
+ *        lookup_group_rows. hit[j] is set when the row at pos[j] is
+ *        keys[j], the node found holds the key so no row is read.
+ */
+static inline void lookup_group_eytzinger(const Eytzinger *tree, const uint64_t *keys, int n,
+                        int *pos, bool *hit)
+{
+    const uint64_t *tkeys = tree->keys;
+    STATS_COUNT(STATS_SEARCHES, n);
+    STATS_COUNT(STATS_SEARCH_STEPS, n*stats_search_depth((int64_t)tree->n + 1));
+
+    unsigned k[LOOKUP_GROUP];
+    for (int j = 0; j < n; j++)
+    {
+        k[j] = 1;
+    }
+
+    // every search passes the complete levels, only the last level is
+    // partial and taken by some of them.
+    int levels = 31 - __builtin_clz((unsigned)tree->n + 1);
+    for (int level = 0; level < levels; level++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            k[j] = 2*k[j] + (tkeys[k[j]] < keys[j]);
+            __builtin_prefetch(tkeys + k[j]);
+        }
+    }
+
+    for (int j = 0; j < n; j++)
+    {
+        if (k[j] <= (unsigned)tree->n)
+        {
+            k[j] = 2*k[j] + (tkeys[k[j]] < keys[j]);
+        }
+        // the last node where the search went left, see eytzinger_lower_bound
+        unsigned node = k[j] >> __builtin_ffs(~k[j]);
+        pos[j] = node ? tree->rank[node] : tree->n;
+        hit[j] = node && tkeys[node] == keys[j];
+    }
+}
+
+/**
+ * @brief Look up keys[begin, end), see lookup_batch.
+ *
+ * @return Number of keys found.
+ */
+static inline int lookup_range(const Eytzinger *tree, const Row *rows, int nrows,
+                        const uint64_t *keys, int begin, int end, int *idx, bool *found)
+{
+    int pos[LOOKUP_GROUP];
+    bool hit[LOOKUP_GROUP];
+    int nfound = 0;
+
+    for (int i = begin; i < end; i += LOOKUP_GROUP)
+    {
+        int n = end - i < LOOKUP_GROUP ? end - i : LOOKUP_GROUP;
+        if (tree)
+        {
+            lookup_group_eytzinger(tree, keys + i, n, pos, hit);
+        }
+        else
+        {
+            lookup_group_rows(rows, nrows, keys + i, n, pos);
+            for (int j = 0; j < n; j++)
+            {
+                hit[j] = pos[j] < nrows && row_key(rows[pos[j]]) == keys[i + j];
+            }
+        }
+
+        for (int j = 0; j < n; j++)
+        {
+            if (idx)
+            {
+                idx[i + j] = hit[j] ? pos[j] : -1;
+            }
+            if (found)
+            {
+                found[i + j] = hit[j];
+            }
+            nfound += hit[j];
+        }
+    }
+
+    return nfound;
+}
+
+typedef struct LookupWork {
+    const Eytzinger *tree;
+    const Row *rows;
+    int nrows;
+    const uint64_t *keys;
+    int nkeys;
+    int *idx;
+    bool *found;
+    int *nfound; // one count per thread
+} LookupWork;
+
+static inline void lookup_work(int tid, int nthreads, void *arg)
+{
+    LookupWork *work = (LookupWork *)arg;
+    int begin = parallel_partition(work->nkeys, nthreads, tid, LOOKUP_GROUP);
+    int end = parallel_partition(work->nkeys, nthreads, tid + 1, LOOKUP_GROUP);
+    work->nfound[tid] = lookup_range(work->tree, work->rows, work->nrows, work->keys,
+            begin, end, work->idx, work->found);
+}
+
+/**
+ * @brief Exact lookup of a batch of keys (see row_key) in rows sorted by
+ *        (a,b), through the Eytzinger layout when tree is not NULL. Keys
+ *        need no order, large batches are split over nthreads threads.
+ *
+ * @param tree Layout built from rows, or NULL.
+ * @param rows Rows sorted by (a,b).
+ * @param nrows Number of rows.
+ * @param keys Keys to look up.
+ * @param nkeys Number of keys.
+ * @param idx idx[i] is the first row equal to keys[i], -1 when there is
+ *            none. May be NULL.
+ * @param found found[i] is set when keys[i] is in rows. May be NULL.
+ * @param nthreads Threads to use, see parallel_threads.
+ * @return Number of keys found.
+ */
+static inline int lookup_batch(const Eytzinger *tree, const Row *rows, int nrows,
+                        const uint64_t *keys, int nkeys, int *idx, bool *found, int nthreads)
+{
+    if (nkeys < LOOKUP_MIN_PARALLEL || nthreads <= 1)
+    {
+        return lookup_range(tree, rows, nrows, keys, 0, nkeys, idx, found);
+    }
+
+    nthreads = nthreads > PARALLEL_MAX_THREADS ? PARALLEL_MAX_THREADS : nthreads;
+    int nfound[PARALLEL_MAX_THREADS] = { 0 };
+    LookupWork work = { tree, rows, nrows, keys, nkeys, idx, found, nfound };
+    parallel_run(nthreads, lookup_work, &work);
+
+    int total = 0;
+    for (int t = 0; t < nthreads; t++)
+    {
+        total += nfound[t];
+    }
+    return total;
+}
+
+#endif // MATRIXDB_LOOKUP_H
@@ -0,0 +1,541 @@
+#ifndef MATRIXDB_LSM_H
+#define MATRIXDB_LSM_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "row.h"
+#include "search.h"
+#include "merge.h"
+#include "epoch.h"
+
+/*
+ * Appendable table in the shape of a log-structured merge tree. Rows
+ * go into a sorted write buffer of LSM_MEMTABLE_ROWS rows, a full
+ * buffer is frozen into an immutable run sorted by (a,b). A background
+ * compactor merges LSM_FANOUT runs of one level into one run of the next
+ * level, so a table of n rows has O(LSM_FANOUT * log n) runs.
+ *
+ * Readers never lock. The table publishes immutable versions, the runs
+ * and a copy of the write buffer, through an atomic pointer. A snapshot
+ * pins an epoch and loads the current version, every append batch and
+ * every compaction publishes a new one with one pointer swap, so a
+ * reader sees a batch entirely or not at all. Unpublished versions and
+ * compacted runs are retired and released through epoch-based
+ * reclamation once no snapshot can hold them, see epoch.h.
+ *
+ * Writers, the appending thread and the compactor, serialize on the
+ * table lock. Appending waits for the compactor when it falls behind by
+ * more than LSM_MAX_RUNS runs.
+ */
+#define LSM_MEMTABLE_ROWS 4096
+#define LSM_FANOUT 4
+#define LSM_MAX_LEVELS 32
+#define LSM_MAX_RUNS 64
+// Largest run compaction builds, rows of a run are indexed by int.
+#define LSM_MAX_RUN_ROWS (1 << 30)
+
+/**
+ * @brief Immutable run of rows sorted by (a,b).
+ */
+typedef struct LsmRun {
+    Row *rows;
+    int nrows;
+    int level; // 0 for a frozen write buffer, +1 per compaction
+} LsmRun;
+
+/**
+ * @brief Published state of a table, immutable once published.
+ */
+typedef struct LsmVersion {
+    LsmRun **runs; // oldest first, mem last when set
+    int nruns;
+    LsmRun *mem;   // private copy of the write buffer, NULL when empty
+    int64_t nrows;
+} LsmVersion;
+
+typedef struct LsmTable {
+    _Atomic(LsmVersion *) current; // the version snapshots load
+    EpochDomain epochs;
+    pthread_mutex_t lock;   // writers only
+    pthread_cond_t changed; // runs were added or compacted, or stop was set
+    Row *mem;               // sorted write buffer
+    int nmem;
+    LsmRun **runs;          // oldest first, the writers' view
+    int nruns;
+    int cap;
+    int64_t nrows;          // rows appended
+    int64_t compactions;    // runs built by compaction
+    LsmRun *dropped[LSM_FANOUT]; // compacted runs, retired once unpublished
+    int ndropped;
+    bool compacting;        // runs are being merged outside the lock
+    bool running;           // the compactor thread runs
+    bool stop;
+    pthread_t compactor;
+} LsmTable;
+
+/**
+ * @brief The rows of a table at one point in time, valid until
+ *        lsm_snapshot_release.
+ */
+typedef struct LsmSnapshot {
+    LsmRun *const *runs;
+    int nruns;
+    int64_t nrows;
+    int slot; // epoch slot of the reader
+} LsmSnapshot;
+
+static inline LsmRun* lsm_run_create(int nrows, int level)
+{
+    LsmRun *run = malloc(sizeof(LsmRun));
+    Row *rows = malloc(sizeof(Row)*(nrows > 0 ? nrows : 1));
+    if (!run || !rows)
+    {
+        free(run);
+        free(rows);
+        return NULL;
+    }
+
+    run->rows = rows;
+    run->nrows = nrows;
+    run->level = level;
+    return run;
+}
+
+static inline void lsm_run_free(void *ptr)
+{
+    LsmRun *run = (LsmRun *)ptr;
+    free(run->rows);
+    free(run);
+}
+
+static inline void lsm_version_free(void *ptr)
+{
+    LsmVersion *version = (LsmVersion *)ptr;
+    if (version->mem)
+    {
+        lsm_run_free(version->mem);
+    }
+    free(version->runs);
+    free(version);
+}
+
+/**
+ * @brief Publish the runs and the write buffer of table as the current
+ *        version, table lock held.
+ *
+ * @return false when out of memory, the previous version stays current.
+ */
+static inline bool lsm_publish(LsmTable *table)
+{
+    LsmVersion *version = malloc(sizeof(LsmVersion));
+    LsmRun **runs = malloc(sizeof(LsmRun *)*(table->nruns + 1));
+    LsmRun *mem = table->nmem > 0 ? lsm_run_create(table->nmem, 0) : NULL;
+    if (!version || !runs || (table->nmem > 0 && !mem))
+    {
+        free(version);
+        free(runs);
+        if (mem)
+        {
+            lsm_run_free(mem);
+        }
+        return false;
+    }
+
+    memcpy(runs, table->runs, sizeof(LsmRun *)*table->nruns);
+    version->runs = runs;
+    version->nruns = table->nruns;
+    version->mem = mem;
+    version->nrows = table->nrows;
+    if (mem)
+    {
+        memcpy(mem->rows, table->mem, sizeof(Row)*table->nmem);
+        runs[version->nruns++] = mem;
+    }
+
+    LsmVersion *old = atomic_exchange(&table->current, version);
+    if (old)
+    {
+        epoch_retire(&table->epochs, old, lsm_version_free);
+    }
+    for (int i = 0; i < table->ndropped; i++)
+    {
+        epoch_retire(&table->epochs, table->dropped[i], lsm_run_free);
+    }
+    table->ndropped = 0;
+    epoch_reclaim(&table->epochs);
+    return true;
+}
+
+static inline bool lsm_init(LsmTable *table)
+{
+    memset(table, 0, sizeof(LsmTable));
+    atomic_init(&table->current, NULL);
+    epoch_init(&table->epochs);
+    table->mem = malloc(sizeof(Row)*LSM_MEMTABLE_ROWS);
+    if (!table->mem || !lsm_publish(table))
+    {
+        free(table->mem);
+        return false;
+    }
+
+    pthread_mutex_init(&table->lock, NULL);
+    pthread_cond_init(&table->changed, NULL);
+    return true;
+}
+
+/**
+ * @brief Add run to the newest end of the runs, table lock held.
+ */
+static inline bool lsm_push_run(LsmTable *table, LsmRun *run)
+{
+    if (table->nruns == table->cap)
+    {
+        int cap = table->cap ? table->cap*2 : 16;
+        LsmRun **runs = realloc(table->runs, sizeof(LsmRun *)*cap);
+        if (!runs)
+        {
+            return false;
+        }
+        table->runs = runs;
+        table->cap = cap;
+    }
+
+    table->runs[table->nruns++] = run;
+    return true;
+}
+
+/**
+ * @brief Freeze the write buffer into a run of level 0, table lock held.
+ *        Waits while the compactor is LSM_MAX_RUNS runs behind.
+ */
+static inline bool lsm_freeze(LsmTable *table)
+{
+    while (table->running && table->nruns >= LSM_MAX_RUNS)
+    {
+        pthread_cond_wait(&table->changed, &table->lock);
+    }
+
+    LsmRun *run = lsm_run_create(table->nmem, 0);
+    if (!run)
+    {
+        return false;
+    }
+    memcpy(run->rows, table->mem, sizeof(Row)*table->nmem);
+    if (!lsm_push_run(table, run))
+    {
+        lsm_run_free(run);
+        return false;
+    }
+
+    table->nmem = 0;
+    pthread_cond_broadcast(&table->changed);
+    return true;
+}
+
+/**
+ * @brief Append rows to table, they become visible at once to the
+ *        snapshots taken after the call. Every call copies the write
+ *        buffer for the readers, append in batches.
+ *
+ * @return false when out of memory, rows before the failing one were
+ *         appended and may become visible with the next call.
+ */
+static inline bool lsm_append_rows(LsmTable *table, const Row *rows, int nrows)
+{
+    bool ok = true;
+    pthread_mutex_lock(&table->lock);
+
+    for (int i = 0; i < nrows; i++)
+    {
+        if (table->nmem == LSM_MEMTABLE_ROWS && !lsm_freeze(table))
+        {
+            ok = false;
+            break;
+        }
+
+        // insertion into the sorted buffer, the memmove stays in L1
+        int pos = rows_upper_bound(table->mem, table->nmem, row_key(rows[i]));
+        memmove(table->mem + pos + 1, table->mem + pos, sizeof(Row)*(table->nmem - pos));
+        table->mem[pos] = rows[i];
+        table->nmem++;
+        table->nrows++;
+    }
+    ok = lsm_publish(table) && ok;
+
+    pthread_mutex_unlock(&table->lock);
+    return ok;
+}
+
+/**
+ * @brief Lowest level with LSM_FANOUT runs whose merge fits into a run,
+ *        -1 when there is nothing to compact. Table lock held.
+ */
+static inline int lsm_pick_level(const LsmTable *table)
+{
+    int count[LSM_MAX_LEVELS] = { 0 };
+    int64_t rows[LSM_MAX_LEVELS] = { 0 };
+    for (int i = 0; i < table->nruns; i++)
+    {
+        const LsmRun *run = table->runs[i];
+        if (run->level < LSM_MAX_LEVELS - 1 && count[run->level] < LSM_FANOUT)
+        {
+            count[run->level]++;
+            rows[run->level] += run->nrows;
+        }
+    }
+
+    for (int level = 0; level < LSM_MAX_LEVELS - 1; level++)
+    {
+        if (count[level] == LSM_FANOUT && rows[level] <= LSM_MAX_RUN_ROWS)
+        {
+            return level;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Merge the LSM_FANOUT oldest runs of the lowest full level into
+ *        one run of the next level. The merge runs outside the lock,
+ *        appends and snapshots go on meanwhile.
+ *
+ * @return false when there was nothing to compact or out of memory.
+ */
+static inline bool lsm_compact(LsmTable *table)
+{
+    pthread_mutex_lock(&table->lock);
+    int level = table->compacting || table->ndropped > 0 ? -1 : lsm_pick_level(table);
+    if (level < 0)
+    {
+        pthread_mutex_unlock(&table->lock);
+        return false;
+    }
+
+    LsmRun *picked[LSM_FANOUT];
+    int npicked = 0;
+    int64_t nrows = 0;
+    for (int i = 0; i < table->nruns && npicked < LSM_FANOUT; i++)
+    {
+        if (table->runs[i]->level == level)
+        {
+            picked[npicked++] = table->runs[i];
+            nrows += table->runs[i]->nrows;
+        }
+    }
+    table->compacting = true;
+    pthread_mutex_unlock(&table->lock);
+
+    // the picked runs are immutable and stay in the table until they
+    // are replaced below.
+    LsmRun *merged = lsm_run_create((int)nrows, level + 1);
+    if (merged)
+    {
+        MergeRun runs[LSM_FANOUT];
+        int tree[2*LSM_FANOUT];
+        for (int i = 0; i < npicked; i++)
+        {
+            MergeRun run = { picked[i]->rows, picked[i]->rows + picked[i]->nrows, NULL, NULL };
+            runs[i] = run;
+        }
+
+        LoserTree lt;
+        merge_init(&lt, runs, npicked, tree, MERGE_BY_KEY);
+        Row *out = merged->rows;
+        while (merge_next(&lt, out) >= 0)
+        {
+            out++;
+        }
+    }
+
+    pthread_mutex_lock(&table->lock);
+    if (merged)
+    {
+        // the merged run takes the place of the oldest picked run, the
+        // others are dropped, the runs stay ordered by age.
+        int n = 0;
+        for (int i = 0; i < table->nruns; i++)
+        {
+            LsmRun *run = table->runs[i];
+            bool was_picked = false;
+            for (int j = 0; j < npicked; j++)
+            {
+                was_picked = was_picked || run == picked[j];
+            }
+            if (!was_picked)
+            {
+                table->runs[n++] = run;
+            }
+            else if (run == picked[0])
+            {
+                table->runs[n++] = merged;
+            }
+        }
+        table->nruns = n;
+        table->compactions++;
+
+        // the picked runs are retired once a version without them is
+        // published, snapshots of older versions may still read them.
+        memcpy(table->dropped, picked, sizeof(LsmRun *)*npicked);
+        table->ndropped = npicked;
+        lsm_publish(table);
+    }
+    table->compacting = false;
+    pthread_cond_broadcast(&table->changed);
+    pthread_mutex_unlock(&table->lock);
+
+    return merged != NULL;
+}
+
+static inline void* lsm_compactor(void *arg)
+{
+    LsmTable *table = (LsmTable *)arg;
+
+    pthread_mutex_lock(&table->lock);
+    while (!table->stop)
+    {
+        if (lsm_pick_level(table) < 0)
+        {
+            pthread_cond_wait(&table->changed, &table->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&table->lock);
+        bool ok = lsm_compact(table);
+        pthread_mutex_lock(&table->lock);
+        if (!ok && !table->stop)
+        {
+            // out of memory, retry on the next change of the table
+            pthread_cond_wait(&table->changed, &table->lock);
+        }
+    }
+    pthread_mutex_unlock(&table->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Start the background compactor, without it call lsm_compact.
+ */
+static inline bool lsm_start(LsmTable *table)
+{
+    pthread_mutex_lock(&table->lock);
+    table->stop = false;
+    table->running = pthread_create(&table->compactor, NULL, lsm_compactor, table) == 0;
+    bool running = table->running;
+    pthread_mutex_unlock(&table->lock);
+    return running;
+}
+
+/**
+ * @brief Stop the compactor, a merge in progress is finished first.
+ */
+static inline void lsm_stop(LsmTable *table)
+{
+    pthread_mutex_lock(&table->lock);
+    bool running = table->running;
+    table->stop = true;
+    pthread_cond_broadcast(&table->changed);
+    pthread_mutex_unlock(&table->lock);
+
+    if (running)
+    {
+        pthread_join(table->compactor, NULL);
+        pthread_mutex_lock(&table->lock);
+        table->running = false;
+        pthread_cond_broadcast(&table->changed);
+        pthread_mutex_unlock(&table->lock);
+    }
+}
+
+/**
+ * @brief Claim an epoch slot for a reader thread.
+ *
+ * @return The slot for lsm_snapshot_acquire, -1 when all
+ *         EPOCH_MAX_READERS are taken.
+ */
+static inline int lsm_reader_register(LsmTable *table)
+{
+    return epoch_register(&table->epochs);
+}
+
+static inline void lsm_reader_unregister(LsmTable *table, int slot)
+{
+    epoch_unregister(&table->epochs, slot);
+}
+
+/**
+ * @brief Take a snapshot of table, no lock and no copy. Release it
+ *        with lsm_snapshot_release before the next acquire of slot.
+ */
+static inline void lsm_snapshot_acquire(LsmTable *table, int slot, LsmSnapshot *snap)
+{
+    epoch_enter(&table->epochs, slot);
+    const LsmVersion *version = atomic_load(&table->current);
+    snap->runs = version->runs;
+    snap->nruns = version->nruns;
+    snap->nrows = version->nrows;
+    snap->slot = slot;
+}
+
+static inline void lsm_snapshot_release(LsmTable *table, LsmSnapshot *snap)
+{
+    epoch_exit(&table->epochs, snap->slot);
+    memset(snap, 0, sizeof(LsmSnapshot));
+}
+
+/**
+ * @brief The rows of every run of snap within slice as merge runs.
+ *
+ * @param runs Room for snap->nruns runs, receives the non-empty ones.
+ * @return Number of runs written.
+ */
+static inline int lsm_slice_runs(const LsmSnapshot *snap, RangeSlice slice, MergeRun *runs)
+{
+    int k = 0;
+    for (int i = 0; i < snap->nruns; i++)
+    {
+        const LsmRun *run = snap->runs[i];
+        int begin, end;
+        rows_slice_range(run->rows, run->nrows, slice, &begin, &end);
+        if (begin < end)
+        {
+            MergeRun merge_run = { run->rows + begin, run->rows + end, NULL, NULL };
+            runs[k++] = merge_run;
+        }
+    }
+
+    return k;
+}
+
+/**
+ * @brief Stop the compactor and release the table, snapshots must be
+ *        released before.
+ */
+static inline void lsm_free(LsmTable *table)
+{
+    lsm_stop(table);
+
+    for (int i = 0; i < table->nruns; i++)
+    {
+        lsm_run_free(table->runs[i]);
+    }
+    for (int i = 0; i < table->ndropped; i++)
+    {
+        lsm_run_free(table->dropped[i]);
+    }
+    lsm_version_free(atomic_load(&table->current));
+    epoch_destroy(&table->epochs);
+    free(table->runs);
+    free(table->mem);
+    pthread_cond_destroy(&table->changed);
+    pthread_mutex_destroy(&table->lock);
+    memset(table, 0, sizeof(LsmTable));
+}
+
+#endif // MATRIXDB_LSM_H
@@ -0,0 +1,154 @@
+#ifndef MATRIXDB_MERGE_H
+#define MATRIXDB_MERGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "row.h"
+#include "search.h"
+
+/*
+ * K-way merge of sorted runs of rows through a loser tree. Every pop
+ * replays one leaf to root path, O(log k) compares per row and O(k)
+ * memory, the runs themselves are never copied.
+ *
+ * Runs are merged by b (ORDER BY b over slices of a single a) or by the
+ * packed (a,b) key. Equal keys come out in run order, so merging runs
+ * that are ordered by a yields the same order as a stable sort.
+ */
+typedef enum MergeOrder {
+    MERGE_BY_B,   // (uint32)b ^ sign, ORDER BY b
+    MERGE_BY_KEY, // row_key(row), (a,b) order
+} MergeOrder;
+
+/**
+ * @brief A sorted run [cur, end), accept filters its rows when not NULL.
+ */
+typedef struct MergeRun {
+    const Row *cur;
+    const Row *end;
+    bool (*accept)(const void *env, Row row);
+    const void *env;
+} MergeRun;
+
+typedef struct LoserTree {
+    int k;
+    int *tree;       // tree[0] is the winner, tree[1..k) the losers
+    MergeRun *runs;
+    MergeOrder order;
+} LoserTree;
+
+static inline uint64_t merge_key(MergeOrder order, Row row)
+{
+    return order == MERGE_BY_B ? (uint64_t)((uint32_t)row.b ^ 0x80000000u) : row_key(row);
+}
+
+/**
+ * @brief Move run to its next accepted row.
+ */
+static inline void merge_run_skip(MergeRun *run)
+{
+    while (run->accept && run->cur < run->end && !run->accept(run->env, *run->cur))
+    {
+        run->cur++;
+    }
+}
+
+/**
+ * @brief Whether run i beats run j, exhausted runs lose against all.
+ */
+static inline bool merge_less(const LoserTree *lt, int i, int j)
+{
+    const MergeRun *ri = &lt->runs[i], *rj = &lt->runs[j];
+    if (ri->cur == ri->end)
+    {
+        return false;
+    }
+    if (rj->cur == rj->end)
+    {
+        return true;
+    }
+
+    uint64_t ki = merge_key(lt->order, *ri->cur);
+    uint64_t kj = merge_key(lt->order, *rj->cur);
+    return ki < kj || (ki == kj && i < j);
+}
+
+/**
+ * @brief Build the tree over k runs.
+ *
+ * @param runs The runs, advanced while merging.
+ * @param k Number of runs, at least 1.
+ * @param tree Storage of 2k ints.
+ */
+static inline void merge_init(LoserTree *lt, MergeRun *runs, int k, int *tree, MergeOrder order)
+{
+    lt->k = k;
+    lt->tree = tree;
+    lt->runs = runs;
+    lt->order = order;
+
+    for (int i = 0; i < k; i++)
+    {
+        merge_run_skip(&runs[i]);
+    }
+
+    // leaf i is node k + i, win[] holds the winner of each inner node
+    // while the tree keeps its loser.
+    int *win = tree + k;
+    for (int node = k - 1; node >= 1; node--)
+    {
+        int l = 2*node >= k ? 2*node - k : win[2*node];
+        int r = 2*node + 1 >= k ? 2*node + 1 - k : win[2*node + 1];
+        bool left = merge_less(lt, l, r) || !merge_less(lt, r, l);
+        win[node] = left ? l : r;
+        tree[node] = left ? r : l;
+    }
+    tree[0] = k > 1 ? win[1] : 0;
+}
+
+/**
+ * @brief Pop the smallest row of all runs.
+ *
+ * @return The run the row came from, -1 when every run is exhausted.
+ */
+static inline int merge_next(LoserTree *lt, Row *out)
+{
+    int w = lt->tree[0];
+    MergeRun *run = &lt->runs[w];
+    if (run->cur == run->end)
+    {
+        return -1;
+    }
+    int from = w;
+
+    *out = *run->cur++;
+    merge_run_skip(run);
+
+    // replay the path of the winner's leaf
+    for (int node = (w + lt->k) / 2; node > 0; node /= 2)
+    {
+        if (merge_less(lt, lt->tree[node], w))
+        {
+            int loser = w;
+            w = lt->tree[node];
+            lt->tree[node] = loser;
+        }
+    }
+    lt->tree[0] = w;
+    STATS_COUNT(STATS_COMPARES, stats_search_depth(lt->k));
+
+    return from;
+}
+
+/**
+ * @brief Whether every row of slice has the same a, such a slice of a
+ *        (a,b) sorted table is a run sorted by b.
+ */
+static inline bool slice_single_a(RangeSlice slice)
+{
+    uint64_t last = slice_last_key(slice);
+    return last >= row_key(slice.left) && key_row(last).a == slice.left.a;
+}
+
+#endif // MATRIXDB_MERGE_H
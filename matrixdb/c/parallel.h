@@ -0,0 +1,105 @@
+#ifndef MATRIXDB_PARALLEL_H
+#define MATRIXDB_PARALLEL_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Upper bound of worker threads of a single parallel operation.
+#define PARALLEL_MAX_THREADS 256
+
+/**
+ * @brief Number of threads parallel operations should use, configured
+ *        by MATRIXDB_THREADS, defaults to the number of online cores.
+ */
+static inline int parallel_threads(void)
+{
+    const char *env = getenv("MATRIXDB_THREADS");
+    long n = env ? strtol(env, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n < 1)
+    {
+        n = 1;
+    }
+    if (n > PARALLEL_MAX_THREADS)
+    {
+        n = PARALLEL_MAX_THREADS;
+    }
+
+    return (int)n;
+}
+
+/**
+ * @brief Work of one thread, tid is in [0, nthreads).
+ */
+typedef void (*ParallelWork)(int tid, int nthreads, void *ctx);
+
+typedef struct ParallelTask {
+    ParallelWork work;
+    void *ctx;
+    int tid;
+    int nthreads;
+} ParallelTask;
+
+static inline void* parallel_trampoline(void *arg)
+{
+    ParallelTask *task = (ParallelTask *)arg;
+    task->work(task->tid, task->nthreads, task->ctx);
+    return NULL;
+}
+
+/**
+ * @brief Run work on nthreads threads and wait for all of them, the
+ *        calling thread runs tid 0. Falls back to fewer threads when
+ *        threads cannot be created, every tid is still executed.
+ */
+static inline void parallel_run(int nthreads, ParallelWork work, void *ctx)
+{
+    pthread_t threads[PARALLEL_MAX_THREADS];
+    ParallelTask tasks[PARALLEL_MAX_THREADS];
+    bool started[PARALLEL_MAX_THREADS];
+
+    if (nthreads > PARALLEL_MAX_THREADS)
+    {
+        nthreads = PARALLEL_MAX_THREADS;
+    }
+
+    for (int t = 1; t < nthreads; t++)
+    {
+        tasks[t] = (ParallelTask){ work, ctx, t, nthreads };
+        started[t] = pthread_create(&threads[t], NULL, parallel_trampoline, &tasks[t]) == 0;
+    }
+
+    work(0, nthreads, ctx);
+
+    for (int t = 1; t < nthreads; t++)
+    {
+        if (started[t])
+        {
+            pthread_join(threads[t], NULL);
+        }
+        else
+        {
+            work(t, nthreads, ctx);
+        }
+    }
+}
+
+/**
+ * @brief Split [0, n) into nparts partitions aligned to `align` items,
+ *        return the beginning of partition part (part == nparts gives n).
+ */
+static inline int parallel_partition(int n, int nparts, int part, int align)
+{
+    if (part >= nparts)
+    {
+        return n;
+    }
+
+    long begin = (long)n*part/nparts;
+    begin -= begin % align;
+    return (int)begin;
+}
+
+#endif // MATRIXDB_PARALLEL_H
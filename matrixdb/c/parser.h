@@ -0,0 +1,914 @@
+#ifndef MATRIXDB_PARSER_H
+#define MATRIXDB_PARSER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include "row.h"
+#include "search.h"
+#include "arena.h"
+#include "inlist.h"
+
+/*
+ * WHERE expressions over the columns `a` and `b`:
+ *
+ *   expr   := term { OR term }
+ *   term   := factor { AND factor }
+ *   factor := '(' expr ')'
+ *           | column IN '(' int { ',' int } ')'
+ *           | column BETWEEN int AND int          (inclusive, as in SQL)
+ *           | column op int                       op: = == != <> < <= > >=
+ *   column := a | b
+ *
+ * An expression is normalized into a union of boxes (a range x b range),
+ * the boxes become sorted, merged and non-overlapping RangeSlices of the
+ * (a,b) order.
+ *
+ * The expression can be followed by a grouping and a limit of the
+ * result rows:
+ *
+ *   query  := expr [ GROUP BY a ] [ LIMIT int [ OFFSET int ] [ BY a ] ]
+ *
+ * GROUP BY a turns the rows of every a into one line
+ * "a,COUNT(b),SUM(b),MIN(b),MAX(b)", see agg.h.
+ * LIMIT k OFFSET n keeps the result rows [n, n+k) in output order,
+ * LIMIT k BY a keeps them within the rows of every a. With GROUP BY the
+ * limit applies to the groups.
+ */
+
+// Longest a range expanded into one exact slice per value of a.
+#define QUERY_EXPAND_LIMIT 64
+// Longest accepted query text, room for IN-lists of a million values.
+#define QUERY_MAX_TEXT (16 << 20)
+
+/**
+ * @brief Rows with a_lo <= a <= a_hi and b_lo <= b <= b_hi, bounds are
+ *        inclusive and kept in 64 bits so `a < INT_MIN` is just empty.
+ */
+typedef struct Box {
+    int64_t a_lo;
+    int64_t a_hi;
+    int64_t b_lo;
+    int64_t b_hi;
+} Box;
+
+/**
+ * @brief Union of boxes, the disjunctive normal form of an expression.
+ */
+typedef struct BoxSet {
+    Box *boxes;
+    int  nboxes;
+    int  cap;
+    Arena *arena; // arena of the boxes, NULL for malloc
+} BoxSet;
+
+/**
+ * @brief The boxes of where that share one b range, their a ranges are
+ *        probed as one InList.
+ */
+typedef struct QueryGroup {
+    int64_t b_lo;
+    int64_t b_hi;
+    InList a;
+} QueryGroup;
+
+/**
+ * @brief Parsed query.
+ */
+typedef struct Query {
+    BoxSet where;       // rows the query selects
+    RangeSlice *slices; // sorted, merged, non-overlapping slices covering where
+    int nslices;
+    QueryGroup *groups; // where grouped by b range, in box order
+    int ngroups;
+    int64_t limit;      // LIMIT k, -1 without limit
+    int64_t offset;     // OFFSET n
+    bool limit_by_a;    // the limit applies to the rows of every a
+    bool group_by_a;    // GROUP BY a, one aggregate line per a
+    Arena *arena;       // arena the query lives in, NULL for malloc
+} Query;
+
+typedef enum TokenType {
+    TOKEN_END,
+    TOKEN_INT,
+    TOKEN_IDENT,
+    TOKEN_LPAREN,
+    TOKEN_RPAREN,
+    TOKEN_COMMA,
+    TOKEN_OP,
+    TOKEN_ERROR,
+} TokenType;
+
+typedef struct Token {
+    TokenType type;
+    const char *text;
+    int len;
+    int64_t value;
+} Token;
+
+typedef struct Parser {
+    const char *cur;
+    Token tok;
+    char *err;
+    size_t errlen;
+    bool failed;
+} Parser;
+
+static inline void box_set_free(BoxSet *set)
+{
+    arena_free(set->arena, set->boxes);
+    set->boxes = NULL;
+    set->nboxes = set->cap = 0;
+}
+
+static inline bool box_set_add(BoxSet *set, Box box)
+{
+    if (box.a_lo > box.a_hi || box.b_lo > box.b_hi)
+    {
+        // empty boxes are dropped
+        return true;
+    }
+
+    if (set->nboxes == set->cap)
+    {
+        int cap = set->cap ? set->cap*2 : 4;
+        Box *boxes = arena_realloc(set->arena, set->boxes, sizeof(Box)*set->cap, sizeof(Box)*cap);
+        if (!boxes)
+        {
+            return false;
+        }
+        set->boxes = boxes;
+        set->cap = cap;
+    }
+
+    set->boxes[set->nboxes++] = box;
+    return true;
+}
+
+static inline int box_compare(const void *x, const void *y)
+{
+    const Box *l = (const Box *)x, *r = (const Box *)y;
+    if (l->b_lo != r->b_lo) return l->b_lo < r->b_lo ? -1 : 1;
+    if (l->b_hi != r->b_hi) return l->b_hi < r->b_hi ? -1 : 1;
+    if (l->a_lo != r->a_lo) return l->a_lo < r->a_lo ? -1 : 1;
+    return 0;
+}
+
+/**
+ * @brief Merge boxes with the same b range whose a ranges overlap or
+ *        touch, `a IN (1,2,3)` becomes the single box a in [1,3].
+ */
+static inline void box_set_normalize(BoxSet *set)
+{
+    if (set->nboxes < 2)
+    {
+        return;
+    }
+
+    qsort(set->boxes, set->nboxes, sizeof(Box), box_compare);
+
+    int n = 0;
+    for (int i = 1; i < set->nboxes; i++)
+    {
+        Box *last = &set->boxes[n];
+        Box *box = &set->boxes[i];
+        if (box->b_lo == last->b_lo && box->b_hi == last->b_hi && box->a_lo <= last->a_hi + 1)
+        {
+            last->a_hi = box->a_hi > last->a_hi ? box->a_hi : last->a_hi;
+        }
+        else
+        {
+            set->boxes[++n] = *box;
+        }
+    }
+    set->nboxes = n + 1;
+}
+
+static inline bool box_contains(const Box *box, Row row)
+{
+    return row.a >= box->a_lo && row.a <= box->a_hi && row.b >= box->b_lo && row.b <= box->b_hi;
+}
+
+/**
+ * @brief Whether query selects row, one b test and one InList probe per
+ *        b range however many boxes there are.
+ */
+static inline bool query_match(const Query *query, Row row)
+{
+    for (int i = 0; i < query->ngroups; i++)
+    {
+        const QueryGroup *group = &query->groups[i];
+        if (row.b >= group->b_lo && row.b <= group->b_hi && inlist_contains(&group->a, row.a))
+        {
+            return true;
+        }
+    }
+    if (query->groups)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < query->where.nboxes; i++)
+    {
+        if (box_contains(&query->where.boxes[i], row))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static inline void parser_fail(Parser *p, const char *msg)
+{
+    if (!p->failed && p->err && p->errlen)
+    {
+        snprintf(p->err, p->errlen, "%s near '%.*s'", msg,
+                p->tok.len > 0 ? p->tok.len : 5, p->tok.len > 0 ? p->tok.text : "<end>");
+    }
+    p->failed = true;
+}
+
+static inline void parser_next(Parser *p)
+{
+    const char *s = p->cur;
+    while (isspace((unsigned char)*s))
+    {
+        s++;
+    }
+
+    Token tok = { TOKEN_END, s, 0, 0 };
+    if (!*s)
+    {
+        p->tok = tok;
+        p->cur = s;
+        return;
+    }
+
+    if (isdigit((unsigned char)*s) || ((*s == '-' || *s == '+') && isdigit((unsigned char)s[1])))
+    {
+        char *end;
+        long long v = strtoll(s, &end, 10);
+        tok.type = v < INT_MIN || v > INT_MAX ? TOKEN_ERROR : TOKEN_INT;
+        tok.value = v;
+        tok.len = (int)(end - s);
+    }
+    else if (isalpha((unsigned char)*s) || *s == '_')
+    {
+        const char *e = s;
+        while (isalnum((unsigned char)*e) || *e == '_')
+        {
+            e++;
+        }
+        tok.type = TOKEN_IDENT;
+        tok.len = (int)(e - s);
+    }
+    else if (*s == '(' || *s == ')' || *s == ',')
+    {
+        tok.type = *s == '(' ? TOKEN_LPAREN : *s == ')' ? TOKEN_RPAREN : TOKEN_COMMA;
+        tok.len = 1;
+    }
+    else if (strchr("=!<>", *s))
+    {
+        tok.type = TOKEN_OP;
+        tok.len = (s[1] == '=' || (s[0] == '<' && s[1] == '>')) ? 2 : 1;
+        if (s[0] == '!' && tok.len == 1)
+        {
+            tok.type = TOKEN_ERROR;
+        }
+    }
+    else
+    {
+        tok.type = TOKEN_ERROR;
+        tok.len = 1;
+    }
+
+    p->tok = tok;
+    p->cur = s + tok.len;
+}
+
+static inline bool token_is(const Token *tok, const char *word)
+{
+    return tok->type == TOKEN_IDENT && (int)strlen(word) == tok->len &&
+            strncasecmp(tok->text, word, tok->len) == 0;
+}
+
+static inline bool token_op(const Token *tok, const char *op)
+{
+    return tok->type == TOKEN_OP && (int)strlen(op) == tok->len &&
+            strncmp(tok->text, op, tok->len) == 0;
+}
+
+static inline bool parser_int(Parser *p, int64_t *value)
+{
+    if (p->tok.type != TOKEN_INT)
+    {
+        parser_fail(p, p->tok.type == TOKEN_ERROR && p->tok.len > 1 ? 
+                "integer out of range" : "expected an integer");
+        return false;
+    }
+
+    *value = p->tok.value;
+    parser_next(p);
+    return true;
+}
+
+/**
+ * @brief Box of the full domain with column restricted to [lo, hi].
+ */
+static inline Box box_of(Column column, int64_t lo, int64_t hi)
+{
+    Box box = { INT_MIN, INT_MAX, INT_MIN, INT_MAX };
+    if (column == COLUMN_A)
+    {
+        box.a_lo = lo;
+        box.a_hi = hi;
+    }
+    else
+    {
+        box.b_lo = lo;
+        box.b_hi = hi;
+    }
+    return box;
+}
+
+/**
+ * @brief AND of two box sets, pairwise intersection.
+ */
+static inline bool box_set_and(BoxSet *out, const BoxSet *l, const BoxSet *r)
+{
+    for (int i = 0; i < l->nboxes; i++)
+    {
+        for (int j = 0; j < r->nboxes; j++)
+        {
+            const Box *x = &l->boxes[i], *y = &r->boxes[j];
+            Box box = {
+                x->a_lo > y->a_lo ? x->a_lo : y->a_lo,
+                x->a_hi < y->a_hi ? x->a_hi : y->a_hi,
+                x->b_lo > y->b_lo ? x->b_lo : y->b_lo,
+                x->b_hi < y->b_hi ? x->b_hi : y->b_hi,
+            };
+            if (!box_set_add(out, box))
+            {
+                return false;
+            }
+        }
+    }
+
+    box_set_normalize(out);
+    return true;
+}
+
+static inline bool parse_expr(Parser *p, BoxSet *out);
+
+static inline bool parse_factor(Parser *p, BoxSet *out)
+{
+    if (p->tok.type == TOKEN_LPAREN)
+    {
+        parser_next(p);
+        if (!parse_expr(p, out))
+        {
+            return false;
+        }
+        if (p->tok.type != TOKEN_RPAREN)
+        {
+            parser_fail(p, "expected ')'");
+            return false;
+        }
+        parser_next(p);
+        return true;
+    }
+
+    Column column;
+    if (token_is(&p->tok, "a"))
+    {
+        column = COLUMN_A;
+    }
+    else if (token_is(&p->tok, "b"))
+    {
+        column = COLUMN_B;
+    }
+    else
+    {
+        parser_fail(p, "expected column a or b");
+        return false;
+    }
+    parser_next(p);
+
+    int64_t lo, hi;
+    if (token_is(&p->tok, "IN"))
+    {
+        parser_next(p);
+        if (p->tok.type != TOKEN_LPAREN)
+        {
+            parser_fail(p, "expected '(' after IN");
+            return false;
+        }
+        do
+        {
+            parser_next(p);
+            if (!parser_int(p, &lo) || !box_set_add(out, box_of(column, lo, lo)))
+            {
+                return false;
+            }
+        } while (p->tok.type == TOKEN_COMMA);
+
+        if (p->tok.type != TOKEN_RPAREN)
+        {
+            parser_fail(p, "expected ')' to close IN");
+            return false;
+        }
+        parser_next(p);
+        box_set_normalize(out);
+        return true;
+    }
+
+    if (token_is(&p->tok, "BETWEEN"))
+    {
+        parser_next(p);
+        if (!parser_int(p, &lo))
+        {
+            return false;
+        }
+        if (!token_is(&p->tok, "AND"))
+        {
+            parser_fail(p, "expected AND in BETWEEN");
+            return false;
+        }
+        parser_next(p);
+        return parser_int(p, &hi) && box_set_add(out, box_of(column, lo, hi));
+    }
+
+    if (p->tok.type != TOKEN_OP)
+    {
+        parser_fail(p, "expected IN, BETWEEN or a comparison");
+        return false;
+    }
+    Token op = p->tok;
+    parser_next(p);
+    int64_t v;
+    if (!parser_int(p, &v))
+    {
+        return false;
+    }
+
+    if (token_op(&op, "=") || token_op(&op, "=="))
+    {
+        return box_set_add(out, box_of(column, v, v));
+    }
+    if (token_op(&op, "!=") || token_op(&op, "<>"))
+    {
+        return box_set_add(out, box_of(column, INT_MIN, v - 1)) &&
+                box_set_add(out, box_of(column, v + 1, INT_MAX));
+    }
+    if (token_op(&op, "<"))  return box_set_add(out, box_of(column, INT_MIN, v - 1));
+    if (token_op(&op, "<=")) return box_set_add(out, box_of(column, INT_MIN, v));
+    if (token_op(&op, ">"))  return box_set_add(out, box_of(column, v + 1, INT_MAX));
+    if (token_op(&op, ">=")) return box_set_add(out, box_of(column, v, INT_MAX));
+
+    p->tok = op;
+    parser_fail(p, "unknown comparison");
+    return false;
+}
+
+static inline bool parse_term(Parser *p, BoxSet *out)
+{
+    if (!parse_factor(p, out))
+    {
+        return false;
+    }
+
+    while (token_is(&p->tok, "AND"))
+    {
+        parser_next(p);
+
+        BoxSet rhs = { NULL, 0, 0, out->arena }, both = { NULL, 0, 0, out->arena };
+        bool ok = parse_factor(p, &rhs) && box_set_and(&both, out, &rhs);
+        box_set_free(&rhs);
+        box_set_free(out);
+        *out = both;
+        if (!ok)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static inline bool parse_expr(Parser *p, BoxSet *out)
+{
+    if (!parse_term(p, out))
+    {
+        return false;
+    }
+
+    while (token_is(&p->tok, "OR"))
+    {
+        parser_next(p);
+
+        BoxSet rhs = { NULL, 0, 0, out->arena };
+        bool ok = parse_term(p, &rhs);
+        for (int i = 0; ok && i < rhs.nboxes; i++)
+        {
+            ok = box_set_add(out, rhs.boxes[i]);
+        }
+        box_set_free(&rhs);
+        if (!ok)
+        {
+            return false;
+        }
+        box_set_normalize(out);
+    }
+
+    return true;
+}
+
+static inline int slice_compare(const void *x, const void *y)
+{
+    uint64_t l = row_key(((const RangeSlice *)x)->left);
+    uint64_t r = row_key(((const RangeSlice *)y)->left);
+    return l < r ? -1 : l > r;
+}
+
+/**
+ * @brief Slice [(a_lo,b_lo), (a_hi,b_hi)] as a half open RangeSlice,
+ *        one ending at the very last key runs to the end, see to_end.
+ */
+static inline RangeSlice slice_of(int64_t a_lo, int64_t b_lo, int64_t a_hi, int64_t b_hi, bool covered)
+{
+    Row left = { (int)a_lo, (int)b_lo };
+    Row last = { (int)a_hi, (int)b_hi };
+    uint64_t right = row_key(last);
+
+    RangeSlice slice = { left, key_row(right == UINT64_MAX ? right : right + 1), covered,
+            right == UINT64_MAX };
+    return slice;
+}
+
+/**
+ * @brief Turn the boxes of query into sorted, merged, non-overlapping
+ *        slices. A box becomes exact slices (covered, no predicate
+ *        needed) when b is unrestricted or a spans a few values,
+ *        otherwise one slice over its bounding keys which the scan has
+ *        to re-check with query_match.
+ */
+static inline bool query_build_slices(Query *query)
+{
+    int cap = 0;
+    for (int i = 0; i < query->where.nboxes; i++)
+    {
+        const Box *box = &query->where.boxes[i];
+        bool full_b = box->b_lo == INT_MIN && box->b_hi == INT_MAX;
+        cap += full_b || box->a_hi - box->a_lo >= QUERY_EXPAND_LIMIT ? 1 : (int)(box->a_hi - box->a_lo + 1);
+    }
+
+    query->slices = arena_alloc(query->arena, sizeof(RangeSlice)*(cap > 0 ? cap : 1));
+    if (!query->slices)
+    {
+        return false;
+    }
+
+    int n = 0;
+    for (int i = 0; i < query->where.nboxes; i++)
+    {
+        const Box *box = &query->where.boxes[i];
+        bool full_b = box->b_lo == INT_MIN && box->b_hi == INT_MAX;
+        if (full_b)
+        {
+            query->slices[n++] = slice_of(box->a_lo, INT_MIN, box->a_hi, INT_MAX, true);
+        }
+        else if (box->a_hi - box->a_lo >= QUERY_EXPAND_LIMIT)
+        {
+            query->slices[n++] = slice_of(box->a_lo, box->b_lo, box->a_hi, box->b_hi, false);
+        }
+        else
+        {
+            for (int64_t a = box->a_lo; a <= box->a_hi; a++)
+            {
+                query->slices[n++] = slice_of(a, box->b_lo, a, box->b_hi, true);
+            }
+        }
+    }
+
+    qsort(query->slices, n, sizeof(RangeSlice), slice_compare);
+
+    // merge overlapping and touching slices, a merged slice is only
+    // covered when both of its parts are.
+    int m = 0;
+    for (int i = 1; i < n; i++)
+    {
+        RangeSlice *last = &query->slices[m];
+        RangeSlice *slice = &query->slices[i];
+        if (last->to_end || row_key(slice->left) <= row_key(last->right))
+        {
+            if (!last->to_end && (slice->to_end || row_key(slice->right) > row_key(last->right)))
+            {
+                last->right = slice->right;
+                last->to_end = slice->to_end;
+            }
+            last->covered = last->covered && slice->covered;
+        }
+        else
+        {
+            query->slices[++m] = *slice;
+        }
+    }
+    query->nslices = n > 0 ? m + 1 : 0;
+
+    return true;
+}
+
+/**
+ * @brief Group the boxes of where by b range, where is normalized so
+ *        the boxes of a group are adjacent and their a ranges sorted and
+ *        disjoint.
+ */
+static inline bool query_build_groups(Query *query)
+{
+    const BoxSet *where = &query->where;
+    int ngroups = 0;
+    for (int i = 0; i < where->nboxes; i++)
+    {
+        ngroups += i == 0 || where->boxes[i].b_lo != where->boxes[i - 1].b_lo ||
+                where->boxes[i].b_hi != where->boxes[i - 1].b_hi;
+    }
+
+    query->groups = arena_alloc(query->arena, sizeof(QueryGroup)*(ngroups > 0 ? ngroups : 1));
+    if (!query->groups)
+    {
+        return false;
+    }
+    memset(query->groups, 0, sizeof(QueryGroup)*(ngroups > 0 ? ngroups : 1));
+
+    for (int i = 0; i < where->nboxes; )
+    {
+        const Box *first = &where->boxes[i];
+        int j = i;
+        while (j < where->nboxes && where->boxes[j].b_lo == first->b_lo && where->boxes[j].b_hi == first->b_hi)
+        {
+            j++;
+        }
+
+        int *lo = arena_alloc(query->arena, sizeof(int)*(j - i));
+        int *hi = arena_alloc(query->arena, sizeof(int)*(j - i));
+        if (!lo || !hi)
+        {
+            arena_free(query->arena, lo);
+            arena_free(query->arena, hi);
+            return false;
+        }
+        for (int k = i; k < j; k++)
+        {
+            lo[k - i] = (int)where->boxes[k].a_lo;
+            hi[k - i] = (int)where->boxes[k].a_hi;
+        }
+
+        QueryGroup *group = &query->groups[query->ngroups++];
+        group->b_lo = first->b_lo;
+        group->b_hi = first->b_hi;
+        inlist_init(&group->a, lo, hi, j - i, query->arena);
+        i = j;
+    }
+
+    return true;
+}
+
+static inline void query_free(Query *query)
+{
+    if (!query)
+    {
+        return;
+    }
+
+    for (int i = 0; i < query->ngroups; i++)
+    {
+        inlist_free(&query->groups[i].a, query->arena);
+    }
+    arena_free(query->arena, query->groups);
+    box_set_free(&query->where);
+    arena_free(query->arena, query->slices);
+    arena_free(query->arena, query);
+}
+
+/**
+ * @brief Parse the optional GROUP BY a clause.
+ */
+static inline bool parse_group(Parser *p, Query *query)
+{
+    if (!token_is(&p->tok, "GROUP"))
+    {
+        return true;
+    }
+
+    parser_next(p);
+    if (!token_is(&p->tok, "BY"))
+    {
+        parser_fail(p, "expected BY after GROUP");
+        return false;
+    }
+    parser_next(p);
+    if (!token_is(&p->tok, "a"))
+    {
+        parser_fail(p, "expected column a");
+        return false;
+    }
+    parser_next(p);
+    query->group_by_a = true;
+
+    return true;
+}
+
+/**
+ * @brief Parse the optional LIMIT k [OFFSET n] [BY a] clause.
+ */
+static inline bool parse_limit(Parser *p, Query *query)
+{
+    query->limit = -1;
+    if (!token_is(&p->tok, "LIMIT"))
+    {
+        return true;
+    }
+
+    parser_next(p);
+    if (!parser_int(p, &query->limit))
+    {
+        return false;
+    }
+    if (token_is(&p->tok, "OFFSET"))
+    {
+        parser_next(p);
+        if (!parser_int(p, &query->offset))
+        {
+            return false;
+        }
+    }
+    if (query->limit < 0 || query->offset < 0)
+    {
+        parser_fail(p, "LIMIT and OFFSET must not be negative");
+        return false;
+    }
+    if (token_is(&p->tok, "BY"))
+    {
+        parser_next(p);
+        if (!token_is(&p->tok, "a"))
+        {
+            parser_fail(p, "expected column a");
+            return false;
+        }
+        if (query->group_by_a)
+        {
+            parser_fail(p, "LIMIT ... BY a of a GROUP BY a query");
+            return false;
+        }
+        parser_next(p);
+        query->limit_by_a = true;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Limit of the result positions, the rows [offset, end) are kept.
+ */
+static inline int64_t query_limit_end(const Query *query)
+{
+    return query->limit < 0 ? INT64_MAX : query->offset + query->limit;
+}
+
+/**
+ * @brief The LIMIT of a query over rows accepted in (a,b) order.
+ */
+typedef struct QueryLimit {
+    const Query *query;
+    int64_t rank; // rank of the next row, within its a for LIMIT ... BY a
+    int a;        // a of the last row
+} QueryLimit;
+
+/**
+ * @brief Count an accepted row, whether the LIMIT keeps it.
+ */
+static inline bool query_limit_keep(QueryLimit *limit, Row row)
+{
+    const Query *query = limit->query;
+    if (query->limit < 0)
+    {
+        return true;
+    }
+
+    if (query->limit_by_a && row.a != limit->a)
+    {
+        limit->rank = 0;
+    }
+    limit->a = row.a;
+
+    int64_t rank = limit->rank++;
+    return rank >= query->offset && rank < query_limit_end(query);
+}
+
+/**
+ * @brief Whether the LIMIT keeps no further row.
+ */
+static inline bool query_limit_done(const QueryLimit *limit)
+{
+    return limit->query->limit >= 0 && !limit->query->limit_by_a &&
+            limit->rank >= query_limit_end(limit->query);
+}
+
+/**
+ * @brief Parse a WHERE expression, e.g.
+ *        "a IN (1000, 2000, 3000) AND b >= 10 AND b < 50 LIMIT 100".
+ *
+ * @param text The expression.
+ * @param arena Query scoped arena the query is allocated from, NULL
+ *              for malloc, then release the query with query_free.
+ * @param err Receives a message when parsing fails, can be NULL.
+ * @param errlen Size of err.
+ * @return Query* the query, NULL on syntax error or out of memory.
+ */
+static inline Query* query_parse(const char *text, Arena *arena, char *err, size_t errlen)
+{
+    Parser p = { text, { TOKEN_END, text, 0, 0 }, err, errlen, false };
+    Query *query = arena_alloc(arena, sizeof(Query));
+    if (!query || strlen(text) > QUERY_MAX_TEXT)
+    {
+        if (err && errlen)
+        {
+            snprintf(err, errlen, query ? "query is too long" : "out of memory");
+        }
+        arena_free(arena, query);
+        return NULL;
+    }
+    memset(query, 0, sizeof(Query));
+    query->arena = arena;
+    query->where.arena = arena;
+
+    parser_next(&p);
+    bool ok = parse_expr(&p, &query->where) && parse_group(&p, query) && parse_limit(&p, query);
+    if (ok && p.tok.type != TOKEN_END)
+    {
+        parser_fail(&p, "unexpected trailing input");
+        ok = false;
+    }
+    if (ok && (!query_build_slices(query) || !query_build_groups(query)))
+    {
+        if (err && errlen)
+        {
+            snprintf(err, errlen, "out of memory");
+        }
+        ok = false;
+    }
+    if (!ok && !p.failed && err && errlen)
+    {
+        snprintf(err, errlen, "out of memory");
+    }
+
+    if (!ok)
+    {
+        query_free(query);
+        return NULL;
+    }
+
+    return query;
+}
+
+/**
+ * @brief Parse the query of a command line argument, `@path` reads the
+ *        text from a file, for IN-lists longer than an argument can be.
+ */
+static inline Query* query_parse_arg(const char *arg, Arena *arena, char *err, size_t errlen)
+{
+    if (arg[0] != '@')
+    {
+        return query_parse(arg, arena, err, errlen);
+    }
+
+    FILE *file = fopen(arg + 1, "r");
+    char *text = malloc(QUERY_MAX_TEXT + 2);
+    size_t len = file && text ? fread(text, 1, QUERY_MAX_TEXT + 1, file) : 0;
+    Query *query = NULL;
+    if (!file || !text || ferror(file))
+    {
+        snprintf(err, err ? errlen : 0, "%s: %s", arg + 1, text ? "cannot read" : "out of memory");
+    }
+    else
+    {
+        text[len] = '\0';
+        query = query_parse(text, arena, err, errlen);
+    }
+
+    if (file)
+    {
+        fclose(file);
+    }
+    free(text);
+    return query;
+}
+
+#endif // MATRIXDB_PARSER_H
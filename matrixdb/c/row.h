@@ -0,0 +1,18 @@
+#ifndef MATRIXDB_ROW_H
+#define MATRIXDB_ROW_H
+
+/**
+ * @brief A row of the (a,b) table, this is the row oriented
+ *        layout used by the generated seeds and the sorted tasks.
+ */
+typedef struct Row {
+    int a;
+    int b;
+} Row;
+
+typedef enum Column {
+    COLUMN_A = 0,
+    COLUMN_B = 1,
+} Column;
+
+#endif // MATRIXDB_ROW_H
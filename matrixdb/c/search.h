@@ -0,0 +1,119 @@
+#ifndef MATRIXDB_SEARCH_H
+#define MATRIXDB_SEARCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "row.h"
+#include "stats.h"
+
+/**
+ * @brief Range slice of rows, selects every row r with
+ *        left <= r < right in (a,b) order, i.e. [left, right).
+ *        covered is set when every row of the slice is known to
+ *        satisfy the query, so the scan needs no predicate for it.
+ *        The last key (INT_MAX,INT_MAX) has no successor to end a
+ *        slice with, a slice including it sets to_end instead and its
+ *        right is not used.
+ */
+typedef struct RangeSlice {
+    Row left;
+    Row right;
+    bool covered;
+    bool to_end;
+} RangeSlice;
+
+/**
+ * @brief Pack (a,b) into one 64-bit key whose unsigned order is the
+ *        (a,b) lexicographic order of the row, flipping the sign bits
+ *        maps signed int order onto unsigned order.
+ */
+static inline uint64_t row_key(Row row)
+{
+    return ((uint64_t)((uint32_t)row.a ^ 0x80000000u) << 32) |
+            (uint64_t)((uint32_t)row.b ^ 0x80000000u);
+}
+
+/**
+ * @brief Inverse of row_key.
+ */
+static inline Row key_row(uint64_t key)
+{
+    Row row = { (int)((uint32_t)(key >> 32) ^ 0x80000000u), 
+                (int)((uint32_t)key ^ 0x80000000u) };
+    return row;
+}
+
+/**
+ * @brief Key of the last row slice can select, inclusive so a slice
+ *        to the end of the key space has one too.
+ */
+static inline uint64_t slice_last_key(RangeSlice slice)
+{
+    return slice.to_end ? UINT64_MAX : row_key(slice.right) - 1;
+}
+
+/**
+ * @brief Index of the first row with row_key(row) >= key, nrows when
+ *        every row is smaller. Rows must be sorted by (a,b), duplicates
+ *        are allowed. The loop has no data dependent branch, the
+ *        comparison only selects the next base.
+ */
+static inline int rows_lower_bound(const Row *rows, int nrows, uint64_t key)
+{
+    if (nrows <= 0)
+    {
+        return 0;
+    }
+    STATS_COUNT(STATS_SEARCHES, 1);
+    STATS_COUNT(STATS_SEARCH_STEPS, stats_search_depth(nrows));
+
+    const Row *base = rows;
+    int n = nrows;
+    while (n > 1)
+    {
+        int half = n / 2;
+        base = row_key(base[half]) < key ? base + half : base;
+        n -= half;
+    }
+
+    return (int)(base - rows) + (row_key(*base) < key);
+}
+
+/**
+ * @brief Index of the first row with row_key(row) > key, nrows when
+ *        no row is greater, see rows_lower_bound.
+ */
+static inline int rows_upper_bound(const Row *rows, int nrows, uint64_t key)
+{
+    if (nrows <= 0)
+    {
+        return 0;
+    }
+    STATS_COUNT(STATS_SEARCHES, 1);
+    STATS_COUNT(STATS_SEARCH_STEPS, stats_search_depth(nrows));
+
+    const Row *base = rows;
+    int n = nrows;
+    while (n > 1)
+    {
+        int half = n / 2;
+        base = row_key(base[half]) <= key ? base + half : base;
+        n -= half;
+    }
+
+    return (int)(base - rows) + (row_key(*base) <= key);
+}
+
+/**
+ * @brief Rows selected by slice are rows[*begin, *end).
+ */
+static inline void rows_slice_range(const Row *rows, int nrows, RangeSlice slice,
+                        int *begin, int *end)
+{
+    *begin = rows_lower_bound(rows, nrows, row_key(slice.left));
+    // an inverted slice finds no row in the tail, so it comes out empty.
+    *end = *begin + rows_upper_bound(rows + *begin, nrows - *begin, slice_last_key(slice));
+}
+
+#endif // MATRIXDB_SEARCH_H
@@ -0,0 +1,493 @@
+#ifndef MATRIXDB_SEED_H
+#define MATRIXDB_SEED_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <math.h>
+
+#include "row.h"
+#include "search.h"
+#include "parallel.h"
+
+/*
+ * Seeded dataset generator. Row i draws its values from a random stream
+ * keyed by (seed, i), so rows are filled in parallel and the table is
+ * the same for every number of threads.
+ *
+ *   a = a_base*k, the key k drawn from the distribution:
+ *     SEED_UNIFORM     k uniform in [1, a_domain]
+ *     SEED_ZIPF        k in [1, a_domain] with P(k) ~ 1/k^zipf_s
+ *     SEED_DUPLICATES  dup rows for every k in [1, nrows/dup], the rows
+ *                      of a key spread over the table
+ *   b = b_base*j, j uniform in [0, b_domain)
+ *
+ * The rows are then sorted by (a,b), left in generation order, or sorted
+ * with a fraction disorder of them swapped with a row at most
+ * SEED_NEAR_WINDOW further, nearly sorted.
+ */
+// Rows of a partition of the fill, fewer rows are filled by one thread.
+#define SEED_MIN_PARALLEL (64*1024)
+// Digit of the radix sort, four passes over the 64-bit row keys.
+#define SEED_RADIX_BITS 16
+// Farthest a row of a nearly sorted table moves from its place.
+#define SEED_NEAR_WINDOW 64
+// Rows of a block of the disorder pass, swaps stay within a block.
+#define SEED_NEAR_BLOCK (64*1024)
+
+typedef enum SeedDist {
+    SEED_UNIFORM,
+    SEED_ZIPF,
+    SEED_DUPLICATES,
+} SeedDist;
+
+typedef enum SeedOrder {
+    SEED_SORTED,        // by (a,b)
+    SEED_UNSORTED,      // generation order
+    SEED_NEARLY_SORTED, // sorted, then a fraction disorder of rows moved
+} SeedOrder;
+
+typedef struct SeedConfig {
+    uint64_t seed;
+    SeedDist dist;
+    int a_base;
+    int a_domain;      // keys of uniform and zipf
+    double zipf_s;     // exponent of zipf, > 0
+    int dup;           // rows per key of duplicates
+    int b_base;
+    int b_domain;
+    SeedOrder order;
+    double disorder;   // of a nearly sorted table, in [0, 1]
+} SeedConfig;
+
+static inline void seed_config_default(SeedConfig *config)
+{
+    SeedConfig init = { 42, SEED_UNIFORM, 1000, 1000000, 1.0, 100, 10, 100, SEED_SORTED, 0.01 };
+    *config = init;
+}
+
+/**
+ * @brief Whether config can fill nrows rows, every a and b must fit an int.
+ */
+static inline bool seed_config_check(const SeedConfig *config, int nrows, char *err, size_t errlen)
+{
+    int64_t keys = config->dist == SEED_DUPLICATES ?
+            (config->dup > 0 ? ((int64_t)nrows + config->dup - 1) / config->dup : 0) : config->a_domain;
+    const char *problem = NULL;
+
+    if (nrows < 0)
+    {
+        problem = "negative row count";
+    }
+    else if (config->dist == SEED_DUPLICATES && config->dup < 1)
+    {
+        problem = "rows per a must be positive";
+    }
+    else if (config->dist != SEED_DUPLICATES && config->a_domain < 1)
+    {
+        problem = "a domain must be positive";
+    }
+    else if (config->dist == SEED_ZIPF && !(config->zipf_s > 0))
+    {
+        problem = "zipf exponent must be positive";
+    }
+    else if (config->b_domain < 1)
+    {
+        problem = "b domain must be positive";
+    }
+    else if ((int64_t)config->a_base*keys > INT_MAX || (int64_t)config->a_base*keys < INT_MIN ||
+            (int64_t)config->b_base*(config->b_domain - 1) > INT_MAX ||
+            (int64_t)config->b_base*(config->b_domain - 1) < INT_MIN)
+    {
+        problem = "values do not fit an int, lower the base or the domain";
+    }
+    else if (!(config->disorder >= 0 && config->disorder <= 1))
+    {
+        problem = "disorder must be in [0, 1]";
+    }
+
+    if (problem)
+    {
+        snprintf(err, err ? errlen : 0, "%s", problem);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief splitmix64 finalizer, a bijective mix of x.
+ */
+static inline uint64_t seed_mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @brief splitmix64 stream.
+ */
+typedef struct SeedRandom {
+    uint64_t state;
+} SeedRandom;
+
+/**
+ * @brief The stream of row i, independent of the streams of other rows.
+ */
+static inline SeedRandom seed_stream(uint64_t seed, uint64_t i)
+{
+    SeedRandom r = { seed_mix(seed ^ seed_mix(i + 0x9E3779B97F4A7C15ull)) };
+    return r;
+}
+
+static inline uint64_t seed_next(SeedRandom *r)
+{
+    return seed_mix(r->state += 0x9E3779B97F4A7C15ull);
+}
+
+/**
+ * @brief Uniform double in [0, 1).
+ */
+static inline double seed_uniform(SeedRandom *r)
+{
+    return (double)(seed_next(r) >> 11) * 0x1p-53;
+}
+
+/**
+ * @brief Uniform integer in [0, n), by the high half of a product.
+ */
+static inline uint32_t seed_below(SeedRandom *r, uint32_t n)
+{
+    return (uint32_t)(((seed_next(r) >> 32) * (uint64_t)n) >> 32);
+}
+
+/**
+ * @brief Zipf sampler over [1, n] by rejection-inversion (Hormann and
+ *        Derflinger), O(1) memory and about one draw per sample for any n.
+ */
+typedef struct SeedZipf {
+    double n;
+    double s;
+    double h_x1;   // H(1.5) - 1
+    double h_n;    // H(n + 0.5)
+    double cut;    // 2 - H^-1(H(2.5) - h(2))
+} SeedZipf;
+
+// expm1(x)/x and log1p(x)/x, both 1 at x = 0.
+static inline double seed_expm1_x(double x)
+{
+    return fabs(x) > 1e-8 ? expm1(x)/x : 1.0 + x/2.0*(1.0 + x/3.0);
+}
+
+static inline double seed_log1p_x(double x)
+{
+    return fabs(x) > 1e-8 ? log1p(x)/x : 1.0 - x*(0.5 - x/3.0);
+}
+
+// H(x), the integral of h(x) = x^-s.
+static inline double seed_zipf_h_integral(const SeedZipf *z, double x)
+{
+    double log_x = log(x);
+    return seed_expm1_x((1.0 - z->s)*log_x)*log_x;
+}
+
+static inline double seed_zipf_h(const SeedZipf *z, double x)
+{
+    return exp(-z->s*log(x));
+}
+
+static inline double seed_zipf_h_inverse(const SeedZipf *z, double x)
+{
+    double t = x*(1.0 - z->s);
+    t = t < -1.0 ? -1.0 : t;
+    return exp(seed_log1p_x(t)*x);
+}
+
+static inline void seed_zipf_init(SeedZipf *z, int n, double s)
+{
+    z->n = n;
+    z->s = s;
+    z->h_x1 = seed_zipf_h_integral(z, 1.5) - 1.0;
+    z->h_n = seed_zipf_h_integral(z, n + 0.5);
+    z->cut = 2.0 - seed_zipf_h_inverse(z, seed_zipf_h_integral(z, 2.5) - seed_zipf_h(z, 2.0));
+}
+
+static inline int seed_zipf_next(const SeedZipf *z, SeedRandom *r)
+{
+    for (;;)
+    {
+        double u = z->h_n + seed_uniform(r)*(z->h_x1 - z->h_n);
+        double x = seed_zipf_h_inverse(z, u);
+        double k = floor(x + 0.5);
+        k = k < 1 ? 1 : k > z->n ? z->n : k;
+
+        if (k - x <= z->cut || u >= seed_zipf_h_integral(z, k + 0.5) - seed_zipf_h(z, k))
+        {
+            return (int)k;
+        }
+    }
+}
+
+/**
+ * @brief Random permutation of [0, n), a four round Feistel network over
+ *        the next even power of two, cycle walking back into [0, n).
+ */
+typedef struct SeedPermutation {
+    uint64_t n;
+    int half_bits;
+    uint64_t keys[4];
+} SeedPermutation;
+
+static inline void seed_permutation_init(SeedPermutation *perm, uint64_t n, uint64_t seed)
+{
+    perm->n = n;
+    perm->half_bits = 1;
+    while ((1ull << (2*perm->half_bits)) < n)
+    {
+        perm->half_bits++;
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        perm->keys[i] = seed_mix(seed + 0x632BE59BD9B4E019ull*(i + 1));
+    }
+}
+
+static inline uint64_t seed_permute(const SeedPermutation *perm, uint64_t x)
+{
+    uint64_t mask = (1ull << perm->half_bits) - 1;
+    do
+    {
+        uint64_t l = x >> perm->half_bits, r = x & mask;
+        for (int i = 0; i < 4; i++)
+        {
+            uint64_t f = seed_mix(r ^ perm->keys[i]) & mask;
+            uint64_t t = l ^ f;
+            l = r;
+            r = t;
+        }
+        x = (l << perm->half_bits) | r;
+    } while (x >= perm->n);
+
+    return x;
+}
+
+typedef struct SeedFillCtx {
+    const SeedConfig *config;
+    const SeedZipf *zipf;
+    const SeedPermutation *perm;
+    Row *rows;
+    int nrows;
+} SeedFillCtx;
+
+static inline void seed_fill_work(int tid, int nthreads, void *arg)
+{
+    SeedFillCtx *ctx = (SeedFillCtx *)arg;
+    const SeedConfig *config = ctx->config;
+    int begin = parallel_partition(ctx->nrows, nthreads, tid, 1);
+    int end = parallel_partition(ctx->nrows, nthreads, tid + 1, 1);
+
+    for (int i = begin; i < end; i++)
+    {
+        SeedRandom r = seed_stream(config->seed, (uint64_t)i);
+        int k;
+        switch (config->dist)
+        {
+        case SEED_ZIPF:
+            k = seed_zipf_next(ctx->zipf, &r);
+            break;
+        case SEED_DUPLICATES:
+            k = 1 + (int)(seed_permute(ctx->perm, (uint64_t)i) / (uint64_t)config->dup);
+            break;
+        default:
+            k = 1 + (int)seed_below(&r, (uint32_t)config->a_domain);
+            break;
+        }
+
+        ctx->rows[i].a = config->a_base*k;
+        ctx->rows[i].b = config->b_base*(int)seed_below(&r, (uint32_t)config->b_domain);
+    }
+}
+
+typedef struct SeedSortCtx {
+    const Row *src;
+    Row *dst;
+    int nrows;
+    int shift;
+    int *hist;  // hist[tid << SEED_RADIX_BITS | digit], counts, then positions
+} SeedSortCtx;
+
+static inline int seed_digit(Row row, int shift)
+{
+    return (int)((row_key(row) >> shift) & ((1u << SEED_RADIX_BITS) - 1));
+}
+
+static inline void seed_count_work(int tid, int nthreads, void *arg)
+{
+    SeedSortCtx *ctx = (SeedSortCtx *)arg;
+    int begin = parallel_partition(ctx->nrows, nthreads, tid, 1);
+    int end = parallel_partition(ctx->nrows, nthreads, tid + 1, 1);
+    int *hist = ctx->hist + ((size_t)tid << SEED_RADIX_BITS);
+
+    for (int i = begin; i < end; i++)
+    {
+        hist[seed_digit(ctx->src[i], ctx->shift)]++;
+    }
+}
+
+static inline void seed_scatter_work(int tid, int nthreads, void *arg)
+{
+    SeedSortCtx *ctx = (SeedSortCtx *)arg;
+    int begin = parallel_partition(ctx->nrows, nthreads, tid, 1);
+    int end = parallel_partition(ctx->nrows, nthreads, tid + 1, 1);
+    int *pos = ctx->hist + ((size_t)tid << SEED_RADIX_BITS);
+
+    for (int i = begin; i < end; i++)
+    {
+        ctx->dst[pos[seed_digit(ctx->src[i], ctx->shift)]++] = ctx->src[i];
+    }
+}
+
+/**
+ * @brief Sort rows by (a,b), a parallel LSD radix sort of the row keys.
+ *        A pass whose digit is the same for every row is skipped, so
+ *        narrow domains take fewer passes.
+ *
+ * @return false when out of memory, rows are left untouched.
+ */
+static inline bool seed_sort(Row *rows, int nrows, int nthreads)
+{
+    int buckets = 1 << SEED_RADIX_BITS;
+    Row *scratch = malloc(sizeof(Row)*(nrows > 0 ? nrows : 1));
+    int *hist = malloc(sizeof(int)*((size_t)nthreads << SEED_RADIX_BITS));
+    if (!scratch || !hist)
+    {
+        free(scratch);
+        free(hist);
+        return false;
+    }
+
+    SeedSortCtx ctx = { rows, scratch, nrows, 0, hist };
+    for (ctx.shift = 0; ctx.shift < 64; ctx.shift += SEED_RADIX_BITS)
+    {
+        memset(hist, 0, sizeof(int)*((size_t)nthreads << SEED_RADIX_BITS));
+        parallel_run(nthreads, seed_count_work, &ctx);
+
+        // positions, digit major then thread, keep the sort stable
+        int total = 0;
+        bool constant = false;
+        for (int d = 0; d < buckets; d++)
+        {
+            int before = total;
+            for (int t = 0; t < nthreads; t++)
+            {
+                int count = hist[((size_t)t << SEED_RADIX_BITS) | d];
+                hist[((size_t)t << SEED_RADIX_BITS) | d] = total;
+                total += count;
+            }
+            constant = constant || total - before == nrows;
+        }
+        if (constant)
+        {
+            continue;
+        }
+
+        parallel_run(nthreads, seed_scatter_work, &ctx);
+        const Row *src = ctx.src;
+        ctx.src = ctx.dst;
+        ctx.dst = (Row *)src;
+    }
+
+    if (ctx.src != rows)
+    {
+        memcpy(rows, ctx.src, sizeof(Row)*nrows);
+    }
+    free(scratch);
+    free(hist);
+    return true;
+}
+
+typedef struct SeedDisorderCtx {
+    const SeedConfig *config;
+    Row *rows;
+    int nrows;
+} SeedDisorderCtx;
+
+static inline void seed_disorder_work(int tid, int nthreads, void *arg)
+{
+    SeedDisorderCtx *ctx = (SeedDisorderCtx *)arg;
+    int nblocks = (ctx->nrows + SEED_NEAR_BLOCK - 1) / SEED_NEAR_BLOCK;
+
+    // blocks round robin, the swaps of a block depend on the block only
+    for (int blk = tid; blk < nblocks; blk += nthreads)
+    {
+        int begin = blk*SEED_NEAR_BLOCK;
+        int end = begin + SEED_NEAR_BLOCK < ctx->nrows ? begin + SEED_NEAR_BLOCK : ctx->nrows;
+        SeedRandom r = seed_stream(~ctx->config->seed, (uint64_t)blk);
+
+        for (int i = begin; i < end; i++)
+        {
+            if (seed_uniform(&r) >= ctx->config->disorder)
+            {
+                continue;
+            }
+
+            int j = i + 1 + (int)seed_below(&r, SEED_NEAR_WINDOW);
+            if (j < end)
+            {
+                Row tmp = ctx->rows[i];
+                ctx->rows[i] = ctx->rows[j];
+                ctx->rows[j] = tmp;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Fill rows[0, nrows) as config describes on nthreads threads,
+ *        config must pass seed_config_check.
+ *
+ * @return false when out of memory.
+ */
+static inline bool seed_generate(const SeedConfig *config, Row *rows, int nrows, int nthreads)
+{
+    if (nthreads > nrows / SEED_MIN_PARALLEL)
+    {
+        nthreads = nrows / SEED_MIN_PARALLEL;
+    }
+    nthreads = nthreads < 1 ? 1 : nthreads > PARALLEL_MAX_THREADS ? PARALLEL_MAX_THREADS : nthreads;
+
+    SeedZipf zipf;
+    SeedPermutation perm;
+    if (config->dist == SEED_ZIPF)
+    {
+        seed_zipf_init(&zipf, config->a_domain, config->zipf_s);
+    }
+    if (config->dist == SEED_DUPLICATES)
+    {
+        seed_permutation_init(&perm, (uint64_t)nrows, config->seed);
+    }
+
+    SeedFillCtx fill = { config, &zipf, &perm, rows, nrows };
+    parallel_run(nthreads, seed_fill_work, &fill);
+
+    if (config->order == SEED_UNSORTED)
+    {
+        return true;
+    }
+    if (!seed_sort(rows, nrows, nthreads))
+    {
+        return false;
+    }
+
+    if (config->order == SEED_NEARLY_SORTED)
+    {
+        SeedDisorderCtx disorder = { config, rows, nrows };
+        parallel_run(nthreads, seed_disorder_work, &disorder);
+    }
+    return true;
+}
+
+#endif // MATRIXDB_SEED_H
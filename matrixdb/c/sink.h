@@ -0,0 +1,389 @@
+#ifndef MATRIXDB_SINK_H
+#define MATRIXDB_SINK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "row.h"
+#include "parallel.h"
+
+/*
+ * Result sink, matching rows are formatted as "a,b\n" into a large
+ * reusable buffer and written with write(2), instead of one printf per
+ * row. Large batches can be formatted in parallel and are written in
+ * order with writev(2).
+ */
+#define SINK_BUFFER_SIZE (1 << 20)
+// Longest formatted row, "-2147483648,-2147483648\n".
+#define SINK_MAX_ROW 24
+// Batches smaller than this are formatted by the calling thread.
+#define SINK_MIN_PARALLEL (64*1024)
+
+typedef struct ResultSink {
+    int    fd;
+    char  *buf;
+    size_t len;
+    size_t cap;
+    long   rows;   // rows written so far
+    bool   failed; // a write failed, later output is dropped
+} ResultSink;
+
+static const char sink_digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/**
+ * @brief Format v in decimal at out, two digits per step.
+ *
+ * @return Number of characters written, at most 11.
+ */
+static inline int sink_itoa(int v, char *out)
+{
+    char tmp[12];
+    char *p = tmp + sizeof(tmp);
+    // the magnitude in unsigned arithmetic also covers INT_MIN
+    uint32_t u = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+
+    while (u >= 100)
+    {
+        uint32_t r = u % 100;
+        u /= 100;
+        p -= 2;
+        memcpy(p, sink_digit_pairs + 2*r, 2);
+    }
+    if (u >= 10)
+    {
+        p -= 2;
+        memcpy(p, sink_digit_pairs + 2*u, 2);
+    }
+    else
+    {
+        *--p = (char)('0' + u);
+    }
+    if (v < 0)
+    {
+        *--p = '-';
+    }
+
+    int n = (int)(tmp + sizeof(tmp) - p);
+    memcpy(out, p, n);
+    return n;
+}
+
+/**
+ * @brief sink_itoa of a 64-bit v, such as a count or a sum.
+ *
+ * @return Number of characters written, at most 20.
+ */
+static inline int sink_ltoa(int64_t v, char *out)
+{
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+    uint64_t u = v < 0 ? 0u - (uint64_t)v : (uint64_t)v;
+
+    while (u >= 100)
+    {
+        uint64_t r = u % 100;
+        u /= 100;
+        p -= 2;
+        memcpy(p, sink_digit_pairs + 2*r, 2);
+    }
+    if (u >= 10)
+    {
+        p -= 2;
+        memcpy(p, sink_digit_pairs + 2*u, 2);
+    }
+    else
+    {
+        *--p = (char)('0' + u);
+    }
+    if (v < 0)
+    {
+        *--p = '-';
+    }
+
+    int n = (int)(tmp + sizeof(tmp) - p);
+    memcpy(out, p, n);
+    return n;
+}
+
+/**
+ * @brief Format one row as "a,b\n", out needs SINK_MAX_ROW bytes.
+ */
+static inline int sink_format_row(int a, int b, char *out)
+{
+    int n = sink_itoa(a, out);
+    out[n++] = ',';
+    n += sink_itoa(b, out + n);
+    out[n++] = '\n';
+    return n;
+}
+
+/**
+ * @brief Initialize sink writing to fd, usually STDOUT_FILENO.
+ *
+ * @return false when out of memory.
+ */
+static inline bool sink_init(ResultSink *sink, int fd)
+{
+    memset(sink, 0, sizeof(ResultSink));
+    sink->fd = fd;
+    sink->cap = SINK_BUFFER_SIZE;
+    sink->buf = malloc(sink->cap);
+    sink->failed = !sink->buf;
+    return sink->buf != NULL;
+}
+
+static inline void sink_write_all(ResultSink *sink, const char *data, size_t len)
+{
+    while (len > 0 && !sink->failed)
+    {
+        ssize_t n = write(sink->fd, data, len);
+        if (n < 0)
+        {
+            sink->failed = errno != EINTR;
+            continue;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+/**
+ * @brief Write the buffered rows. stdio output of the same fd is
+ *        flushed first, so the sink and printf keep their order.
+ */
+static inline void sink_flush(ResultSink *sink)
+{
+    if (sink->fd == STDOUT_FILENO)
+    {
+        fflush(stdout);
+    }
+
+    sink_write_all(sink, sink->buf, sink->len);
+    sink->len = 0;
+}
+
+/**
+ * @brief Append one row.
+ */
+static inline void sink_row(ResultSink *sink, int a, int b)
+{
+    if (sink->cap - sink->len < SINK_MAX_ROW)
+    {
+        sink_flush(sink);
+        if (sink->failed)
+        {
+            return;
+        }
+    }
+
+    sink->len += sink_format_row(a, b, sink->buf + sink->len);
+    sink->rows++;
+}
+
+/**
+ * @brief Append preformatted text, such as an aggregate line.
+ */
+static inline void sink_text(ResultSink *sink, const char *text, size_t len)
+{
+    if (sink->cap - sink->len < len)
+    {
+        sink_flush(sink);
+        if (sink->cap < len)
+        {
+            sink_write_all(sink, text, len);
+            return;
+        }
+    }
+
+    memcpy(sink->buf + sink->len, text, len);
+    sink->len += len;
+}
+
+/**
+ * @brief Flush and release sink, the fd stays open.
+ */
+static inline void sink_close(ResultSink *sink)
+{
+    if (sink->buf)
+    {
+        sink_flush(sink);
+    }
+    free(sink->buf);
+    sink->buf = NULL;
+    sink->len = sink->cap = 0;
+}
+
+/**
+ * @brief Rows of a batch, either rows[i] or (a[sel[i]], b[sel[i]]).
+ */
+typedef struct SinkBatch {
+    const Row *rows;
+    const int *a;
+    const int *b;
+    const int *sel;
+    int n;
+} SinkBatch;
+
+typedef struct SinkChunk {
+    char  *buf;
+    size_t len;
+} SinkChunk;
+
+typedef struct SinkParallelCtx {
+    const SinkBatch *batch;
+    SinkChunk *chunks;
+} SinkParallelCtx;
+
+static inline size_t sink_format_batch(const SinkBatch *batch, int begin, int end, char *out)
+{
+    size_t len = 0;
+    if (batch->rows)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            len += sink_format_row(batch->rows[i].a, batch->rows[i].b, out + len);
+        }
+    }
+    else
+    {
+        for (int i = begin; i < end; i++)
+        {
+            len += sink_format_row(batch->a[batch->sel[i]], batch->b[batch->sel[i]], out + len);
+        }
+    }
+    return len;
+}
+
+static inline void sink_format_work(int tid, int nthreads, void *arg)
+{
+    SinkParallelCtx *ctx = (SinkParallelCtx *)arg;
+    int begin = parallel_partition(ctx->batch->n, nthreads, tid, 1);
+    int end = parallel_partition(ctx->batch->n, nthreads, tid + 1, 1);
+
+    ctx->chunks[tid].buf = malloc((size_t)(end - begin)*SINK_MAX_ROW + 1);
+    if (ctx->chunks[tid].buf)
+    {
+        ctx->chunks[tid].len = sink_format_batch(ctx->batch, begin, end, ctx->chunks[tid].buf);
+    }
+}
+
+/**
+ * @brief Append a batch, formatted by nthreads threads into one chunk
+ *        each and written in order with writev. Small batches and
+ *        nthreads == 1 go through the buffer of sink.
+ */
+static inline void sink_batch(ResultSink *sink, const SinkBatch *batch, int nthreads)
+{
+    if (nthreads > batch->n / SINK_MIN_PARALLEL)
+    {
+        nthreads = batch->n / SINK_MIN_PARALLEL;
+    }
+    if (nthreads > PARALLEL_MAX_THREADS)
+    {
+        nthreads = PARALLEL_MAX_THREADS;
+    }
+
+    SinkChunk chunks[PARALLEL_MAX_THREADS];
+    memset(chunks, 0, sizeof(chunks));
+    if (nthreads > 1)
+    {
+        SinkParallelCtx ctx = { batch, chunks };
+        parallel_run(nthreads, sink_format_work, &ctx);
+    }
+
+    bool formatted = nthreads > 1;
+    for (int t = 0; t < nthreads; t++)
+    {
+        formatted = formatted && chunks[t].buf;
+    }
+
+    if (!formatted)
+    {
+        for (int t = 0; t < nthreads; t++)
+        {
+            free(chunks[t].buf);
+        }
+
+        // serial path, the same bytes through the sink buffer
+        for (int i = 0; i < batch->n; i++)
+        {
+            if (batch->rows)
+            {
+                sink_row(sink, batch->rows[i].a, batch->rows[i].b);
+            }
+            else
+            {
+                sink_row(sink, batch->a[batch->sel[i]], batch->b[batch->sel[i]]);
+            }
+        }
+        return;
+    }
+
+    sink_flush(sink);
+
+    struct iovec iov[PARALLEL_MAX_THREADS];
+    for (int t = 0; t < nthreads; t++)
+    {
+        iov[t].iov_base = chunks[t].buf;
+        iov[t].iov_len = chunks[t].len;
+    }
+
+    // writev may stop early, advance through the vector until all is out
+    int first = 0;
+    while (first < nthreads && !sink->failed)
+    {
+        ssize_t n = writev(sink->fd, iov + first, nthreads - first);
+        if (n < 0)
+        {
+            sink->failed = errno != EINTR;
+            continue;
+        }
+        while (first < nthreads && (size_t)n >= iov[first].iov_len)
+        {
+            n -= iov[first].iov_len;
+            first++;
+        }
+        if (first < nthreads)
+        {
+            iov[first].iov_base = (char *)iov[first].iov_base + n;
+            iov[first].iov_len -= n;
+        }
+    }
+
+    for (int t = 0; t < nthreads; t++)
+    {
+        free(chunks[t].buf);
+    }
+    sink->rows += batch->n;
+}
+
+/**
+ * @brief Append the rows (a[sel[i]], b[sel[i]]) for i in [0, nsel).
+ */
+static inline void sink_select(ResultSink *sink, const int *a, const int *b,
+                        const int *sel, int nsel, int nthreads)
+{
+    SinkBatch batch = { NULL, a, b, sel, nsel };
+    sink_batch(sink, &batch, nthreads);
+}
+
+/**
+ * @brief Append rows[0, nrows).
+ */
+static inline void sink_rows(ResultSink *sink, const Row *rows, int nrows, int nthreads)
+{
+    SinkBatch batch = { rows, NULL, NULL, NULL, nrows };
+    sink_batch(sink, &batch, nthreads);
+}
+
+#endif // MATRIXDB_SINK_H
@@ -0,0 +1,188 @@
+#ifndef MATRIXDB_SORT_H
+#define MATRIXDB_SORT_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include "row.h"
+#include "arena.h"
+
+/*
+ * Stable ORDER BY b of a flat array of rows. A counting sort is used
+ * when the b values span a small domain (the 10 <= b < 50 queries span
+ * 40 values), an LSD radix sort over the bytes of b otherwise. Both are
+ * stable, rows with the same b keep their scan order, i.e. their order
+ * by a when the rows came out of a (a,b) sorted table.
+ */
+
+// Largest b domain sorted with a counting sort.
+#define SORT_COUNTING_LIMIT (1 << 16)
+
+/**
+ * @brief Growable flat array of rows.
+ */
+typedef struct RowVec {
+    Row *rows;
+    int  n;
+    int  cap;
+    Arena *arena; // arena of rows, NULL for malloc
+} RowVec;
+
+/**
+ * @brief Append row to vec, doubling its capacity when full.
+ *
+ * @return false when out of memory, the row is dropped.
+ */
+static inline bool rowvec_push(RowVec *vec, Row row)
+{
+    if (vec->n == vec->cap)
+    {
+        int cap = vec->cap ? vec->cap*2 : 1024;
+        Row *rows = arena_realloc(vec->arena, vec->rows, sizeof(Row)*vec->cap, sizeof(Row)*cap);
+        if (!rows)
+        {
+            return false;
+        }
+        vec->rows = rows;
+        vec->cap = cap;
+        STATS_COUNT(STATS_ALLOCS, 1);
+    }
+
+    vec->rows[vec->n++] = row;
+    return true;
+}
+
+static inline void rowvec_free(RowVec *vec)
+{
+    arena_free(vec->arena, vec->rows);
+    vec->rows = NULL;
+    vec->n = vec->cap = 0;
+}
+
+/**
+ * @brief Stable counting sort of rows by b, every b must lie in
+ *        [min_b, min_b + domain). The histogram comes from arena.
+ *
+ * @return false when out of memory, rows are left untouched.
+ */
+static inline bool sort_counting_by_b(Row *rows, int n, Row *scratch, int min_b, int domain,
+                        Arena *arena)
+{
+    int *count = arena_alloc(arena, sizeof(int)*((size_t)domain + 1));
+    if (!count)
+    {
+        return false;
+    }
+    memset(count, 0, sizeof(int)*((size_t)domain + 1));
+
+    for (int i = 0; i < n; i++)
+    {
+        count[rows[i].b - min_b + 1]++;
+    }
+    for (int v = 1; v <= domain; v++)
+    {
+        count[v] += count[v - 1];
+    }
+    // count[v] is now the first output slot of value min_b + v
+    for (int i = 0; i < n; i++)
+    {
+        scratch[count[rows[i].b - min_b]++] = rows[i];
+    }
+
+    memcpy(rows, scratch, sizeof(Row)*n);
+    arena_free(arena, count);
+    return true;
+}
+
+/**
+ * @brief Stable LSD radix sort of rows by b, one pass per byte of
+ *        the order preserving unsigned key of b, passes where every
+ *        row has the same byte are skipped.
+ */
+static inline void sort_radix_by_b(Row *rows, int n, Row *scratch)
+{
+    int count[4][256];
+    memset(count, 0, sizeof(count));
+
+    // one read pass builds the histograms of all four bytes
+    for (int i = 0; i < n; i++)
+    {
+        uint32_t key = (uint32_t)rows[i].b ^ 0x80000000u;
+        count[0][key & 0xff]++;
+        count[1][(key >> 8) & 0xff]++;
+        count[2][(key >> 16) & 0xff]++;
+        count[3][key >> 24]++;
+    }
+
+    Row *src = rows, *dst = scratch;
+    for (int pass = 0; pass < 4; pass++)
+    {
+        int shift = pass*8;
+        uint32_t first = ((uint32_t)src[0].b ^ 0x80000000u) >> shift & 0xff;
+        if (count[pass][first] == n)
+        {
+            continue;
+        }
+
+        int offset[256];
+        int sum = 0;
+        for (int d = 0; d < 256; d++)
+        {
+            offset[d] = sum;
+            sum += count[pass][d];
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            uint32_t key = (uint32_t)src[i].b ^ 0x80000000u;
+            dst[offset[key >> shift & 0xff]++] = src[i];
+        }
+
+        Row *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != rows)
+    {
+        memcpy(rows, src, sizeof(Row)*n);
+    }
+}
+
+/**
+ * @brief Stable sort of rows by b.
+ *
+ * @param rows Rows to sort in place.
+ * @param n Number of rows.
+ * @param scratch Scratch space of n rows.
+ * @param arena Arena of the counting sort histogram, NULL for malloc.
+ */
+static inline void sort_rows_by_b(Row *rows, int n, Row *scratch, Arena *arena)
+{
+    if (n < 2)
+    {
+        return;
+    }
+
+    int min_b = INT_MAX, max_b = INT_MIN;
+    for (int i = 0; i < n; i++)
+    {
+        min_b = rows[i].b < min_b ? rows[i].b : min_b;
+        max_b = rows[i].b > max_b ? rows[i].b : max_b;
+    }
+
+    // the histogram of a counting sort has to stay small next to n
+    int64_t domain = (int64_t)max_b - min_b + 1;
+    if (domain <= SORT_COUNTING_LIMIT && domain <= 4*(int64_t)n + 256 &&
+            sort_counting_by_b(rows, n, scratch, min_b, (int)domain, arena))
+    {
+        return;
+    }
+
+    sort_radix_by_b(rows, n, scratch);
+}
+
+#endif // MATRIXDB_SORT_H
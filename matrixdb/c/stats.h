@@ -0,0 +1,497 @@
+#ifndef MATRIXDB_STATS_H
+#define MATRIXDB_STATS_H
+
+/*
+ * Query instrumentation, compiled in with gcc -DMATRIXDB_STATS. Without
+ * it every STATS_* macro expands to nothing and its arguments are not
+ * evaluated.
+ *
+ *   STATS_INIT()              once before the first query
+ *   STATS_PHASE_BEGIN(phase)  time a phase of the query, StatsPhase
+ *   STATS_PHASE_END(phase)
+ *   STATS_COUNT(counter, n)   add n to a StatsCounter, from any thread
+ *   STATS_TIMER(t)            a timer summing many short spans, such as
+ *   STATS_TIMER_START(t)      the search of every slice, with two clock
+ *   STATS_TIMER_STOP(t)       reads per span
+ *   STATS_PHASE_ADD(phase, t) record the sum of t as one instance of phase
+ *   STATS_REPORT()            write the report, once at exit
+ *
+ * Every phase keeps its count, total time and an HDR style histogram of
+ * its durations, log-linear buckets within 1/STATS_SUB_BUCKETS of the
+ * value. Phases are marked by the query thread, they may nest but a
+ * phase is not re-entered while open. A phase reads the perf counters
+ * and adds a trace event at every end, so it should cover work worth
+ * more than a few syscalls; a step repeated per slice or per row takes
+ * a timer instead. Counters are striped over cache
+ * lines so threads of a parallel scan rarely share one, hot loops add
+ * their counts once per call rather than per row.
+ *
+ *   MATRIXDB_STATS_JSON=path   the report as JSON, default stderr
+ *   MATRIXDB_STATS_TRACE=path  every phase as a Chrome trace event, for
+ *                              chrome://tracing or Perfetto
+ *   MATRIXDB_STATS_PERF=1      perf_event_open counters per phase,
+ *                              events the kernel refuses are left out
+ */
+#ifdef MATRIXDB_STATS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Stripes of the counters, threads map onto them round robin.
+#define STATS_STRIPES 64
+#define STATS_CACHE_LINE 64
+// log2 of the sub-buckets of a power of two, 32 gives about 3% precision.
+#define STATS_SUB_BITS 5
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 1) << STATS_SUB_BITS)
+// Trace events kept, later phases are counted as dropped.
+#define STATS_MAX_EVENTS (1 << 16)
+
+typedef enum StatsPhase {
+    STATS_PHASE_QUERY,    // the whole query
+    STATS_PHASE_LOAD,     // generate or map the table
+    STATS_PHASE_SEARCH,   // locate the rows of a slice
+    STATS_PHASE_SCAN,     // evaluate the rows
+    STATS_PHASE_SORT,     // order the accepted rows
+    STATS_PHASE_GROUP,    // aggregate the accepted rows
+    STATS_PHASE_OUTPUT,   // format and write the result
+    STATS_NPHASES,
+} StatsPhase;
+
+typedef enum StatsCounter {
+    STATS_ROWS_EXAMINED,  // rows a predicate or a slice bound looked at
+    STATS_ROWS_ACCEPTED,
+    STATS_BLOCKS_SKIPPED, // zone map blocks ruled out
+    STATS_SEARCHES,       // binary searches over the rows
+    STATS_SEARCH_STEPS,   // their halving steps, the search depth
+    STATS_COMPARES,       // row compares of merges and heaps
+    STATS_ALLOCS,         // arena chunks and vector growths
+    STATS_NCOUNTERS,
+} StatsCounter;
+
+typedef enum StatsEvent {
+    STATS_CYCLES,
+    STATS_INSTRUCTIONS,
+    STATS_CACHE_MISSES,
+    STATS_BRANCH_MISSES,
+    STATS_PAGE_FAULTS,
+    STATS_NEVENTS,
+} StatsEvent;
+
+static const char *const stats_phase_names[STATS_NPHASES] = {
+    "query", "load", "search", "scan", "sort", "group", "output",
+};
+
+static const char *const stats_counter_names[STATS_NCOUNTERS] = {
+    "rows_examined", "rows_accepted", "blocks_skipped", "searches",
+    "search_steps", "compares", "allocs",
+};
+
+static const char *const stats_event_names[STATS_NEVENTS] = {
+    "cycles", "instructions", "cache_misses", "branch_misses", "page_faults",
+};
+
+typedef struct StatsStripe {
+    _Alignas(STATS_CACHE_LINE) _Atomic uint64_t counters[STATS_NCOUNTERS];
+} StatsStripe;
+
+typedef struct StatsHistogram {
+    uint64_t buckets[STATS_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+} StatsHistogram;
+
+typedef struct StatsPhaseState {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t start_ns;              // of the open instance
+    uint64_t start_events[STATS_NEVENTS];
+    uint64_t events[STATS_NEVENTS]; // deltas summed over all instances
+    bool     measured;              // events were read, not only timer sums
+    StatsHistogram hist;
+} StatsPhaseState;
+
+typedef struct StatsTraceEvent {
+    uint8_t phase;
+    int tid;
+    uint64_t start_ns;
+    uint64_t dur_ns;
+} StatsTraceEvent;
+
+typedef struct StatsState {
+    bool ready;
+    uint64_t origin_ns;              // trace timestamps count from here
+    StatsStripe stripes[STATS_STRIPES];
+    atomic_int next_stripe;
+    StatsPhaseState phases[STATS_NPHASES];
+    StatsTraceEvent *events;
+    int nevents;
+    int64_t dropped;
+    int perf_fds[STATS_NEVENTS];     // -1 for events not counted
+} StatsState;
+
+static StatsState stats_state;
+static _Thread_local int stats_stripe = -1;
+
+static inline uint64_t stats_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Bucket of v, exact below STATS_SUB_BUCKETS, then
+ *        STATS_SUB_BUCKETS buckets per power of two.
+ */
+static inline int stats_bucket(uint64_t v)
+{
+    if (v < STATS_SUB_BUCKETS)
+    {
+        return (int)v;
+    }
+
+    int e = 63 - __builtin_clzll(v);
+    return ((e - STATS_SUB_BITS + 1) << STATS_SUB_BITS) |
+            (int)((v >> (e - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1));
+}
+
+/**
+ * @brief Smallest value of bucket i.
+ */
+static inline uint64_t stats_bucket_value(int i)
+{
+    if (i < STATS_SUB_BUCKETS)
+    {
+        return (uint64_t)i;
+    }
+
+    int e = (i >> STATS_SUB_BITS) + STATS_SUB_BITS - 1;
+    return ((uint64_t)STATS_SUB_BUCKETS | (uint64_t)(i & (STATS_SUB_BUCKETS - 1))) << (e - STATS_SUB_BITS);
+}
+
+static inline void stats_hist_record(StatsHistogram *hist, uint64_t v)
+{
+    hist->buckets[stats_bucket(v)]++;
+    hist->count++;
+    hist->max = v > hist->max ? v : hist->max;
+}
+
+/**
+ * @brief Percentile p in [0, 100] of hist, the low end of its bucket.
+ */
+static inline uint64_t stats_hist_percentile(const StatsHistogram *hist, double p)
+{
+    uint64_t rank = (uint64_t)(p/100.0*hist->count + 0.999999);
+    rank = rank < 1 ? 1 : rank;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++)
+    {
+        seen += hist->buckets[i];
+        if (seen >= rank)
+        {
+            return stats_bucket_value(i);
+        }
+    }
+    return hist->max;
+}
+
+static inline int stats_perf_open(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // threads started later count too, folded in when they exit
+    attr.inherit = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static inline void stats_perf_read(uint64_t *values)
+{
+    for (int i = 0; i < STATS_NEVENTS; i++)
+    {
+        uint64_t v = 0;
+        if (stats_state.perf_fds[i] >= 0 && read(stats_state.perf_fds[i], &v, sizeof(v)) != sizeof(v))
+        {
+            v = 0;
+        }
+        values[i] = v;
+    }
+}
+
+static inline void stats_init(void)
+{
+    memset(&stats_state, 0, sizeof(StatsState));
+    stats_state.origin_ns = stats_now_ns();
+    stats_state.events = malloc(sizeof(StatsTraceEvent)*STATS_MAX_EVENTS);
+    for (int i = 0; i < STATS_NEVENTS; i++)
+    {
+        stats_state.perf_fds[i] = -1;
+    }
+
+    const char *perf = getenv("MATRIXDB_STATS_PERF");
+    if (perf && strcmp(perf, "0") != 0)
+    {
+        static const struct { uint32_t type; uint64_t config; } kinds[STATS_NEVENTS] = {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+            { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+        };
+        for (int i = 0; i < STATS_NEVENTS; i++)
+        {
+            stats_state.perf_fds[i] = stats_perf_open(kinds[i].type, kinds[i].config);
+            if (stats_state.perf_fds[i] < 0)
+            {
+                fprintf(stderr, "WARN: perf event %s is not available\n", stats_event_names[i]);
+            }
+        }
+    }
+    stats_state.ready = true;
+}
+
+static inline void stats_count(StatsCounter counter, uint64_t n)
+{
+    if (stats_stripe < 0)
+    {
+        stats_stripe = atomic_fetch_add(&stats_state.next_stripe, 1) % STATS_STRIPES;
+    }
+    atomic_fetch_add_explicit(&stats_state.stripes[stats_stripe].counters[counter], n,
+            memory_order_relaxed);
+}
+
+static inline uint64_t stats_counter_total(StatsCounter counter)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < STATS_STRIPES; i++)
+    {
+        total += atomic_load_explicit(&stats_state.stripes[i].counters[counter], memory_order_relaxed);
+    }
+    return total;
+}
+
+/**
+ * @brief Number of halving steps of a binary search over n rows.
+ */
+static inline uint64_t stats_search_depth(int64_t n)
+{
+    return n > 1 ? 64 - __builtin_clzll((uint64_t)(n - 1)) : 0;
+}
+
+static inline int stats_tid(void)
+{
+    static _Thread_local int tid = 0;
+    if (!tid)
+    {
+        tid = (int)syscall(SYS_gettid);
+    }
+    return tid;
+}
+
+static inline void stats_phase_begin(StatsPhase phase)
+{
+    StatsPhaseState *state = &stats_state.phases[phase];
+    if (!stats_state.ready)
+    {
+        return;
+    }
+
+    stats_perf_read(state->start_events);
+    state->start_ns = stats_now_ns();
+}
+
+static inline void stats_phase_end(StatsPhase phase)
+{
+    StatsPhaseState *state = &stats_state.phases[phase];
+    if (!stats_state.ready)
+    {
+        return;
+    }
+
+    uint64_t end_ns = stats_now_ns();
+    uint64_t events[STATS_NEVENTS];
+    stats_perf_read(events);
+
+    uint64_t dur = end_ns - state->start_ns;
+    state->count++;
+    state->total_ns += dur;
+    stats_hist_record(&state->hist, dur);
+    for (int i = 0; i < STATS_NEVENTS; i++)
+    {
+        state->events[i] += events[i] - state->start_events[i];
+    }
+    state->measured = true;
+
+    if (stats_state.events && stats_state.nevents < STATS_MAX_EVENTS)
+    {
+        StatsTraceEvent *event = &stats_state.events[stats_state.nevents++];
+        event->phase = (uint8_t)phase;
+        event->tid = stats_tid();
+        event->start_ns = state->start_ns - stats_state.origin_ns;
+        event->dur_ns = dur;
+    }
+    else if (stats_state.events)
+    {
+        stats_state.dropped++;
+    }
+}
+
+/**
+ * @brief One instance of phase that took ns in total, summed up by a
+ *        timer. It has no perf counters and no trace event, its spans
+ *        are spread over the query.
+ */
+static inline void stats_phase_add(StatsPhase phase, uint64_t ns)
+{
+    StatsPhaseState *state = &stats_state.phases[phase];
+    if (!stats_state.ready)
+    {
+        return;
+    }
+
+    state->count++;
+    state->total_ns += ns;
+    stats_hist_record(&state->hist, ns);
+}
+
+static inline void stats_write_json(FILE *out)
+{
+    fprintf(out, "{\"counters\":{");
+    for (int i = 0; i < STATS_NCOUNTERS; i++)
+    {
+        fprintf(out, "%s\"%s\":%llu", i ? "," : "", stats_counter_names[i],
+                (unsigned long long)stats_counter_total((StatsCounter)i));
+    }
+
+    fprintf(out, "},\"phases\":{");
+    bool first = true;
+    for (int i = 0; i < STATS_NPHASES; i++)
+    {
+        const StatsPhaseState *state = &stats_state.phases[i];
+        if (!state->count)
+        {
+            continue;
+        }
+
+        fprintf(out, "%s\"%s\":{\"count\":%llu,\"total_ns\":%llu,\"p50_ns\":%llu,"
+                "\"p99_ns\":%llu,\"max_ns\":%llu", first ? "" : ",", stats_phase_names[i],
+                (unsigned long long)state->count, (unsigned long long)state->total_ns,
+                (unsigned long long)stats_hist_percentile(&state->hist, 50),
+                (unsigned long long)stats_hist_percentile(&state->hist, 99),
+                (unsigned long long)state->hist.max);
+        for (int e = 0; e < STATS_NEVENTS; e++)
+        {
+            if (stats_state.perf_fds[e] >= 0 && state->measured)
+            {
+                fprintf(out, ",\"%s\":%llu", stats_event_names[e], (unsigned long long)state->events[e]);
+            }
+        }
+        fprintf(out, "}");
+        first = false;
+    }
+    fprintf(out, "},\"trace_dropped\":%lld}\n", (long long)stats_state.dropped);
+}
+
+/**
+ * @brief Chrome trace event format, one complete ("X") event per phase.
+ */
+static inline void stats_write_trace(FILE *out)
+{
+    int pid = (int)getpid();
+    fprintf(out, "{\"traceEvents\":[");
+    for (int i = 0; i < stats_state.nevents; i++)
+    {
+        const StatsTraceEvent *event = &stats_state.events[i];
+        fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                i ? "," : "", stats_phase_names[event->phase], event->start_ns/1e3,
+                event->dur_ns/1e3, pid, event->tid);
+    }
+    fprintf(out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+}
+
+static inline void stats_report(void)
+{
+    if (!stats_state.ready)
+    {
+        return;
+    }
+
+    const char *path = getenv("MATRIXDB_STATS_JSON");
+    FILE *out = path ? fopen(path, "w") : stderr;
+    if (out)
+    {
+        stats_write_json(out);
+        if (out != stderr)
+        {
+            fclose(out);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "WARN: cannot write %s\n", path);
+    }
+
+    path = getenv("MATRIXDB_STATS_TRACE");
+    out = path ? fopen(path, "w") : NULL;
+    if (out)
+    {
+        stats_write_trace(out);
+        fclose(out);
+    }
+    else if (path)
+    {
+        fprintf(stderr, "WARN: cannot write %s\n", path);
+    }
+
+    for (int i = 0; i < STATS_NEVENTS; i++)
+    {
+        if (stats_state.perf_fds[i] >= 0)
+        {
+            close(stats_state.perf_fds[i]);
+        }
+    }
+    free(stats_state.events);
+    stats_state.events = NULL;
+    stats_state.ready = false;
+}
+
+#define STATS_INIT() stats_init()
+#define STATS_PHASE_BEGIN(phase) stats_phase_begin(phase)
+#define STATS_PHASE_END(phase) stats_phase_end(phase)
+#define STATS_COUNT(counter, n) stats_count((counter), (uint64_t)(n))
+#define STATS_TIMER(t) uint64_t t##_start = 0, t##_total = 0
+#define STATS_TIMER_START(t) (t##_start = stats_now_ns())
+#define STATS_TIMER_STOP(t) (t##_total += stats_now_ns() - t##_start)
+#define STATS_PHASE_ADD(phase, t) stats_phase_add((phase), t##_total)
+#define STATS_REPORT() stats_report()
+
+#else
+
+#define STATS_INIT() ((void)0)
+#define STATS_PHASE_BEGIN(phase) ((void)0)
+#define STATS_PHASE_END(phase) ((void)0)
+#define STATS_COUNT(counter, n) ((void)0)
+#define STATS_TIMER(t)
+#define STATS_TIMER_START(t) ((void)0)
+#define STATS_TIMER_STOP(t) ((void)0)
+#define STATS_PHASE_ADD(phase, t) ((void)0)
+#define STATS_REPORT() ((void)0)
+
+#endif // MATRIXDB_STATS
+
+#endif // MATRIXDB_STATS_H
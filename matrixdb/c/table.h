@@ -0,0 +1,117 @@
+#ifndef MATRIXDB_TABLE_H
+#define MATRIXDB_TABLE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "row.h"
+
+// Columns are aligned to a cache line so scans never split a line.
+#define TABLE_ALIGNMENT 64
+
+/**
+ * @brief Columnar (struct-of-arrays) table, column `a` and column `b`
+ *        are stored in separate contiguous arrays so a scan only loads
+ *        the columns its predicate touches.
+ */
+typedef struct Table {
+    int  nrows;
+    int *a; // column a, TABLE_ALIGNMENT aligned
+    int *b; // column b, TABLE_ALIGNMENT aligned
+    bool owned; // table_free releases the columns, false for mapped files
+} Table;
+
+/**
+ * @brief Allocate an aligned column of nrows values.
+ * 
+ * @param nrows Number of values in the column.
+ * @return int* column, NULL when out of memory.
+ */
+static inline int* table_alloc_column(int nrows)
+{
+    void *col = NULL;
+    // round up so the tail of the last cache line is addressable by SIMD loads
+    size_t size = ((size_t)nrows*sizeof(int) + TABLE_ALIGNMENT - 1) & ~(size_t)(TABLE_ALIGNMENT - 1);
+
+    if (posix_memalign(&col, TABLE_ALIGNMENT, size ? size : TABLE_ALIGNMENT) != 0)
+    {
+        return NULL;
+    }
+
+    return (int *)col;
+}
+
+/**
+ * @brief Create an empty table with room for nrows.
+ * 
+ * @param nrows Number of rows of the table.
+ * @return Table* the table, NULL when out of memory.
+ */
+static inline Table* table_create(int nrows)
+{
+    Table *table = calloc(1, sizeof(Table));
+    if (!table)
+    {
+        return NULL;
+    }
+
+    table->nrows = nrows;
+    table->owned = true;
+    table->a = table_alloc_column(nrows);
+    table->b = table_alloc_column(nrows);
+    if (!table->a || !table->b)
+    {
+        free(table->a);
+        free(table->b);
+        free(table);
+        return NULL;
+    }
+
+    return table;
+}
+
+/**
+ * @brief Convert row oriented data into a columnar table.
+ * 
+ * @param rows Rows to copy.
+ * @param nrows Number of rows.
+ * @return Table* the table, NULL when out of memory.
+ */
+static inline Table* table_from_rows(const Row *rows, int nrows)
+{
+    Table *table = table_create(nrows);
+    if (!table)
+    {
+        return NULL;
+    }
+
+    for (int i = 0; i < nrows; i++)
+    {
+        table->a[i] = rows[i].a;
+        table->b[i] = rows[i].b;
+    }
+
+    return table;
+}
+
+/**
+ * @brief Release a table created by table_create/table_from_rows, the
+ *        columns of a table that does not own them are left alone.
+ */
+static inline void table_free(Table *table)
+{
+    if (!table)
+    {
+        return;
+    }
+
+    if (table->owned)
+    {
+        free(table->a);
+        free(table->b);
+    }
+    free(table);
+}
+
+#endif // MATRIXDB_TABLE_H
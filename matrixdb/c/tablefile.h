@@ -0,0 +1,462 @@
+#ifndef MATRIXDB_TABLEFILE_H
+#define MATRIXDB_TABLEFILE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "row.h"
+#include "table.h"
+#include "zonemap.h"
+
+/*
+ * Binary table file, written once and opened with mmap, the scans run
+ * straight over the mapped pages and nothing is parsed or copied at
+ * startup. Pages are read on first touch.
+ *
+ *   [0, 4096)           TableFileHeader
+ *   a_offset            column a, or the rows of a row layout
+ *   b_offset            column b (column layout only)
+ *   zones_offset        block index, one Zone per block_rows rows
+ *
+ * Sections start on page boundaries and are padded to TABLE_ALIGNMENT,
+ * so mapped columns keep the alignment table_alloc_column gives. All
+ * values are in host byte order.
+ *
+ * The header carries a checksum of itself, checked by every open, and a
+ * checksum of everything behind it, checked by tablefile_verify only as
+ * it reads the whole file.
+ */
+#define TABLEFILE_MAGIC "MATRIXDB"
+#define TABLEFILE_VERSION 1
+#define TABLEFILE_PAGE 4096
+
+typedef enum TableLayout {
+    TABLE_LAYOUT_ROWS = 1,    // Row[nrows], what task2-4 scan
+    TABLE_LAYOUT_COLUMNS = 2, // int a[nrows], int b[nrows], what task1 scans
+} TableLayout;
+
+typedef enum TableSortOrder {
+    TABLE_SORT_NONE = 0,
+    TABLE_SORT_AB = 1,        // sorted by (a,b)
+} TableSortOrder;
+
+typedef struct TableFileHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;     // sizeof(TableFileHeader)
+    uint64_t nrows;
+    uint32_t layout;          // TableLayout
+    uint32_t sort_order;      // TableSortOrder
+    uint32_t block_rows;      // rows per zone of the block index
+    uint32_t nblocks;
+    uint64_t a_offset;
+    uint64_t b_offset;
+    uint64_t zones_offset;
+    uint64_t file_size;
+    uint64_t data_checksum;   // of the bytes [TABLEFILE_PAGE, file_size)
+    uint64_t header_checksum; // of the header before this field
+} TableFileHeader;
+
+/**
+ * @brief A mapped table file, the pointers point into the mapping.
+ */
+typedef struct TableFile {
+    void  *base;
+    size_t size;
+    const TableFileHeader *header;
+    const Row *rows;   // row layout
+    const int *a;      // column layout
+    const int *b;
+    const Zone *zones;
+} TableFile;
+
+/**
+ * @brief 64 bit checksum of len bytes, a multiple of 8.
+ */
+static inline uint64_t tablefile_checksum(const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ len;
+    for (size_t i = 0; i + 8 <= len; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, p + i, sizeof(w));
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+static inline uint64_t tablefile_align(uint64_t offset, uint64_t align)
+{
+    return (offset + align - 1) & ~(align - 1);
+}
+
+/**
+ * @brief Zones of the rows [0, nrows), value i of column a is a[i*stride],
+ *        of column b b[i*stride].
+ */
+static inline void tablefile_zones(const int *a, const int *b, size_t stride,
+                        uint64_t nrows, Zone *zones)
+{
+    uint64_t nblocks = (nrows + ZONEMAP_BLOCK_ROWS - 1) / ZONEMAP_BLOCK_ROWS;
+    for (uint64_t blk = 0; blk < nblocks; blk++)
+    {
+        uint64_t begin = blk*ZONEMAP_BLOCK_ROWS;
+        uint64_t end = begin + ZONEMAP_BLOCK_ROWS < nrows ? begin + ZONEMAP_BLOCK_ROWS : nrows;
+        Zone zone = { INT_MAX, INT_MIN, INT_MAX, INT_MIN };
+
+        for (uint64_t i = begin; i < end; i++)
+        {
+            int va = a[i*stride], vb = b[i*stride];
+            zone.min_a = va < zone.min_a ? va : zone.min_a;
+            zone.max_a = va > zone.max_a ? va : zone.max_a;
+            zone.min_b = vb < zone.min_b ? vb : zone.min_b;
+            zone.max_b = vb > zone.max_b ? vb : zone.max_b;
+        }
+
+        zones[blk] = zone;
+    }
+}
+
+static inline bool tablefile_write_at(int fd, const void *data, size_t len, uint64_t offset)
+{
+    const char *p = (const char *)data;
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, p, len, (off_t)offset);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+/**
+ * @brief Write a table file. The sections are written first, the data
+ *        checksum is taken over the written file, the header goes last
+ *        and the file is renamed into place, a crashed write never
+ *        leaves a valid looking file behind.
+ *
+ * @param path File to create or replace.
+ * @param layout TABLE_LAYOUT_ROWS with rows, TABLE_LAYOUT_COLUMNS with a and b.
+ * @param err Receives a message on failure, can be NULL.
+ * @param errlen Size of err.
+ * @return true when the file is written.
+ */
+static inline bool tablefile_write(const char *path, TableLayout layout, const Row *rows,
+                        const int *a, const int *b, uint64_t nrows, char *err, size_t errlen)
+{
+    TableFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TABLEFILE_MAGIC, sizeof(header.magic));
+    header.version = TABLEFILE_VERSION;
+    header.header_size = sizeof(TableFileHeader);
+    header.nrows = nrows;
+    header.layout = layout;
+    header.block_rows = ZONEMAP_BLOCK_ROWS;
+    header.nblocks = (uint32_t)((nrows + ZONEMAP_BLOCK_ROWS - 1) / ZONEMAP_BLOCK_ROWS);
+
+    if (layout == TABLE_LAYOUT_ROWS && rows)
+    {
+        a = &rows[0].a;
+        b = &rows[0].b;
+    }
+    size_t stride = layout == TABLE_LAYOUT_ROWS ? 2 : 1;
+
+    header.sort_order = TABLE_SORT_AB;
+    for (uint64_t i = 1; i < nrows && header.sort_order == TABLE_SORT_AB; i++)
+    {
+        int pa = a[(i - 1)*stride], pb = b[(i - 1)*stride];
+        int ca = a[i*stride], cb = b[i*stride];
+        if (ca < pa || (ca == pa && cb < pb))
+        {
+            header.sort_order = TABLE_SORT_NONE;
+        }
+    }
+
+    uint64_t column_size = tablefile_align(nrows*sizeof(int), TABLE_ALIGNMENT);
+    header.a_offset = TABLEFILE_PAGE;
+    if (layout == TABLE_LAYOUT_ROWS)
+    {
+        header.zones_offset = tablefile_align(header.a_offset + 2*column_size, TABLEFILE_PAGE);
+    }
+    else
+    {
+        header.b_offset = tablefile_align(header.a_offset + column_size, TABLEFILE_PAGE);
+        header.zones_offset = tablefile_align(header.b_offset + column_size, TABLEFILE_PAGE);
+    }
+    header.file_size = header.zones_offset +
+            tablefile_align((uint64_t)header.nblocks*sizeof(Zone), TABLE_ALIGNMENT);
+
+    Zone *zones = malloc(sizeof(Zone)*(header.nblocks > 0 ? header.nblocks : 1));
+    char tmp[PATH_MAX + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    int fd = zones ? open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644) : -1;
+    if (fd < 0)
+    {
+        snprintf(err, err ? errlen : 0, "cannot create %s: %s", tmp, zones ? strerror(errno) : "out of memory");
+        free(zones);
+        return false;
+    }
+
+    tablefile_zones(a, b, stride, nrows, zones);
+
+    // ftruncate leaves the padding between the sections zeroed
+    bool ok = ftruncate(fd, (off_t)header.file_size) == 0;
+    if (layout == TABLE_LAYOUT_ROWS)
+    {
+        ok = ok && tablefile_write_at(fd, rows, nrows*sizeof(Row), header.a_offset);
+    }
+    else
+    {
+        ok = ok && tablefile_write_at(fd, a, nrows*sizeof(int), header.a_offset);
+        ok = ok && tablefile_write_at(fd, b, nrows*sizeof(int), header.b_offset);
+    }
+    ok = ok && tablefile_write_at(fd, zones, (uint64_t)header.nblocks*sizeof(Zone), header.zones_offset);
+    free(zones);
+
+    if (ok)
+    {
+        void *base = mmap(NULL, header.file_size, PROT_READ, MAP_SHARED, fd, 0);
+        ok = base != MAP_FAILED;
+        if (ok)
+        {
+            header.data_checksum = tablefile_checksum((char *)base + TABLEFILE_PAGE,
+                    header.file_size - TABLEFILE_PAGE);
+            munmap(base, header.file_size);
+        }
+    }
+
+    header.header_checksum = tablefile_checksum(&header, offsetof(TableFileHeader, header_checksum));
+    ok = ok && tablefile_write_at(fd, &header, sizeof(header), 0);
+    ok = ok && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok)
+    {
+        snprintf(err, err ? errlen : 0, "cannot write %s: %s", path, strerror(errno));
+        unlink(tmp);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Write the rows of a (a,b) sorted or unsorted row table.
+ */
+static inline bool tablefile_write_rows(const char *path, const Row *rows, uint64_t nrows,
+                        char *err, size_t errlen)
+{
+    return tablefile_write(path, TABLE_LAYOUT_ROWS, rows, NULL, NULL, nrows, err, errlen);
+}
+
+/**
+ * @brief Write the columns of table.
+ */
+static inline bool tablefile_write_table(const char *path, const Table *table,
+                        char *err, size_t errlen)
+{
+    return tablefile_write(path, TABLE_LAYOUT_COLUMNS, NULL, table->a, table->b,
+            (uint64_t)table->nrows, err, errlen);
+}
+
+/**
+ * @brief Open and map a table file, only the header is read.
+ *
+ * @param err Receives a message on failure, can be NULL.
+ * @param errlen Size of err.
+ * @return TableFile* the file, NULL when it is missing or not valid,
+ *         release it with tablefile_close.
+ */
+static inline TableFile* tablefile_open(const char *path, char *err, size_t errlen)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        snprintf(err, err ? errlen : 0, "cannot open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= TABLEFILE_PAGE)
+    {
+        base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    // the mapping keeps the file referenced
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        snprintf(err, err ? errlen : 0, "cannot map %s", path);
+        return NULL;
+    }
+
+    const TableFileHeader *h = (const TableFileHeader *)base;
+    const char *problem = NULL;
+    uint64_t column_size = tablefile_align(h->nrows*sizeof(int), TABLE_ALIGNMENT);
+    if (memcmp(h->magic, TABLEFILE_MAGIC, sizeof(h->magic)) != 0)
+    {
+        problem = "not a table file";
+    }
+    else if (h->version != TABLEFILE_VERSION || h->header_size != sizeof(TableFileHeader))
+    {
+        problem = "unsupported version";
+    }
+    else if (h->header_checksum != tablefile_checksum(h, offsetof(TableFileHeader, header_checksum)))
+    {
+        problem = "header checksum mismatch";
+    }
+    else if (h->file_size != (uint64_t)st.st_size || h->nrows > INT_MAX ||
+            h->block_rows != ZONEMAP_BLOCK_ROWS ||
+            h->nblocks != (h->nrows + ZONEMAP_BLOCK_ROWS - 1) / ZONEMAP_BLOCK_ROWS ||
+            h->zones_offset + (uint64_t)h->nblocks*sizeof(Zone) > h->file_size)
+    {
+        problem = "truncated or inconsistent";
+    }
+    else if (h->layout == TABLE_LAYOUT_ROWS ? h->a_offset + 2*column_size > h->zones_offset :
+            h->layout != TABLE_LAYOUT_COLUMNS || h->a_offset + column_size > h->b_offset ||
+            h->b_offset + column_size > h->zones_offset)
+    {
+        problem = "bad layout";
+    }
+
+    TableFile *file = problem ? NULL : calloc(1, sizeof(TableFile));
+    if (!file)
+    {
+        snprintf(err, err ? errlen : 0, "%s: %s", path, problem ? problem : "out of memory");
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+
+    file->base = base;
+    file->size = (size_t)st.st_size;
+    file->header = h;
+    if (h->layout == TABLE_LAYOUT_ROWS)
+    {
+        file->rows = (const Row *)((const char *)base + h->a_offset);
+    }
+    else
+    {
+        file->a = (const int *)((const char *)base + h->a_offset);
+        file->b = (const int *)((const char *)base + h->b_offset);
+    }
+    file->zones = (const Zone *)((const char *)base + h->zones_offset);
+
+    return file;
+}
+
+/**
+ * @brief Check the data checksum, this reads the whole file.
+ */
+static inline bool tablefile_verify(const TableFile *file)
+{
+    return tablefile_checksum((const char *)file->base + TABLEFILE_PAGE,
+            file->size - TABLEFILE_PAGE) == file->header->data_checksum;
+}
+
+static inline void tablefile_close(TableFile *file)
+{
+    if (!file)
+    {
+        return;
+    }
+
+    munmap(file->base, file->size);
+    free(file);
+}
+
+/**
+ * @brief Open a table file of the given layout for a task. The whole
+ *        file is checked against its data checksum when the environment
+ *        variable MATRIXDB_TABLE_VERIFY is set.
+ */
+static inline TableFile* tablefile_load(const char *path, TableLayout layout, char *err, size_t errlen)
+{
+    TableFile *file = tablefile_open(path, err, errlen);
+    if (!file)
+    {
+        return NULL;
+    }
+
+    const char *problem = NULL;
+    if (file->header->layout != (uint32_t)layout)
+    {
+        problem = layout == TABLE_LAYOUT_ROWS ? "has a column layout, rows expected" :
+                "has a row layout, columns expected";
+    }
+    else if (getenv("MATRIXDB_TABLE_VERIFY") && !tablefile_verify(file))
+    {
+        problem = "data checksum mismatch";
+    }
+
+    if (problem)
+    {
+        snprintf(err, err ? errlen : 0, "%s %s", path, problem);
+        tablefile_close(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+/**
+ * @brief Table over the mapped columns, it does not own them and must
+ *        be freed before file is closed.
+ *
+ * @return Table* the table, NULL for a row layout or when out of memory.
+ */
+static inline Table* tablefile_table(const TableFile *file)
+{
+    Table *table = file->a ? calloc(1, sizeof(Table)) : NULL;
+    if (!table)
+    {
+        return NULL;
+    }
+
+    table->nrows = (int)file->header->nrows;
+    table->a = (int *)file->a;
+    table->b = (int *)file->b;
+    table->owned = false;
+    return table;
+}
+
+/**
+ * @brief Zone map over the mapped block index, must be freed before
+ *        file is closed.
+ */
+static inline ZoneMap* tablefile_zonemap(const TableFile *file)
+{
+    ZoneMap *map = calloc(1, sizeof(ZoneMap));
+    if (!map)
+    {
+        return NULL;
+    }
+
+    map->nblocks = (int)file->header->nblocks;
+    map->block_rows = (int)file->header->block_rows;
+    map->zones = (Zone *)file->zones;
+    map->mapped = true;
+    return map;
+}
+
+#endif // MATRIXDB_TABLEFILE_H
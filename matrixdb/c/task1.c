@@ -1,9 +1,22 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "table.h"
+#include "filter.h"
+#include "zonemap.h"
+#include "parser.h"
+#include "arena.h"
+#include "jit.h"
+#include "sink.h"
+#include "tablefile.h"
+#include "compress.h"
+#include "bitmap.h"
+#include "agg.h"
+
 /* 
  * When generate a Row,
  * column `a` is generated
@@ -18,93 +31,183 @@
 // Number of rows that generated for testing.
 #define N_ROWS 4000000
 
-/**
- * @brief 
- * 
- */
-typedef struct Row {
-    int a;
-    int b;
-} Row;
+// Fewer selected rows are grouped by the calling thread alone.
+#define GROUP_MIN_PARALLEL (64*1024)
+
+// WHERE expression used when none is given on the command line.
+#define DEFAULT_QUERY "a IN (1000, 2000, 3000) AND b >= 10 AND b < 50"
+
+// Query scoped allocations, released at once when the query is done.
+Arena query_arena;
+
+// Per block min/max of the table, lets scans skip blocks, see zonemap.h.
+ZoneMap* zone_map = NULL;
+
+// Compressed columns scanned instead of the raw ones, see MATRIXDB_COMPRESS.
+PackedTable* packed_table = NULL;
+
+// Row ids of every value of a, resolves IN-lists, see MATRIXDB_BITMAP.
+BitmapIndex* bitmap_index = NULL;
 
 /**
  * @brief Function used to generate large seeds for performance testing.
  * 
  * @param nrows Number of rows this function will generate and return.
- * @return Row* list of rows generated in this function.
+ * @return Table* columnar table generated in this function.
  */
-Row* generate_seed(int nrows)
+Table* generate_seed(int nrows)
 {
-    time_t seconds;
-
-    Row* rows = calloc(nrows, sizeof(Row));
+    Table* table = table_create(nrows);
+    if (!table)
+    {
+        return NULL;
+    }
 
     for (int i = 0; i < nrows; i++)
     {
-        rows[i].a = N_BASE_A*(i+1);
-        rows[i].b = N_BASE_B*(i+1);
+        table->a[i] = N_BASE_A*(i+1);
+        table->b[i] = N_BASE_B*(i+1);
     }
 
-    return rows;
+    return table;
 }
 
 /**
- * @brief Scan given rows with specific handler.
+ * @brief Scan given table with specific scan, the table is split into
+ *        one partition per thread, see MATRIXDB_THREADS in
+ *        parallel_threads(). Blocks that the zone map of scan rules out
+ *        are skipped. The cost line is printed by print_cost once the
+ *        rows are out.
  * 
- * @param rows Rows contain part or all dataset, see Row for more details.
- * @param nrows Number of input rows.
- * @param accepted arrary of indices of all accepted rows.
- * @param handle A callback function to let the scanner to 
- *               know whether a row is accepted, callback function
- *               returns true when the scanned row need to be kept,
- *               otherwise return false to remove a scanned row.
- *               You can pass a NULL handle to reject all rows.
+ * @param table Table contains part or all dataset, see Table for more details.
+ * @param scan How rows are evaluated, see ZoneScan.
+ * @param sel Output indices of all accepted rows, room for table->nrows.
  * @return How many rows that accepted by the processor
  */
-int scan_process(const Row* rows, int nrows, bool(*handle)(Row))
+int scan_process(const Table* table, const ZoneScan *scan, int *sel)
 {
-    clock_t before = clock();
-    if (!rows)
+    if (!table)
     {
         return 0;
     }
 
-    int accepted_cnt = 0;
+    STATS_PHASE_BEGIN(STATS_PHASE_SCAN);
+    int accepted_cnt = zone_scan_parallel(scan, table->nrows, parallel_threads(), sel);
+    STATS_PHASE_END(STATS_PHASE_SCAN);
+    STATS_COUNT(STATS_ROWS_ACCEPTED, accepted_cnt);
 
-    for (int i = 0; i < nrows; i++)
-    {
-        if (handle && handle(rows[i]))
-        {
-            accepted_cnt++;
-        }
-    }
+    return accepted_cnt;
+}
 
+/**
+ * @brief Print the cost of the query started at before, rows go out
+ *        before the cost line.
+ */
+void print_cost(clock_t before, int nrows, int accepted_cnt)
+{
     clock_t after = clock();
 
     printf("---- Cost: %ldus(%.2fms) Total(%d) Found(%d) ----\n", 
-            after-before, ((float)after-(float)before)/1000.0F, nrows , accepted_cnt);
+            after-before, ((float)after-(float)before)/1000.0F, nrows, accepted_cnt);
+}
 
-    return accepted_cnt;
+typedef struct GroupWork {
+    const Table *table;
+    const int *sel;
+    int nsel;
+    AggTable *parts; // one partial table per thread
+    bool *ok;
+} GroupWork;
+
+/**
+ * @brief Aggregate the selected rows of one partition into its own table.
+ */
+void group_work(int tid, int nthreads, void *arg)
+{
+    GroupWork *work = (GroupWork *)arg;
+    int begin = parallel_partition(work->nsel, nthreads, tid, AGG_BATCH);
+    int end = parallel_partition(work->nsel, nthreads, tid + 1, AGG_BATCH);
+    int a[AGG_BATCH], b[AGG_BATCH];
+
+    bool ok = agg_init(&work->parts[tid], AGG_MIN_BITS, NULL);
+    for (int k = begin; k < end && ok; k += AGG_BATCH)
+    {
+        int m = end - k < AGG_BATCH ? end - k : AGG_BATCH;
+        if (packed_table)
+        {
+            packed_gather(&packed_table->a, work->sel + k, m, a);
+            packed_gather(&packed_table->b, work->sel + k, m, b);
+        }
+        else
+        {
+            for (int i = 0; i < m; i++)
+            {
+                a[i] = work->table->a[work->sel[k + i]];
+                b[i] = work->table->b[work->sel[k + i]];
+            }
+        }
+        ok = agg_update(&work->parts[tid], a, b, m);
+    }
+    work->ok[tid] = ok;
 }
 
 /**
- * @brief Handle Row according to task1.
- * 
- * @param row immutable object for all row.
- * @return 0 row is accepted
- * @return 1 move to left
- * @return 2 move to right
+ * @brief GROUP BY a of the selected rows, hash aggregated in parallel,
+ *        the groups are printed sorted by a.
  */
-bool task1_handle(Row row)
+void group_process(const Table *table, const Query *query, const int *sel, int nsel)
 {
-    // a in (1000, 2000, 3000) and b between 10 and 50
-    if ((row.a == 1000 || row.a == 2000 || row.a == 3000) && row.b >= 10 && row.b < 50)
+    clock_t before = clock();
+
+    int nthreads = nsel < GROUP_MIN_PARALLEL ? 1 : parallel_threads();
+    AggTable *parts = calloc(nthreads, sizeof(AggTable));
+    bool *ok = calloc(nthreads, sizeof(bool));
+    if (!parts || !ok)
+    {
+        free(parts);
+        free(ok);
+        return;
+    }
+
+    GroupWork work = { table, sel, nsel, parts, ok };
+    STATS_PHASE_BEGIN(STATS_PHASE_GROUP);
+    parallel_run(nthreads, group_work, &work);
+
+    bool merged = ok[0];
+    for (int t = 1; t < nthreads; t++)
+    {
+        merged = merged && ok[t] && agg_merge(&parts[0], &parts[t]);
+    }
+    STATS_PHASE_END(STATS_PHASE_GROUP);
+
+    STATS_PHASE_BEGIN(STATS_PHASE_OUTPUT);
+    ResultSink sink;
+    if (merged && sink_init(&sink, STDOUT_FILENO))
+    {
+        AggOutput out = { &sink, query->offset, query_limit_end(query), 0 };
+        AggGroup *groups = agg_sorted(&parts[0]);
+        for (uint32_t i = 0; i < parts[0].n && !agg_output_done(&out); i++)
+        {
+            agg_emit(&out, &groups[i]);
+        }
+        sink_close(&sink);
+    }
+    else
     {
-        printf("%d,%d\n", row.a, row.b);
-        return true;
+        fprintf(stderr, "WARN: out of memory grouping %d rows\n", nsel);
     }
+    STATS_PHASE_END(STATS_PHASE_OUTPUT);
+
+    clock_t after = clock();
+    printf("---- Cost %ldus(%.2fms) to group %d rows into %u groups ----\n",
+            after-before, ((float)after-(float)before)/1000.0F, nsel, merged ? parts[0].n : 0);
 
-    return false;
+    for (int t = 0; t < nthreads; t++)
+    {
+        agg_free(&parts[t]);
+    }
+    free(parts);
+    free(ok);
 }
 
 /**
@@ -116,22 +219,266 @@ bool task1_handle(Row row)
  *           1000,23
  *           2000,16
  *
- * @param rows The total number of rows.
- * @param nrows The rows, for example rows[0] is the first row.
+ * @param table The columnar table, for example table->a[0] is `a` of the first row.
+ * @param query The parsed WHERE expression, the default is DEFAULT_QUERY.
  */
-void task1(const Row *rows, int nrows)
+void task1(const Table *table, const Query *query)
 {
-    scan_process(rows, nrows, task1_handle);
+    int *sel = arena_alloc(&query_arena, sizeof(int)*(table->nrows > 0 ? table->nrows : 1));
+    if (!sel)
+    {
+        return;
+    }
+
+    // Generic row at a time evaluation works for every query.
+    QueryEnv query_env = { query, table->a, table->b };
+    ZoneScan scan = { zone_map, zone_test_query, query, query_env_select, &query_env };
+
+    int a_in[FILTER_MAX_IN_LIST];
+    ScanPredicate pred;
+    FilterEnv filter_env = { &pred, table->a, table->b };
+
+    JitKernel kernel = { 0 };
+    JitEnv jit_env = { NULL, table->a, table->b };
+    char err[PATH_MAX + 64];
+
+    PackedEnv packed_env = { 0 };
+    packed_env.table = packed_table;
+    packed_env.query = query;
+
+    BitmapEnv bitmap_env = { bitmap_index, &pred, table->b, zone_map };
+
+    InListEnv inlist_env = { query->ngroups == 1 ? &query->groups[0] : NULL, table->a, table->b };
+
+    const char *use_jit = getenv("MATRIXDB_JIT");
+    if (bitmap_index && table->b && filter_from_query(query, &pred, a_in, FILTER_MAX_IN_LIST) && pred.a_in)
+    {
+        // IN-lists OR the bitmaps of their values, b is read for those rows
+        // only, the zone map is consulted inside.
+        scan.map = NULL;
+        scan.select = bitmap_env_select;
+        scan.env = &bitmap_env;
+    }
+    else if (packed_table)
+    {
+        // Predicates run on the packed codes, other queries on decoded blocks.
+        scan.select = packed_query_select;
+        scan.env = &packed_env;
+        if (filter_from_query(query, &pred, a_in, FILTER_MAX_IN_LIST))
+        {
+            packed_ranges_of(&pred, &packed_env.a, &packed_env.b);
+            scan.may_match = zone_test_predicate;
+            scan.test_env = &pred;
+            scan.select = packed_env_select;
+        }
+    }
+    else if (use_jit && strcmp(use_jit, "0") != 0)
+    {
+        // MATRIXDB_JIT=1 compiles the query into a specialized scan loop.
+        if (jit_compile(query, &kernel, err, sizeof(err)))
+        {
+            jit_env.scan = kernel.scan;
+            scan.select = jit_env_select;
+            scan.env = &jit_env;
+        }
+        else
+        {
+            fprintf(stderr, "WARN: %s, falling back to the interpreted scan\n", err);
+        }
+    }
+
+    if (scan.env == &query_env && filter_from_query(query, &pred, a_in, FILTER_MAX_IN_LIST))
+    {
+        // IN-list and range shaped queries go to the SIMD filter kernel,
+        // resolve it before the threads race on it.
+        filter_select(&pred, table->a, table->b, 0, 0, sel);
+        scan.may_match = zone_test_predicate;
+        scan.test_env = &pred;
+        scan.select = filter_env_select;
+        scan.env = &filter_env;
+    }
+    else if (scan.env == &query_env && inlist_env.group)
+    {
+        // Longer IN-lists of one b range probe the InList of the query.
+        scan.select = inlist_env_select;
+        scan.env = &inlist_env;
+    }
+
+    clock_t before = clock();
+    int found = scan_process(table, &scan, sel);
+    int accepted_cnt = found;
+
+#ifdef VERIFY_FILTER
+    // gcc -DVERIFY_FILTER cross checks the chosen scan with the scalar path.
+    int *expect = malloc(sizeof(int)*(table->nrows > 0 ? table->nrows : 1));
+    int expect_cnt = query_env_select(&query_env, 0, table->nrows, expect);
+    if (expect_cnt != found || memcmp(expect, sel, sizeof(int)*found) != 0)
+    {
+        fprintf(stderr, "VERIFY: scan found %d rows, scalar found %d rows\n", found, expect_cnt);
+        abort();
+    }
+    free(expect);
+#endif
+    if (query->group_by_a)
+    {
+        group_process(table, query, sel, found);
+        print_cost(before, table->nrows, accepted_cnt);
+        jit_unload(&kernel);
+        return;
+    }
+
+    // LIMIT k OFFSET n keeps sel[n, n+k), rows are in table order here.
+    int first = 0;
+    if (query->limit >= 0)
+    {
+        int64_t end = query_limit_end(query);
+        first = query->offset < found ? (int)query->offset : found;
+        found = end < found ? (int)end : found;
+    }
+
+    // large results are formatted by all threads and written in order.
+    STATS_PHASE_BEGIN(STATS_PHASE_OUTPUT);
+    ResultSink sink;
+    if (sink_init(&sink, STDOUT_FILENO) && packed_table)
+    {
+        // only the accepted rows are decoded
+        Row *rows = arena_alloc(&query_arena, sizeof(Row)*(found - first > 0 ? found - first : 1));
+        if (rows)
+        {
+            packed_gather_rows(packed_table, sel + first, found - first, rows);
+            sink_rows(&sink, rows, found - first, parallel_threads());
+        }
+    }
+    else if (sink.buf)
+    {
+        sink_select(&sink, table->a, table->b, sel + first, found - first, parallel_threads());
+    }
+    sink_close(&sink);
+    STATS_PHASE_END(STATS_PHASE_OUTPUT);
+    print_cost(before, table->nrows, accepted_cnt);
+
+    jit_unload(&kernel);
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
-    // Generate dataset to verify given solutions.
-    Row* rows = generate_seed(N_ROWS);
+    STATS_INIT();
+    arena_init(&query_arena);
+
+    // The WHERE expression comes from the command line, @path reads it
+    // from a file, see parser.h.
+    char err[256];
+    Query *query = query_parse_arg(argc > 1 ? argv[1] : DEFAULT_QUERY, &query_arena, err, sizeof(err));
+    if (!query)
+    {
+        fprintf(stderr, "invalid query: %s\n", err);
+        return 1;
+    }
+    if (query->limit_by_a)
+    {
+        // the table is scanned in its own order, the rows of an a are not
+        // consecutive.
+        fprintf(stderr, "invalid query: LIMIT ... BY a needs rows ordered by a\n");
+        return 1;
+    }
+
+    // MATRIXDB_TABLE=path maps the columns from a table file, the file
+    // is written from the generated seed when it does not exist yet.
+    STATS_PHASE_BEGIN(STATS_PHASE_LOAD);
+    const char *table_path = getenv("MATRIXDB_TABLE");
+    TableFile *table_file = NULL;
+    Table* table = NULL;
+    char ferr[PATH_MAX + 64];
+    if (table_path && access(table_path, F_OK) == 0)
+    {
+        table_file = tablefile_load(table_path, TABLE_LAYOUT_COLUMNS, ferr, sizeof(ferr));
+        if (!table_file)
+        {
+            fprintf(stderr, "%s\n", ferr);
+            return 1;
+        }
+        table = tablefile_table(table_file);
+    }
+    else
+    {
+        // Generate dataset to verify given solutions.
+        table = generate_seed(N_ROWS);
+        if (table && table_path && !tablefile_write_table(table_path, table, ferr, sizeof(ferr)))
+        {
+            fprintf(stderr, "WARN: %s\n", ferr);
+        }
+    }
+    if (!table)
+    {
+        return 1;
+    }
+
+    // MATRIXDB_ZONEMAP=0 scans every block, a table file has its zones
+    // in the block index.
+    const char *use_zones = getenv("MATRIXDB_ZONEMAP");
+    if (!use_zones || strcmp(use_zones, "0") != 0)
+    {
+        zone_map = table_file ? tablefile_zonemap(table_file) : zonemap_build(table);
+    }
+    STATS_PHASE_END(STATS_PHASE_LOAD);
+
+    // MATRIXDB_BITMAP=1 indexes the rows of every value of a.
+    const char *use_bitmap = getenv("MATRIXDB_BITMAP");
+    if (use_bitmap && strcmp(use_bitmap, "0") != 0)
+    {
+        clock_t before = clock();
+        bitmap_index = bitmap_index_build(table->a, table->nrows);
+        clock_t after = clock();
+        if (bitmap_index)
+        {
+            printf("---- Cost %ldus(%.2fms) to index %d values of a in %zu bytes. ----\n",
+                    after-before, ((float)after-(float)before)/1000.0F,
+                    bitmap_index->nvalues, bitmap_index->bytes);
+        }
+        else
+        {
+            fprintf(stderr, "WARN: column a is not indexed, too many distinct values\n");
+        }
+    }
+
+    // MATRIXDB_COMPRESS=1 scans a compressed copy, the raw columns of a
+    // generated table are released.
+    const char *use_compress = getenv("MATRIXDB_COMPRESS");
+    if (use_compress && strcmp(use_compress, "0") != 0)
+    {
+        clock_t before = clock();
+        packed_table = packed_table_build(table);
+        clock_t after = clock();
+        if (packed_table)
+        {
+            printf("---- Cost %ldus(%.2fms) to pack %zu bytes into %zu bytes. ----\n",
+                    after-before, ((float)after-(float)before)/1000.0F,
+                    2*sizeof(int)*(size_t)table->nrows, packed_table_size(packed_table));
+#ifndef VERIFY_FILTER
+            if (table->owned)
+            {
+                free(table->a);
+                free(table->b);
+                table->a = table->b = NULL;
+            }
+#endif
+        }
+    }
+
+    STATS_PHASE_BEGIN(STATS_PHASE_QUERY);
+    task1(table, query);
+    STATS_PHASE_END(STATS_PHASE_QUERY);
 
-    task1(rows, N_ROWS);
+    // The query is done, everything it allocated is released at once.
+    arena_reset(&query_arena);
 
     // Destroy generated dataset.
-    free(rows);
+    zonemap_free(zone_map);
+    packed_table_free(packed_table);
+    bitmap_index_free(bitmap_index);
+    table_free(table);
+    tablefile_close(table_file);
+    arena_destroy(&query_arena);
+    STATS_REPORT();
 }
  
\ No newline at end of file
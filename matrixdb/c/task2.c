@@ -3,6 +3,17 @@
 #include <time.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <string.h>
+
+#include "row.h"
+#include "search.h"
+#include "eytzinger.h"
+#include "parser.h"
+#include "arena.h"
+#include "sink.h"
+#include "tablefile.h"
+#include "agg.h"
 
 /* 
  * When generate a Row,
@@ -18,26 +29,18 @@
 // Number of rows that generated for testing.
 #define N_ROWS 4000000
 
-/**
- * @brief 
- * 
- */
-typedef struct Row {
-    int a;
-    int b;
-} Row;
 
-typedef struct RangeSlice {
-    Row left;
-    Row right;
-} RangeSlice;
+// WHERE expression used when none is given on the command line.
+#define DEFAULT_QUERY "a IN (1000, 2000, 3000) AND b >= 10 AND b < 50"
+
+// Query scoped allocations, released at once when the query is done.
+Arena query_arena;
 
+// Buffered writer of the result rows, see sink.h.
+ResultSink result_sink;
 
-RangeSlice range_slices[] = {
-    {{1000,10}, {1000,50}},
-    {{2000,10}, {2000,50}},
-    {{3000,10}, {3000,50}},
-};
+// Optional cache friendly layout used to locate slices, see MATRIXDB_EYTZINGER.
+Eytzinger* slice_index = NULL;
 
 
 /**
@@ -72,242 +75,182 @@ Row* generate_seed(int nrows)
 }
 
 /**
- * @brief Compare row1 and row2 for binary search/compare.
- * 
- * @param row1 left argument of the comparison.
- * @param row2 right argument of the comparison.
- * @return 0 when row1 == row2 if
- *         row1.a == row2.a and row1.b == row2.b
- * @return 1 when row1 > row2 if
- *         (row1.a > row2.a) || (row1.a >= row2.a && row1.b > row2.b)
- * @return 2 when row1 < row2 if
- *         (row1.a < row2.a) || (row1.a <= row2.a && row1.b < row2.b)
- * @return 3 for undefined, should print warning.
- */
-uint8_t compare(Row row1, Row row2)
-{
-    if (row1.a == row2.a && row1.b == row2.b)
-    {
-        // printf("DEBUG: (%d,%d)==(%d,%d)\n", row1.a, row1.b, row2.a, row2.b);
-        return 0;
-    }
-
-    if ((row1.a > row2.a) || (row1.a >= row2.a && row1.b > row2.b))
-    {
-        // printf("DEBUG: (%d,%d)>(%d,%d)\n", row1.a, row1.b, row2.a, row2.b);
-        return 1;
-    }
-
-    if ((row1.a < row2.a) || (row1.a <= row2.a && row1.b < row2.b))
-    {
-        // printf("DEBUG: (%d,%d)<(%d,%d)\n", row1.a, row1.b, row2.a, row2.b);
-        return 2;
-    }
-
-    return 3;
-}
-
-/**
- * @brief Search for left most position for binary search.
- * 
- * @param rows Rows
- * @param nrows number of rows
- * @return int index of the left most row
+ * @brief Map the rows of the table file at path, see tablefile.h.
+ *
+ * @return TableFile* the file, NULL when it cannot be used.
  */
-int search_left_most_rowidx(const Row *rows, int nrows, 
-                        int low, int high, Row range_right)
+TableFile* open_table(const char *path)
 {
-    int mid = low+(high-low)/2;
-
-    // printf("DEBUG: right_index(%d,%d) nrows(%d) low(%d) mid(%d) high(%d)\n", range_right.a, range_right.b, nrows, low, mid, high);
+    clock_t before = clock();
 
-    // not found
-    if (low == high && low == (nrows-1) && 
-            compare(rows[high], range_right) != 0)
+    char err[PATH_MAX + 64];
+    TableFile *file = tablefile_load(path, TABLE_LAYOUT_ROWS, err, sizeof(err));
+    if (!file)
     {
-        return nrows;
+        fprintf(stderr, "%s\n", err);
+        return NULL;
     }
-
-    if (high >= nrows || low >= high)
+    if (file->header->sort_order != TABLE_SORT_AB)
     {
-        return low;
+        fprintf(stderr, "WARN: %s is not sorted by (a,b), slices may miss rows\n", path);
     }
 
-    /*
-    if (low == high && low == nrows - 1 && 
-            compare(rows[nrows-1], range_right) != 0)
-    {
-        return nrows;
-    }
-    */
-
-    do
-    {
-        // mid == range_right
-        if (compare(rows[mid], range_right)==0)
-        {
-            // FIXME, cannot handle duplicate rows?
-            // congras, found exact index for range_right
-            return mid;
-        }
-
-        // mid > range_right
-        if (compare(rows[mid], range_right) == 1)
-        {
-            return search_left_most_rowidx(rows, nrows, 
-                low, mid-1, range_right);
-        }
-
-        // mid < range_right
-        if (compare(rows[mid], range_right) == 2)
-        {
-            return search_left_most_rowidx(rows, nrows, 
-                mid+1, high, range_right);
-        }
+    clock_t after = clock();
 
-    } while (mid > low);
+    printf("---- Cost %ldus(%.2fms) to open the table file. ----\n", 
+            after-before, ((float)after-(float)before)/1000.0F);
 
-    return low;
+    return file;
 }
 
 /**
- * @brief Search for right most postition for binary search.
+ * @brief Scan the slices of query over given rows.
  * 
- * @param rows rows
- * @param nrows number of rows
- * @return int index of the right most row
+ * @param rows Rows contain part or all dataset sorted by (a,b), see Row for more details.
+ * @param nrows Number of input rows.
+ * @param query Parsed query, its slices are sorted and disjoint so every
+ *              row is visited at most once, see parser.h.
+ * @param handle A callback receives every accepted row in (a,b) order.
+ *               You can pass a NULL handle to only count the rows.
+ * @return How many rows that accepted by the processor
  */
-int search_right_most_rowidx(const Row *rows, int nrows, 
-                        int low, int high, Row range_left)
+int scan_process(const Row* rows, int nrows, const Query *query, void(*handle)(Row))
 {
-    int mid = low+(high-low)/2;
-
-    // printf("DEBUG: left_index(%d,%d) nrows(%d) low(%d) mid(%d) high(%d)\n", range_left.a, range_left.b, nrows, low, mid, high);
-
-    // not found
-    if (low == high && low == (nrows-1) && compare(rows[high], range_left) != 0)
+    clock_t before = clock();
+    if (!rows || !query)
     {
-        // printf("DEBUG: left_index(%d,%d) not found nrows(%d) low(%d) mid(%d) high(%d)\n", range_left.a, range_left.b, nrows, low, mid, high);
         return 0;
     }
 
-    if (low > high)
-    {
-        // not found
-        return 0;
-    }
+    int accepted_cnt = 0;
+    // rows go out in (a,b) order, a LIMIT ends the scan early
+    QueryLimit limit = { query, 0, 0 };
 
-    while(mid < high)
+    // the slice searches are timed in aggregate, one SEARCH per query
+    STATS_TIMER(search);
+    STATS_PHASE_BEGIN(STATS_PHASE_SCAN);
+    for (int i = 0; i < query->nslices && !query_limit_done(&limit); i++)
     {
-        // mid == range_right
-        if (compare(rows[mid], range_left)==0)
-        {
-            // FIXME, cannot handle duplicate rows?
-            // congras, found exact index for range_right
-            return mid;
-        }
-
-        // mid > range_right
-        if (compare(rows[mid], range_left) == 1)
+        RangeSlice slice = query->slices[i];
+        // rows[left_idx, right_idx) are exactly the rows in [slice.left, slice.right)
+        int left_idx, right_idx;
+        STATS_TIMER_START(search);
+        eytzinger_slice_range(slice_index, rows, nrows, slice, &left_idx, &right_idx);
+        STATS_TIMER_STOP(search);
+
+        if (slice.covered && query->limit < 0)
         {
-            // printf("DEBUG: (%d,%d)>left_index(%d,%d) nrows(%d) low(%d) mid(%d) high(%d)\n", 
-            //    rows[mid].a, rows[mid].b, range_left.a, range_left.b, nrows, low, mid, high);
-            return search_right_most_rowidx(rows, nrows, 
-                low, mid-1, range_left);
+            // every row of a covered slice satisfies the query
+            for (int j = left_idx; j < right_idx && handle; j++)
+            {
+                handle(rows[j]);
+            }
+            accepted_cnt += right_idx - left_idx;
+            STATS_COUNT(STATS_ROWS_EXAMINED, right_idx - left_idx);
+            continue;
         }
 
-        // mid < range_right
-        if (compare(rows[mid], range_left) == 2)
+        int j;
+        for (j = left_idx; j < right_idx && !query_limit_done(&limit); j++)
         {
-            // printf("DEBUG: (%d,%d)<left_index(%d,%d) nrows(%d) low(%d) mid(%d) high(%d)\n", 
-            //    rows[mid].a, rows[mid].b, range_left.a, range_left.b, nrows, low, mid, high);
-            return search_right_most_rowidx(rows, nrows, 
-                mid+1, high, range_left);
+            if ((slice.covered || query_match(query, rows[j])) && query_limit_keep(&limit, rows[j]))
+            {
+                if (handle)
+                {
+                    handle(rows[j]);
+                }
+                accepted_cnt++;
+            }
         }
+        STATS_COUNT(STATS_ROWS_EXAMINED, j - left_idx);
     }
-    
+    STATS_PHASE_END(STATS_PHASE_SCAN);
+    STATS_PHASE_ADD(STATS_PHASE_SEARCH, search);
+    STATS_COUNT(STATS_ROWS_ACCEPTED, accepted_cnt);
+
+    // rows go out before the cost line
+    STATS_PHASE_BEGIN(STATS_PHASE_OUTPUT);
+    sink_flush(&result_sink);
+    STATS_PHASE_END(STATS_PHASE_OUTPUT);
+
+    clock_t after = clock();
+
+    printf("---- Cost: %ldus(%.2fms) Total(%d) Found(%d) ----\n", 
+            after-before, ((float)after-(float)before)/1000.0F, nrows , accepted_cnt);
 
-    return high;
+    return accepted_cnt;
 }
 
 /**
- * @brief Scan given rows with specific handler.
- * 
- * @param rows Rows contain part or all dataset, see Row for more details.
- * @param nrows Number of input rows.
- * @param handle A callback function to let the scanner to 
- *               know whether a row is accepted, callback function
- *               returns true when the scanned row need to be kept,
- *               otherwise return false to remove a scanned row.
- *               You can pass a NULL handle to reject all rows.
- * @return How many rows that accepted by the processor
+ * @brief GROUP BY a over the slices of query. Rows of a slice are sorted
+ *        by a, runs of equal a are aggregated without hashing and the
+ *        groups stream out in a order, a LIMIT ends the scan early.
+ *
+ * @return Number of groups.
  */
-int scan_process(const Row* rows, int nrows, uint8_t(*handle)(Row))
+int group_process(const Row* rows, int nrows, const Query *query)
 {
     clock_t before = clock();
-    if (!rows)
-    {
-        return 0;
-    }
 
-    int accepted_cnt = 0;
+    AggOutput out = { &result_sink, query->offset, query_limit_end(query), 0 };
+    AggRun run = { { 0 }, &out };
+    Row batch[AGG_BATCH];
 
-    int n_slices = sizeof(range_slices)/sizeof(RangeSlice);
-    int finished_idx = -1;
-    for (int i = 0; i< n_slices; i++)
+    STATS_TIMER(search);
+    STATS_PHASE_BEGIN(STATS_PHASE_GROUP);
+    for (int i = 0; i < query->nslices && !agg_output_done(&out); i++)
     {
-        RangeSlice slice = range_slices[i];
-        Row range_left = slice.left;
-        Row range_right = slice.right;
-        // --right most-->|left_index  right_index|<--left most---
-        int right_idx = search_left_most_rowidx(rows, nrows, 0, nrows-1, range_right);
-        int left_idx = search_right_most_rowidx(rows, nrows, 0, nrows-1, range_left);
-        right_idx = right_idx < 0 ? 0 : right_idx;
-        left_idx = left_idx < 0 ? 0 : left_idx;
-        
-        /*
-        printf("DEBUG: (%d,%d)[%d]->(%d,%d)[%d]  finished(%d)\n", 
-                range_left.a, range_left.b, left_idx, 
-                range_right.a, range_right.b, right_idx, finished_idx);
-        */
-       
-        for (int j = left_idx; j <= right_idx && j>=0 && j<nrows; j++)
+        RangeSlice slice = query->slices[i];
+        int left_idx, right_idx;
+        STATS_TIMER_START(search);
+        eytzinger_slice_range(slice_index, rows, nrows, slice, &left_idx, &right_idx);
+        STATS_TIMER_STOP(search);
+        STATS_COUNT(STATS_ROWS_EXAMINED, right_idx - left_idx);
+
+        if (slice.covered)
+        {
+            agg_run_rows(&run, rows + left_idx, right_idx - left_idx);
+            continue;
+        }
+
+        // matching rows keep their order, they are aggregated in batches
+        int n = 0;
+        for (int j = left_idx; j < right_idx; j++)
         {
-            if (handle && j > finished_idx && handle(rows[j]))
+            batch[n] = rows[j];
+            n += query_match(query, rows[j]);
+            if (n == AGG_BATCH)
             {
-                finished_idx = j;
-                accepted_cnt++;
+                agg_run_rows(&run, batch, n);
+                n = 0;
             }
-            // printf("DEBUG: handled (%d,%d)[%d] finished_at(%d)\n", rows[j].a, rows[j].b, j, finished_idx);
         }
+        agg_run_rows(&run, batch, n);
     }
+    agg_run_finish(&run);
+    STATS_PHASE_END(STATS_PHASE_GROUP);
+    STATS_PHASE_ADD(STATS_PHASE_SEARCH, search);
+
+    STATS_PHASE_BEGIN(STATS_PHASE_OUTPUT);
+    sink_flush(&result_sink);
+    STATS_PHASE_END(STATS_PHASE_OUTPUT);
 
     clock_t after = clock();
 
-    printf("---- Cost: %ldus(%.2fms) Total(%d) Found(%d) ----\n", 
-            after-before, ((float)after-(float)before)/1000.0F, nrows , accepted_cnt);
+    printf("---- Cost: %ldus(%.2fms) Total(%d) Groups(%lld) ----\n",
+            after-before, ((float)after-(float)before)/1000.0F, nrows, (long long)out.rank);
 
-    return accepted_cnt;
+    return (int)out.rank;
 }
 
 /**
- * @brief Handle Row according to task1.
+ * @brief Handle a Row accepted by the query.
  * 
  * @param row immutable object for all row.
- * @return 0 row is accepted
- * @return 1 move to left
- * @return 2 move to right
  */
-uint8_t task2_handle(Row row)
+void task2_handle(Row row)
 {
-    // a in (1000, 2000, 3000) and b between 10 and 50
-    if ((row.a == 1000 || row.a == 2000 || row.a == 3000) && row.b >= 10 && row.b < 50)
-    {
-        printf("%d,%d\n", row.a, row.b);
-        return true;
-    }
-
-    return false;
+    sink_row(&result_sink, row.a, row.b);
 }
 
 /**
@@ -321,16 +264,65 @@ uint8_t task2_handle(Row row)
  *
  * @param rows The total number of rows.
  * @param nrows The rows, for example rows[0] is the first row.
+ * @param query The parsed WHERE expression, the default is DEFAULT_QUERY.
  */
-void task2(const Row *rows, int nrows)
+void task2(const Row *rows, int nrows, const Query *query)
 {
-    scan_process(rows, nrows, task2_handle);
+    if (query->group_by_a)
+    {
+        group_process(rows, nrows, query);
+        return;
+    }
+
+    scan_process(rows, nrows, query, task2_handle);
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
-    // Generate dataset to verify given solutions.
-    Row* rows = generate_seed(N_ROWS);
+    if (!sink_init(&result_sink, STDOUT_FILENO))
+    {
+        return 1;
+    }
+
+    STATS_INIT();
+    arena_init(&query_arena);
+
+    // The WHERE expression comes from the command line, @path reads it
+    // from a file, see parser.h.
+    char err[256];
+    Query *query = query_parse_arg(argc > 1 ? argv[1] : DEFAULT_QUERY, &query_arena, err, sizeof(err));
+    if (!query)
+    {
+        fprintf(stderr, "invalid query: %s\n", err);
+        return 1;
+    }
+
+    // MATRIXDB_TABLE=path maps the rows from a table file, the file is
+    // written from the generated seed when it does not exist yet.
+    STATS_PHASE_BEGIN(STATS_PHASE_LOAD);
+    const char *table_path = getenv("MATRIXDB_TABLE");
+    TableFile *table_file = NULL;
+    Row *seed = NULL;
+    if (table_path && access(table_path, F_OK) == 0)
+    {
+        table_file = open_table(table_path);
+        if (!table_file)
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        // Generate dataset to verify given solutions.
+        seed = generate_seed(N_ROWS);
+        char werr[PATH_MAX + 64];
+        if (table_path && !tablefile_write_rows(table_path, seed, N_ROWS, werr, sizeof(werr)))
+        {
+            fprintf(stderr, "WARN: %s\n", werr);
+        }
+    }
+    const Row *rows = table_file ? table_file->rows : seed;
+    int nrows = table_file ? (int)table_file->header->nrows : N_ROWS;
 
     /*
     Row rows[] = {
@@ -343,18 +335,35 @@ int main(void)
     };
     */
 
+    // Build the Eytzinger layout once after the load when asked for.
+    if (getenv("MATRIXDB_EYTZINGER"))
+    {
+        slice_index = eytzinger_build(rows, nrows);
+    }
+    STATS_PHASE_END(STATS_PHASE_LOAD);
+
     // Execute task1
-    task2(rows, N_ROWS);
+    STATS_PHASE_BEGIN(STATS_PHASE_QUERY);
+    task2(rows, nrows, query);
+    STATS_PHASE_END(STATS_PHASE_QUERY);
+
+    // The query is done, everything it allocated is released at once.
+    arena_reset(&query_arena);
 
     /*
     Row range_left  = {2000,10};
     Row range_right = {2000,50};
 
     printf("(%d,%d)[%d]->(%d,%d)[%d]\n", 
-            range_left.a, range_left.b, search_right_most_rowidx(rows, 6, 0, 5, range_left),
-            range_right.a, range_right.b, search_left_most_rowidx(rows, 6, 0, 5, range_right));
+            range_left.a, range_left.b, rows_lower_bound(rows, 6, row_key(range_left)),
+            range_right.a, range_right.b, rows_lower_bound(rows, 6, row_key(range_right)));
     */
     // Destroy generated dataset.
-    free(rows);
+    eytzinger_free(slice_index);
+    arena_destroy(&query_arena);
+    sink_close(&result_sink);
+    free(seed);
+    tablefile_close(table_file);
+    STATS_REPORT();
 }
  
\ No newline at end of file
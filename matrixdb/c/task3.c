@@ -3,6 +3,19 @@
 #include <time.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <string.h>
+
+#include "row.h"
+#include "search.h"
+#include "eytzinger.h"
+#include "parser.h"
+#include "arena.h"
+#include "sink.h"
+#include "tablefile.h"
+#include "sort.h"
+#include "merge.h"
+#include "topk.h"
 
 /* 
  * When generate a Row,
@@ -18,37 +31,32 @@
 // Number of rows that generated for testing.
 #define N_ROWS 4000000
 
-/**
- * @brief 
- * 
- */
-typedef struct Row {
-    int a;
-    int b;
-} Row;
-
-// range slice for config the [left, right)
-typedef struct RangeSlice {
-    Row left;
-    Row right;
-} RangeSlice;
-
-typedef struct Node Node;
-// Linked list for ordering b column
-typedef struct Node {
-    Row   value;
-    Node* next;
-} Node;
-
-RangeSlice range_slices[] = {
-    {{1000,10}, {1000,50}},
-    {{2000,10}, {2000,50}},
-    {{3000,10}, {3000,50}},
-};
-
-Node* ordered_rows = NULL;
-Node* ordered_rows_tail = NULL;
-int ordered_rows_count = 0;
+// WHERE expression used when none is given on the command line.
+#define DEFAULT_QUERY "a IN (1000, 2000, 3000) AND b >= 10 AND b < 50"
+
+// Query scoped allocations, released at once when the query is done.
+Arena query_arena;
+
+// Buffered writer of the result rows, see sink.h.
+ResultSink result_sink;
+
+// Optional cache friendly layout used to locate slices, see MATRIXDB_EYTZINGER.
+Eytzinger* slice_index = NULL;
+
+// Accepted rows, sorted by b before they are printed.
+RowVec ordered_rows = { NULL, 0, 0, &query_arena };
+
+// The first rows by b when the query has a LIMIT, instead of ordered_rows.
+TopK top_rows;
+
+// Query of the running scan, its LIMIT applies to the accepted rows.
+const Query* ordered_query = NULL;
+
+// Rows of every a kept so far, for LIMIT ... BY a.
+QueryLimit group_limit;
+
+// Set when accepted rows could not be kept, the result is incomplete.
+bool ordered_failed = false;
 
 /**
  * @brief Function used to generate large seeds for performance testing.
@@ -82,237 +90,259 @@ Row* generate_seed(int nrows)
 }
 
 /**
- * @brief Compare row1 and row2 for binary search/compare.
- * 
- * @param row1 left argument of the comparison.
- * @param row2 right argument of the comparison.
- * @return 0 when row1 == row2 if
- *         row1.a == row2.a and row1.b == row2.b
- * @return 1 when row1 > row2 if
- *         (row1.a > row2.a) || (row1.a >= row2.a && row1.b > row2.b)
- * @return 2 when row1 < row2 if
- *         (row1.a < row2.a) || (row1.a <= row2.a && row1.b < row2.b)
- * @return 3 for undefined, should print warning.
+ * @brief Map the rows of the table file at path, see tablefile.h.
+ *
+ * @return TableFile* the file, NULL when it cannot be used.
  */
-uint8_t compare(Row row1, Row row2)
+TableFile* open_table(const char *path)
 {
-    if (row1.a == row2.a && row1.b == row2.b)
-    {
-        // printf("DEBUG: (%d,%d)==(%d,%d)\n", row1.a, row1.b, row2.a, row2.b);
-        return 0;
-    }
+    clock_t before = clock();
 
-    if ((row1.a > row2.a) || (row1.a >= row2.a && row1.b > row2.b))
+    char err[PATH_MAX + 64];
+    TableFile *file = tablefile_load(path, TABLE_LAYOUT_ROWS, err, sizeof(err));
+    if (!file)
     {
-        // printf("DEBUG: (%d,%d)>(%d,%d)\n", row1.a, row1.b, row2.a, row2.b);
-        return 1;
+        fprintf(stderr, "%s\n", err);
+        return NULL;
     }
-
-    if ((row1.a < row2.a) || (row1.a <= row2.a && row1.b < row2.b))
+    if (file->header->sort_order != TABLE_SORT_AB)
     {
-        // printf("DEBUG: (%d,%d)<(%d,%d)\n", row1.a, row1.b, row2.a, row2.b);
-        return 2;
+        fprintf(stderr, "WARN: %s is not sorted by (a,b), slices may miss rows\n", path);
     }
 
-    return 3;
+    clock_t after = clock();
+
+    printf("---- Cost %ldus(%.2fms) to open the table file. ----\n", 
+            after-before, ((float)after-(float)before)/1000.0F);
+
+    return file;
 }
 
 /**
- * @brief Search for left most position for binary search.
- * 
- * @param rows Rows
- * @param nrows number of rows
- * @return int index of the left most row
+ * @brief Sort the accepted rows by b and print them, rows with the
+ *        same b keep their (a,b) scan order.
+ *
+ * @return How many rows were printed.
  */
-int search_left_most_rowidx(const Row *rows, int nrows, 
-                        int low, int high, Row range_right)
+int print_ordered_rows()
 {
-    int mid = low+(high-low)/2;
-
-    // printf("DEBUG: right_index(%d,%d) nrows(%d) low(%d) mid(%d) high(%d)\n", range_right.a, range_right.b, nrows, low, mid, high);
-
-    // not found
-    if (low == high && low == (nrows-1) && 
-            compare(rows[high], range_right) != 0)
+    Row *rows = ordered_rows.rows;
+    int n = ordered_rows.n > top_rows.n ? ordered_rows.n : top_rows.n;
+    Row *scratch = arena_alloc(&query_arena, sizeof(Row)*(n > 0 ? n : 1));
+    if (!scratch)
     {
-        return nrows;
+        ordered_failed = true;
+        return 0;
     }
 
-    if (high >= nrows || low >= high)
+    STATS_PHASE_BEGIN(STATS_PHASE_SORT);
+    if (top_rows.cap > 0)
     {
-        return low;
+        n = topk_finish(&top_rows, scratch);
+        rows = scratch;
     }
-
-    /*
-    if (low == high && low == nrows - 1 && 
-            compare(rows[nrows-1], range_right) != 0)
+    else
     {
-        return nrows;
+        sort_rows_by_b(rows, n, scratch, &query_arena);
     }
-    */
+    STATS_PHASE_END(STATS_PHASE_SORT);
 
-    do
+    // LIMIT k OFFSET n, a LIMIT ... BY a was applied while collecting
+    int begin = 0;
+    if (ordered_query && ordered_query->limit >= 0 && !ordered_query->limit_by_a)
     {
-        // mid == range_right
-        if (compare(rows[mid], range_right)==0)
-        {
-            // FIXME, cannot handle duplicate rows?
-            // congras, found exact index for range_right
-            return mid;
-        }
-
-        // mid > range_right
-        if (compare(rows[mid], range_right) == 1)
-        {
-            return search_left_most_rowidx(rows, nrows, 
-                low, mid-1, range_right);
-        }
-
-        // mid < range_right
-        if (compare(rows[mid], range_right) == 2)
-        {
-            return search_left_most_rowidx(rows, nrows, 
-                mid+1, high, range_right);
-        }
-
-    } while (mid > low);
+        int64_t end = query_limit_end(ordered_query);
+        begin = ordered_query->offset < n ? (int)ordered_query->offset : n;
+        n = end < n ? (int)end : n;
+    }
 
-    return low;
+    STATS_PHASE_BEGIN(STATS_PHASE_OUTPUT);
+    sink_rows(&result_sink, rows + begin, n - begin, parallel_threads());
+    STATS_PHASE_END(STATS_PHASE_OUTPUT);
+    return n - begin;
 }
 
 /**
- * @brief Search for right most postition for binary search.
+ * @brief Scan the slices of query over given rows.
  * 
- * @param rows rows
- * @param nrows number of rows
- * @return int index of the right most row
+ * @param rows Rows contain part or all dataset sorted by (a,b), see Row for more details.
+ * @param nrows Number of input rows.
+ * @param query Parsed query, its slices are sorted and disjoint so every
+ *              row is visited at most once, see parser.h.
+ * @param handle A callback receives every accepted row in (a,b) order.
+ *               You can pass a NULL handle to only count the rows.
+ * @return How many rows that accepted by the processor
  */
-int search_right_most_rowidx(const Row *rows, int nrows, 
-                        int low, int high, Row range_left)
+int scan_process(const Row* rows, int nrows, const Query *query, void(*handle)(Row))
 {
-    int mid = low+(high-low)/2;
-
-    // printf("DEBUG: left_index(%d,%d) nrows(%d) low(%d) mid(%d) high(%d)\n", range_left.a, range_left.b, nrows, low, mid, high);
-
-    // not found
-    if (low == high && low == (nrows-1) && compare(rows[high], range_left) != 0)
+    clock_t before = clock();
+    if (!rows || !query)
     {
-        // printf("DEBUG: left_index(%d,%d) not found nrows(%d) low(%d) mid(%d) high(%d)\n", range_left.a, range_left.b, nrows, low, mid, high);
         return 0;
     }
 
-    if (low > high)
-    {
-        // not found
-        return 0;
-    }
+    int accepted_cnt = 0;
 
-    while(mid < high)
+    // the slice searches are timed in aggregate, one SEARCH per query
+    STATS_TIMER(search);
+    STATS_PHASE_BEGIN(STATS_PHASE_SCAN);
+    for (int i = 0; i < query->nslices; i++)
     {
-        // mid == range_right
-        if (compare(rows[mid], range_left)==0)
+        RangeSlice slice = query->slices[i];
+        // rows[left_idx, right_idx) are exactly the rows in [slice.left, slice.right)
+        int left_idx, right_idx;
+        STATS_TIMER_START(search);
+        eytzinger_slice_range(slice_index, rows, nrows, slice, &left_idx, &right_idx);
+        STATS_TIMER_STOP(search);
+        STATS_COUNT(STATS_ROWS_EXAMINED, right_idx - left_idx);
+
+        if (slice.covered)
         {
-            // FIXME, cannot handle duplicate rows?
-            // congras, found exact index for range_right
-            return mid;
+            // every row of a covered slice satisfies the query
+            for (int j = left_idx; j < right_idx && handle; j++)
+            {
+                handle(rows[j]);
+            }
+            accepted_cnt += right_idx - left_idx;
+            continue;
         }
 
-        // mid > range_right
-        if (compare(rows[mid], range_left) == 1)
+        for (int j = left_idx; j < right_idx; j++)
         {
-            // printf("DEBUG: (%d,%d)>left_index(%d,%d) nrows(%d) low(%d) mid(%d) high(%d)\n", 
-            //    rows[mid].a, rows[mid].b, range_left.a, range_left.b, nrows, low, mid, high);
-            return search_right_most_rowidx(rows, nrows, 
-                low, mid-1, range_left);
+            if (query_match(query, rows[j]))
+            {
+                if (handle)
+                {
+                    handle(rows[j]);
+                }
+                accepted_cnt++;
+            }
         }
+    }
+    STATS_PHASE_END(STATS_PHASE_SCAN);
+    STATS_PHASE_ADD(STATS_PHASE_SEARCH, search);
+    STATS_COUNT(STATS_ROWS_ACCEPTED, accepted_cnt);
 
-        // mid < range_right
-        if (compare(rows[mid], range_left) == 2)
-        {
-            // printf("DEBUG: (%d,%d)<left_index(%d,%d) nrows(%d) low(%d) mid(%d) high(%d)\n", 
-            //    rows[mid].a, rows[mid].b, range_left.a, range_left.b, nrows, low, mid, high);
-            return search_right_most_rowidx(rows, nrows, 
-                mid+1, high, range_left);
-        }
+    int printed = print_ordered_rows();
+    if (query->limit >= 0)
+    {
+        accepted_cnt = printed;
     }
-    
+    if (ordered_failed)
+    {
+        fprintf(stderr, "WARN: out of memory, the result is incomplete\n");
+    }
+
+    // rows go out before the cost line
+    sink_flush(&result_sink);
+
+    clock_t after = clock();
 
-    return high;
+    printf("---- Cost: %ldus(%.2fms) Total(%d) Found(%d) ----\n", 
+            after-before, ((float)after-(float)before)/1000.0F, nrows , accepted_cnt);
+
+    return accepted_cnt;
 }
 
-void print_ordered_rows()
+static inline bool merge_accept(const void *query, Row row)
 {
-    // printf("DEBUG: printing ordered rows (%d,%d)...\n", 
-                // ordered_rows->value.a, ordered_rows->value.b);
-    // Node* parent = NULL;
-    Node* cur    = ordered_rows;
-    while(cur)
-    {
-        printf("%d,%d\n", cur->value.a, cur->value.b);
-
-        cur = cur->next;
-        /*
-        parent = cur;
-        parent->next = NULL;
-        parent = NULL;
-        free(parent);
-        */
-    }
+    return query_match((const Query *)query, row);
 }
 
 /**
- * @brief Scan given rows with specific handler.
- * 
- * @param rows Rows contain part or all dataset, see Row for more details.
+ * @brief Scan the slices of query in b order when every slice holds a
+ *        single a. Such a slice of the (a,b) sorted rows is a run sorted
+ *        by b, so the runs are merged straight into the sink instead of
+ *        collecting and sorting the accepted rows, see merge.h.
+ *
+ * @param rows Rows contain part or all dataset sorted by (a,b), see Row for more details.
  * @param nrows Number of input rows.
- * @param handle A callback function to let the scanner to 
- *               know whether a row is accepted, callback function
- *               returns true when the scanned row need to be kept,
- *               otherwise return false to remove a scanned row.
- *               You can pass a NULL handle to reject all rows.
- * @return How many rows that accepted by the processor
+ * @param query Parsed query.
+ * @return How many rows that accepted, -1 when the slices are no runs
+ *         and nothing was scanned.
  */
-int scan_process(const Row* rows, int nrows, uint8_t(*handle)(Row))
+int merge_process(const Row* rows, int nrows, const Query *query)
 {
     clock_t before = clock();
-    if (!rows)
+    if (!rows || !query)
     {
         return 0;
     }
 
+    for (int i = 0; i < query->nslices; i++)
+    {
+        if (!slice_single_a(query->slices[i]))
+        {
+            return -1;
+        }
+    }
+
+    int k = query->nslices > 0 ? query->nslices : 1;
+    MergeRun *runs = arena_alloc(&query_arena, sizeof(MergeRun)*k);
+    int *tree = arena_alloc(&query_arena, sizeof(int)*2*k);
+    // runs of the same a share the row count of their first run
+    int *group = arena_alloc(&query_arena, sizeof(int)*k);
+    int64_t *group_cnt = arena_alloc(&query_arena, sizeof(int64_t)*k);
+    if (!runs || !tree || !group || !group_cnt)
+    {
+        return -1;
+    }
+
     int accepted_cnt = 0;
+    int64_t end = query_limit_end(query);
 
-    int n_slices = sizeof(range_slices)/sizeof(RangeSlice);
-    int finished_idx = -1;
-    for (int i = 0; i< n_slices; i++)
+    if (query->nslices > 0)
     {
-        RangeSlice slice = range_slices[i];
-        Row range_left = slice.left;
-        Row range_right = slice.right;
-        // --right most-->|left_index  right_index|<--left most---
-        int right_idx = search_left_most_rowidx(rows, nrows, 0, nrows-1, range_right);
-        int left_idx = search_right_most_rowidx(rows, nrows, 0, nrows-1, range_left);
-        right_idx = right_idx < 0 ? 0 : right_idx;
-        left_idx = left_idx < 0 ? 0 : left_idx;
-        
-        /*
-        printf("DEBUG: (%d,%d)[%d]->(%d,%d)[%d]  finished(%d)\n", 
-                range_left.a, range_left.b, left_idx, 
-                range_right.a, range_right.b, right_idx, finished_idx);
-        */
-       
-        for (int j = left_idx; j <= right_idx && j>=0 && j<nrows; j++)
+        STATS_PHASE_BEGIN(STATS_PHASE_SEARCH);
+        for (int i = 0; i < query->nslices; i++)
         {
-            if (handle && j > finished_idx && handle(rows[j]))
+            RangeSlice slice = query->slices[i];
+            int left_idx, right_idx;
+            eytzinger_slice_range(slice_index, rows, nrows, slice, &left_idx, &right_idx);
+            STATS_COUNT(STATS_ROWS_EXAMINED, right_idx - left_idx);
+
+            // a run never has more than end rows in the limit of its a
+            if (query->limit_by_a && slice.covered && right_idx - left_idx > end)
             {
-                finished_idx = j;
-                accepted_cnt++;
+                right_idx = left_idx + (int)end;
             }
-            // printf("DEBUG: handled (%d,%d)[%d] finished_at(%d)\n", rows[j].a, rows[j].b, j, finished_idx);
+
+            // rows of a covered slice need no check
+            runs[i] = (MergeRun){ rows + left_idx, rows + right_idx,
+                    slice.covered ? NULL : merge_accept, query };
+            group[i] = i > 0 && slice.left.a == query->slices[i - 1].left.a ? group[i - 1] : i;
+            group_cnt[i] = 0;
         }
+
+        STATS_PHASE_END(STATS_PHASE_SEARCH);
+
+        LoserTree merge;
+        merge_init(&merge, runs, query->nslices, tree, MERGE_BY_B);
+
+        // rows come out in b order, a LIMIT stops the merge early
+        int64_t pos = 0;
+        int64_t stop = query->limit_by_a ? INT64_MAX : end;
+        Row row;
+        int from;
+        STATS_PHASE_BEGIN(STATS_PHASE_SORT);
+        while (pos < stop && (from = merge_next(&merge, &row)) >= 0)
+        {
+            int64_t rank = query->limit_by_a ? group_cnt[group[from]]++ : pos++;
+            if (rank < query->offset || rank >= end)
+            {
+                continue;
+            }
+            sink_row(&result_sink, row.a, row.b);
+            accepted_cnt++;
+        }
+        STATS_PHASE_END(STATS_PHASE_SORT);
+        STATS_COUNT(STATS_ROWS_ACCEPTED, accepted_cnt);
     }
 
-    print_ordered_rows();
+    // rows go out before the cost line
+    STATS_PHASE_BEGIN(STATS_PHASE_OUTPUT);
+    sink_flush(&result_sink);
+    STATS_PHASE_END(STATS_PHASE_OUTPUT);
 
     clock_t after = clock();
 
@@ -322,62 +352,40 @@ int scan_process(const Row* rows, int nrows, uint8_t(*handle)(Row))
     return accepted_cnt;
 }
 
+/**
+ * @brief Collect an accepted row, see print_ordered_rows.
+ */
 void ordered_insert(Row row)
 {
-    ordered_rows_count++;
-    Node *node = (Node *)malloc(sizeof(Node));
-    node->value = row;
-    node->next = NULL;
-
-    if (!ordered_rows)
+    if (ordered_query && ordered_query->limit_by_a)
     {
-        ordered_rows = node;
-        ordered_rows_tail = node;
-
-        // printf("DEBUG: created root(%d,%d)\n", row.a,row.b);
-    }
-    else
-    {
-        Node* cur = ordered_rows;
-        while(cur && cur->next && cur->next->value.b < row.b)
+        // rows arrive in (a,b) order, the rows of an a are consecutive
+        if (!query_limit_keep(&group_limit, row))
         {
-            // Move to next when next value < value of input row
-            cur = cur->next;
+            return;
         }
+    }
 
-        node->next = cur->next;
-        cur->next = node;
-
-        // Switch values between root node vs ->next
-        if (cur->value.b > cur->next->value.b)
-        {
-            Row tmp = cur->next->value;
-            cur->next->value = cur->value;
-            cur->value = tmp;
-        }
+    if (top_rows.cap > 0)
+    {
+        topk_push(&top_rows, row);
+        return;
+    }
 
-        // printf("DEBUG: node(%d,%d) is inserted after node(%d,%d)\n", row.a,row.b, cur->value.a, cur->value.b);
+    if (!rowvec_push(&ordered_rows, row))
+    {
+        ordered_failed = true;
     }
 }
 
 /**
- * @brief Handle Row according to task1.
+ * @brief Handle a Row accepted by the query.
  * 
  * @param row immutable object for all row.
- * @return 0 row is accepted
- * @return 1 move to left
- * @return 2 move to right
  */
-uint8_t task4_handle(Row row)
+void task4_handle(Row row)
 {
-    // a in (1000, 2000, 3000) and b between 10 and 50
-    if ((row.a == 1000 || row.a == 2000 || row.a == 3000) && row.b >= 10 && row.b < 50)
-    {
-        ordered_insert(row);
-        return true;
-    }
-
-    return false;
+    ordered_insert(row);
 }
 
 /**
@@ -391,19 +399,57 @@ uint8_t task4_handle(Row row)
  *
  * @param rows The total number of rows.
  * @param nrows The rows, for example rows[0] is the first row.
+ * @param query The parsed WHERE expression, the default is DEFAULT_QUERY.
  */
-void task3(const Row *rows, int nrows)
+void task3(const Row *rows, int nrows, const Query *query)
 {
-    scan_process(rows, nrows, task4_handle);
+    ordered_query = query;
+    group_limit = (QueryLimit){ query, 0, 0 };
+
+    // MATRIXDB_MERGE=0 always collects and sorts the rows.
+    const char *use_merge = getenv("MATRIXDB_MERGE");
+    if ((use_merge && strcmp(use_merge, "0") == 0) || merge_process(rows, nrows, query) < 0)
+    {
+        // ORDER BY b LIMIT k keeps k rows in a bounded heap, not all of them
+        if (query->limit >= 0 && !query->limit_by_a)
+        {
+            topk_init(&top_rows, query_limit_end(query), &query_arena);
+        }
+        scan_process(rows, nrows, query, task4_handle);
+    }
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
+    if (!sink_init(&result_sink, STDOUT_FILENO))
+    {
+        return 1;
+    }
+
+    STATS_INIT();
+    arena_init(&query_arena);
+
+    // The WHERE expression comes from the command line, @path reads it
+    // from a file, see parser.h.
+    char err[256];
+    Query *query = query_parse_arg(argc > 1 ? argv[1] : DEFAULT_QUERY, &query_arena, err, sizeof(err));
+    if (!query)
+    {
+        fprintf(stderr, "invalid query: %s\n", err);
+        return 1;
+    }
+    if (query->group_by_a)
+    {
+        // the output is ordered by b, the groups of a are ordered by a
+        fprintf(stderr, "invalid query: GROUP BY a needs rows ordered by a\n");
+        return 1;
+    }
+
     // Generate dataset to verify given solutions.
     // Row* rows = generate_seed(N_ROWS);
 
     
-    Row rows[] = {
+    Row sample[] = {
         { 1000, 31 },
         { 1000, 72 },
         { 1500, 12 },
@@ -412,18 +458,63 @@ int main(void)
         { 2000, 33 },
     };
 
+    // MATRIXDB_TABLE=path maps the rows from a table file, the file is
+    // written from the sample rows when it does not exist yet.
+    STATS_PHASE_BEGIN(STATS_PHASE_LOAD);
+    const char *table_path = getenv("MATRIXDB_TABLE");
+    TableFile *table_file = NULL;
+    if (table_path && access(table_path, F_OK) == 0)
+    {
+        table_file = open_table(table_path);
+        if (!table_file)
+        {
+            return 1;
+        }
+    }
+    else if (table_path)
+    {
+        char werr[PATH_MAX + 64];
+        if (!tablefile_write_rows(table_path, sample, 6, werr, sizeof(werr)))
+        {
+            fprintf(stderr, "WARN: %s\n", werr);
+        }
+    }
+    const Row *rows = table_file ? table_file->rows : sample;
+    int nrows = table_file ? (int)table_file->header->nrows : 6;
+
+    // Build the Eytzinger layout once after the load when asked for.
+    if (getenv("MATRIXDB_EYTZINGER"))
+    {
+        slice_index = eytzinger_build(rows, nrows);
+    }
+    STATS_PHASE_END(STATS_PHASE_LOAD);
+
     // Execute task1
-    task3(rows, 6);
+    STATS_PHASE_BEGIN(STATS_PHASE_QUERY);
+    task3(rows, nrows, query);
+    STATS_PHASE_END(STATS_PHASE_QUERY);
+
+    // The query is done, everything it allocated is released at once.
+    ordered_rows = (RowVec){ NULL, 0, 0, &query_arena };
+    top_rows = (TopK){ 0 };
+    ordered_query = NULL;
+    ordered_failed = false;
+    arena_reset(&query_arena);
 
     /*
     Row range_left  = {2000,10};
     Row range_right = {2000,50};
 
     printf("(%d,%d)[%d]->(%d,%d)[%d]\n", 
-            range_left.a, range_left.b, search_right_most_rowidx(rows, 6, 0, 5, range_left),
-            range_right.a, range_right.b, search_left_most_rowidx(rows, 6, 0, 5, range_right));
+            range_left.a, range_left.b, rows_lower_bound(rows, 6, row_key(range_left)),
+            range_right.a, range_right.b, rows_lower_bound(rows, 6, row_key(range_right)));
     */
     // Destroy generated dataset.
+    eytzinger_free(slice_index);
+    arena_destroy(&query_arena);
+    sink_close(&result_sink);
     // free(rows);
+    tablefile_close(table_file);
+    STATS_REPORT();
 }
  
\ No newline at end of file
@@ -0,0 +1,113 @@
+#ifndef MATRIXDB_TOPK_H
+#define MATRIXDB_TOPK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "row.h"
+#include "arena.h"
+
+/*
+ * Bounded heap of the k first rows by b, for ORDER BY b LIMIT k. The
+ * heap keeps the largest of the k rows at its root, a new row either
+ * replaces it or is dropped, O(log k) per row and O(k) memory however
+ * many rows match. Rows with the same b keep their arrival order.
+ */
+
+// Larger limits collect and sort all rows instead.
+#define TOPK_MAX_HEAP (1 << 20)
+
+typedef struct TopKEntry {
+    uint64_t key; // order preserving b in the high, arrival in the low half
+    Row row;
+} TopKEntry;
+
+typedef struct TopK {
+    TopKEntry *heap;
+    int n;
+    int cap;      // k, 0 when the heap is not in use
+    uint32_t seq; // rows pushed so far
+} TopK;
+
+/**
+ * @brief Prepare topk for the k first rows.
+ *
+ * @return false when k is 0, above TOPK_MAX_HEAP or out of memory.
+ */
+static inline bool topk_init(TopK *topk, int64_t k, Arena *arena)
+{
+    topk->heap = NULL;
+    topk->n = topk->cap = 0;
+    topk->seq = 0;
+    if (k <= 0 || k > TOPK_MAX_HEAP)
+    {
+        return false;
+    }
+
+    topk->heap = arena_alloc(arena, sizeof(TopKEntry)*k);
+    topk->cap = topk->heap ? (int)k : 0;
+    return topk->heap != NULL;
+}
+
+static inline void topk_sift_down(TopKEntry *heap, int n, int i)
+{
+    TopKEntry e = heap[i];
+    for (int c = 2*i + 1; c < n; i = c, c = 2*i + 1)
+    {
+        if (c + 1 < n && heap[c + 1].key > heap[c].key)
+        {
+            c++;
+        }
+        if (heap[c].key <= e.key)
+        {
+            break;
+        }
+        heap[i] = heap[c];
+    }
+    heap[i] = e;
+}
+
+static inline void topk_push(TopK *topk, Row row)
+{
+    uint64_t key = (uint64_t)((uint32_t)row.b ^ 0x80000000u) << 32 | topk->seq++;
+    // one compare against the root, two per level of a sift at most
+    STATS_COUNT(STATS_COMPARES, 1 + (topk->n > 0 && topk->n == topk->cap && key < topk->heap[0].key ?
+            2*stats_search_depth(topk->n) : 0));
+
+    if (topk->n < topk->cap)
+    {
+        int i = topk->n++;
+        for (; i > 0 && topk->heap[(i - 1)/2].key < key; i = (i - 1)/2)
+        {
+            topk->heap[i] = topk->heap[(i - 1)/2];
+        }
+        topk->heap[i] = (TopKEntry){ key, row };
+    }
+    else if (key < topk->heap[0].key)
+    {
+        topk->heap[0] = (TopKEntry){ key, row };
+        topk_sift_down(topk->heap, topk->n, 0);
+    }
+}
+
+/**
+ * @brief Sort the kept rows by b into out, the heap is consumed.
+ *
+ * @param out Room for topk->n rows.
+ * @return Number of rows.
+ */
+static inline int topk_finish(TopK *topk, Row *out)
+{
+    // heap sort, the root goes to the back
+    int n = topk->n;
+    for (int end = n - 1; end >= 0; end--)
+    {
+        out[end] = topk->heap[0].row;
+        topk->heap[0] = topk->heap[end];
+        topk_sift_down(topk->heap, end, 0);
+    }
+    topk->n = 0;
+    return n;
+}
+
+#endif // MATRIXDB_TOPK_H
@@ -0,0 +1,233 @@
+#ifndef MATRIXDB_ZONEMAP_H
+#define MATRIXDB_ZONEMAP_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include "table.h"
+#include "filter.h"
+#include "parser.h"
+#include "stats.h"
+
+// Rows per zone, a multiple of the SIMD width and of a cache line.
+#define ZONEMAP_BLOCK_ROWS 4096
+
+/**
+ * @brief Min/max of both columns of one block of rows.
+ */
+typedef struct Zone {
+    int min_a;
+    int max_a;
+    int min_b;
+    int max_b;
+} Zone;
+
+/**
+ * @brief Zone map of a table, zones[i] covers the rows
+ *        [i*block_rows, (i+1)*block_rows).
+ */
+typedef struct ZoneMap {
+    int   nblocks;
+    int   block_rows;
+    Zone *zones;
+    bool  mapped; // zones live in a table file, see tablefile.h
+} ZoneMap;
+
+/**
+ * @brief Build the zone map of table, one pass over both columns.
+ * 
+ * @return ZoneMap* the zone map, NULL when out of memory.
+ */
+static inline ZoneMap* zonemap_build(const Table *table)
+{
+    ZoneMap *map = calloc(1, sizeof(ZoneMap));
+    if (!map)
+    {
+        return NULL;
+    }
+
+    map->block_rows = ZONEMAP_BLOCK_ROWS;
+    map->nblocks = (table->nrows + ZONEMAP_BLOCK_ROWS - 1) / ZONEMAP_BLOCK_ROWS;
+    map->zones = malloc(sizeof(Zone)*(map->nblocks > 0 ? map->nblocks : 1));
+    if (!map->zones)
+    {
+        free(map);
+        return NULL;
+    }
+
+    for (int blk = 0; blk < map->nblocks; blk++)
+    {
+        int begin = blk*ZONEMAP_BLOCK_ROWS;
+        int end = begin + ZONEMAP_BLOCK_ROWS < table->nrows ? begin + ZONEMAP_BLOCK_ROWS : table->nrows;
+        Zone zone = { INT_MAX, INT_MIN, INT_MAX, INT_MIN };
+
+        for (int i = begin; i < end; i++)
+        {
+            // written as selects so the loop vectorizes
+            zone.min_a = table->a[i] < zone.min_a ? table->a[i] : zone.min_a;
+            zone.max_a = table->a[i] > zone.max_a ? table->a[i] : zone.max_a;
+            zone.min_b = table->b[i] < zone.min_b ? table->b[i] : zone.min_b;
+            zone.max_b = table->b[i] > zone.max_b ? table->b[i] : zone.max_b;
+        }
+
+        map->zones[blk] = zone;
+    }
+
+    return map;
+}
+
+static inline void zonemap_free(ZoneMap *map)
+{
+    if (!map)
+    {
+        return;
+    }
+
+    if (!map->mapped)
+    {
+        free(map->zones);
+    }
+    free(map);
+}
+
+/**
+ * @brief Whether some row of zone may satisfy pred, false only when
+ *        no row of the block can.
+ */
+static inline bool zone_may_match(const Zone *zone, const ScanPredicate *pred)
+{
+    if (zone->max_b < pred->b_low || zone->min_b > pred->b_high)
+    {
+        return false;
+    }
+
+    if (!pred->a_in)
+    {
+        return true;
+    }
+
+    for (int k = 0; k < pred->n_a_in; k++)
+    {
+        if (pred->a_in[k] >= zone->min_a && pred->a_in[k] <= zone->max_a)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Whether some row of zone may satisfy query, see zone_may_match.
+ */
+static inline bool zone_may_match_query(const Zone *zone, const Query *query)
+{
+    for (int i = 0; i < query->ngroups; i++)
+    {
+        const QueryGroup *group = &query->groups[i];
+        if (group->b_lo <= zone->max_b && group->b_hi >= zone->min_b &&
+                inlist_intersects(&group->a, zone->min_a, zone->max_a))
+        {
+            return true;
+        }
+    }
+    if (query->groups)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < query->where.nboxes; i++)
+    {
+        const Box *box = &query->where.boxes[i];
+        if (box->a_lo <= zone->max_a && box->a_hi >= zone->min_a &&
+                box->b_lo <= zone->max_b && box->b_hi >= zone->min_b)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Zone test of a scan, false only when no row of zone can match.
+ */
+typedef bool (*ZoneTest)(const void *env, const Zone *zone);
+
+static inline bool zone_test_predicate(const void *env, const Zone *zone)
+{
+    return zone_may_match(zone, (const ScanPredicate *)env);
+}
+
+static inline bool zone_test_query(const void *env, const Zone *zone)
+{
+    return zone_may_match_query(zone, (const Query *)env);
+}
+
+/**
+ * @brief A RangeSelect guarded by a zone map.
+ */
+typedef struct ZoneScan {
+    const ZoneMap *map;   // zone map, NULL scans every block
+    ZoneTest may_match;   // zone test of the predicate
+    const void *test_env; // passed to may_match
+    RangeSelect select;   // evaluates the predicate over a range of rows
+    const void *env;      // passed to select
+} ZoneScan;
+
+/**
+ * @brief RangeSelect that skips every block its zone rules out, runs
+ *        of adjacent candidate blocks go to the inner select at once.
+ *        begin must be a multiple of the block size.
+ */
+static inline int zone_scan_select(const void *arg, int begin, int end, int *sel)
+{
+    const ZoneScan *scan = (const ZoneScan *)arg;
+    const ZoneMap *map = scan->map;
+    int nsel = 0;
+
+    int blk = begin / map->block_rows;
+    int end_blk = (end + map->block_rows - 1) / map->block_rows;
+    while (blk < end_blk)
+    {
+        while (blk < end_blk && !scan->may_match(scan->test_env, &map->zones[blk]))
+        {
+            STATS_COUNT(STATS_BLOCKS_SKIPPED, 1);
+            blk++;
+        }
+
+        int run = blk;
+        while (run < end_blk && scan->may_match(scan->test_env, &map->zones[run]))
+        {
+            run++;
+        }
+
+        if (run > blk)
+        {
+            int run_end = run*map->block_rows < end ? run*map->block_rows : end;
+            STATS_COUNT(STATS_ROWS_EXAMINED, run_end - blk*map->block_rows);
+            nsel += scan->select(scan->env, blk*map->block_rows, run_end, sel + nsel);
+        }
+        blk = run;
+    }
+
+    return nsel;
+}
+
+/**
+ * @brief Run scan over rows [0, nrows) on nthreads threads, see
+ *        select_parallel. Partitions are aligned to zone blocks.
+ */
+static inline int zone_scan_parallel(const ZoneScan *scan, int nrows, int nthreads, int *sel)
+{
+    if (!scan->map)
+    {
+        STATS_COUNT(STATS_ROWS_EXAMINED, nrows);
+        return select_parallel(scan->select, scan->env, nrows, nthreads, 16, sel);
+    }
+
+    return select_parallel(zone_scan_select, scan, nrows, nthreads, scan->map->block_rows, sel);
+}
+
+#endif // MATRIXDB_ZONEMAP_H
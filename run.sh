@@ -3,8 +3,10 @@
 # build and run program snippets in localwork
 wk_space="$1"
 prog_name="$2"
+# remaining arguments are passed to the program, e.g. a WHERE expression
+shift 2
 
-# gcc -ggdb -fsanitize=address -fno-omit-frame-pointer -o ${prog_name} ${wk_space}/c/${prog_name}.c -lpthread
-gcc -o ${prog_name} ${wk_space}/c/${prog_name}.c -lpthread
+# gcc -ggdb -fsanitize=address -fno-omit-frame-pointer -o ${prog_name} ${wk_space}/c/${prog_name}.c -lpthread -ldl -lm
+gcc -o ${prog_name} ${wk_space}/c/${prog_name}.c -lpthread -ldl -lm
 
-./${prog_name}
\ No newline at end of file
+./${prog_name} "$@"
\ No newline at end of file